@@ -0,0 +1,756 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+// Microbenchmarks for the hot paths of detection and training
+// Usage: CRBenchmark [-c] [-r repetitions] [-o results.json] [-t tree_prefix number_of_trees] [-p patch_width patch_height] [image ...]
+// Every benchmark runs on a synthetic image and on the given images (default: example/testimages/test0.png);
+// the voting also runs on a large synthetic image
+// Before, the detection kernels are compared with the reference implementations (CRReference) on random 
+// images and the given images; the program fails if they differ (-c: only compare)
+
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <highgui.h>
+
+#include "CRForestDetector.h"
+#include "CRReference.h"
+
+using namespace std;
+
+// Benchmark: only run() is timed; setup() prepares the input for each run
+class Bench {
+public:
+	Bench(const string& n, double i) : name(n), items(i) {}
+	virtual ~Bench() {}
+	virtual void setup() {}
+	virtual void run() = 0;
+	virtual void teardown() {}
+
+	string name;
+	// number of items (pixels, patches, tests) processed by one run
+	double items;
+};
+
+// Timing statistics of a benchmark in seconds per run
+struct BenchResult {
+	string name;
+	string input;
+	double items;
+	int iterations;
+	vector<double> vTime;
+};
+
+// Access to the private functions of trees and detector
+class CRBenchmark {
+public:
+	static void detectColor(const CRForestDetector& crDetect, const vector<IplImage*>& vImg, vector<IplImage*>& imgDetect, vector<float>& ratios) {
+		const_cast<CRForestDetector&>(crDetect).detectColor(vImg, imgDetect, ratios);
+	}
+
+	// Training state of tree for all patches
+	static void initTraining(CRTree& tree, const CRPatch& Train, NodeSet& Root) {
+		tree.trData = &Train;
+		tree.vIndex.resize(Train.vLPatches.size());
+		unsigned int max_size = 0;
+		Root.begin.resize(tree.vIndex.size());
+		Root.end.resize(tree.vIndex.size());
+		for(unsigned int l=0; l<tree.vIndex.size(); ++l) {
+			tree.vIndex[l].resize(Train.vLPatches[l].size());
+			for(unsigned int i=0; i<tree.vIndex[l].size(); ++i)
+				tree.vIndex[l][i] = i;
+			max_size = max(max_size, (unsigned int)tree.vIndex[l].size());
+			Root.begin[l] = tree.indexBase(l);
+			Root.end[l] = Root.begin[l] + tree.vIndex[l].size();
+		}
+		tree.vBuffer.resize(max_size);
+	}
+	static void generateTest(CRTree& tree, int* test, const CRPatch& Train) {
+		const PatchArena& pos = Train.vLPatches[1];
+		tree.generateTest(test, pos.GetWidth(), pos.GetHeight(), pos.GetChannels());
+	}
+	static void evaluateTest(CRTree& tree, vector<vector<vector<IntIndex> > >& valSet, const int* test, unsigned int num_tests, const NodeSet& Root) {
+		tree.evaluateTest(valSet, test, num_tests, Root);
+	}
+	static void split(CRTree& tree, NodeSet& SetA, NodeSet& SetB, const NodeSet& Root, const int* test) {
+		tree.split(SetA, SetB, Root, test);
+	}
+	static double InfGain(CRTree& tree, const vector<vector<IntIndex> >& valSet, const vector<unsigned int>& vSplit) {
+		return tree.InfGain(valSet, vSplit);
+	}
+	static double distMean(CRTree& tree, const vector<vector<IntIndex> >& valSet, const vector<unsigned int>& vSplit) {
+		return tree.distMean(valSet, vSplit);
+	}
+};
+
+// Time of monotonic clock in seconds
+static double now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+// Run benchmark: one warm up run, then repetitions samples; each sample averages enough runs
+// to take at least min_time seconds
+BenchResult runBench(Bench& bench, const string& input, int repetitions, double min_time) {
+	BenchResult res;
+	res.name = bench.name;
+	res.input = input;
+	res.items = bench.items;
+
+	bench.setup();
+	double t = now();
+	bench.run();
+	t = now() - t;
+	bench.teardown();
+	res.iterations = t>=min_time ? 1 : int(min_time/max(t, 1e-9)) + 1;
+
+	for(int r=0; r<repetitions; ++r) {
+		double sum = 0;
+		for(int i=0; i<res.iterations; ++i) {
+			bench.setup();
+			t = now();
+			bench.run();
+			sum += now() - t;
+			bench.teardown();
+		}
+		res.vTime.push_back(sum / res.iterations);
+	}
+
+	return res;
+}
+
+// mean, standard deviation, min, median, max
+void stats(const vector<double>& vTime, double* s) {
+	vector<double> v(vTime);
+	sort(v.begin(), v.end());
+	double mean = 0, var = 0;
+	for(unsigned int i=0; i<v.size(); ++i)
+		mean += v[i];
+	mean /= v.size();
+	for(unsigned int i=0; i<v.size(); ++i)
+		var += (v[i]-mean)*(v[i]-mean);
+	s[0] = mean;
+	s[1] = v.size()>1 ? sqrt(var/(v.size()-1)) : 0;
+	s[2] = v.front();
+	s[3] = v.size()%2==1 ? v[v.size()/2] : 0.5*(v[v.size()/2-1] + v[v.size()/2]);
+	s[4] = v.back();
+}
+
+/////////////////////// Benchmarks /////////////////////////////
+
+// Feature channels of image (img is converted to Lab, i.e., a copy is used)
+class BenchFeatures : public Bench {
+public:
+	BenchFeatures(IplImage* im) : Bench("features/extractFeatureChannels", im->width*im->height), img(im), tmp(0) {}
+	void setup() {tmp = cvCloneImage(img);}
+	void run() {CRPatch::extractFeatureChannels(tmp, vImg);}
+	void teardown() {
+		for(unsigned int c=0; c<vImg.size(); ++c)
+			cvReleaseImage(&vImg[c]);
+		cvReleaseImage(&tmp);
+	}
+	IplImage* img;
+	IplImage* tmp;
+	vector<IplImage*> vImg;
+};
+
+// Stages of extractFeatureChannels in the same order on the same buffers
+class BenchStage : public Bench {
+public:
+	enum {gray, sobel, orientation, magnitude, hog_bins, sobel2, lab, minfilter, maxfilter};
+
+	BenchStage(IplImage* im, int s, const char* n) : Bench(n, im->width*im->height), img(im), stage(s) {
+		tmp = cvCloneImage(img);
+		vImg.resize(32);
+		for(unsigned int c=0; c<vImg.size(); ++c)
+			vImg[c] = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U , 1);
+		I_x = cvCreateImage(cvGetSize(img), IPL_DEPTH_16S, 1);
+		I_y = cvCreateImage(cvGetSize(img), IPL_DEPTH_16S, 1);
+
+		// input of stage: all stages before it (the filters run on the 16 extracted channels)
+		for(int s=gray; s<stage; ++s)
+			runStage(s);
+
+		// the max filter runs in place and gets a fresh copy of the channels for each run
+		if(stage==maxfilter) {
+			vSrc.resize(16);
+			for(unsigned int c=0; c<vSrc.size(); ++c)
+				vSrc[c] = cvCloneImage(vImg[c]);
+		}
+	}
+	~BenchStage() {
+		for(unsigned int c=0; c<vImg.size(); ++c)
+			cvReleaseImage(&vImg[c]);
+		for(unsigned int c=0; c<vSrc.size(); ++c)
+			cvReleaseImage(&vSrc[c]);
+		cvReleaseImage(&I_x);
+		cvReleaseImage(&I_y);
+		cvReleaseImage(&tmp);
+	}
+	void setup() {
+		if(stage==lab) cvCopy(img, tmp);
+		for(unsigned int c=0; c<vSrc.size(); ++c)
+			cvCopy(vSrc[c], vImg[c]);
+	}
+	void run() {
+		runStage(stage);
+	}
+	void runStage(int s) {
+		switch(s) {
+			case gray: cvCvtColor( img, vImg[0], CV_RGB2GRAY ); break;
+			case sobel:
+				cvSobel(vImg[0],I_x,1,0,3);
+				cvSobel(vImg[0],I_y,0,1,3);
+				cvConvertScaleAbs( I_x, vImg[3], 0.25);
+				cvConvertScaleAbs( I_y, vImg[4], 0.25);
+				break;
+			case orientation: CRPatch::gradientOrientation(I_x, I_y, vImg[1]); break;
+			case magnitude: CRPatch::gradientMagnitude(I_x, I_y, vImg[2]); break;
+			case hog_bins: hog.extractOBin(vImg[1], vImg[2], vImg, 7); break;
+			case sobel2:
+				cvSobel(vImg[0],I_x,2,0,3);
+				cvConvertScaleAbs( I_x, vImg[5], 0.25);
+				cvSobel(vImg[0],I_y,0,2,3);
+				cvConvertScaleAbs( I_y, vImg[6], 0.25);
+				break;
+			case lab:
+				cvCvtColor( tmp, tmp, CV_RGB2Lab  );
+				cvSplit( tmp, vImg[0], vImg[1], vImg[2], 0);
+				break;
+			case minfilter:
+				for(int c=0; c<16; ++c)
+					CRPatch::minfilt(vImg[c], vImg[c+16], 5);
+				break;
+			case maxfilter:
+				for(int c=0; c<16; ++c)
+					CRPatch::maxfilt(vImg[c], 5);
+				break;
+		}
+	}
+	IplImage* img;
+	IplImage* tmp;
+	int stage;
+	vector<IplImage*> vImg;
+	vector<IplImage*> vSrc;
+	IplImage* I_x;
+	IplImage* I_y;
+};
+
+// Regression of all patches of an image
+class BenchRegression : public Bench {
+public:
+	BenchRegression(const CRForest& forest, const vector<IplImage*>& vI, int w, int h) :
+		Bench("detect/regression", double(vI[0]->width-w)*(vI[0]->height-h)), crForest(forest), vImg(vI), width(w), height(h), leafs(0) {}
+	void run() {
+		int stepImg;
+		vector<uchar*> ptFCh(vImg.size());
+		for(unsigned int c=0; c<vImg.size(); ++c)
+			cvGetRawData( vImg[c], &ptFCh[c], &stepImg);
+
+		vector<uchar*> ptFCh_row(vImg.size());
+		vector<const FlatLeaf*> result;
+		for(int y=0; y<vImg[0]->height-height; ++y) {
+			for(unsigned int c=0; c<vImg.size(); ++c)
+				ptFCh_row[c] = ptFCh[c] + y*stepImg;
+			for(int x=0; x<vImg[0]->width-width; ++x) {
+				crForest.regression(result, &ptFCh_row[0], stepImg);
+				leafs += result[0]->count;
+				for(unsigned int c=0; c<vImg.size(); ++c)
+					++ptFCh_row[c];
+			}
+		}
+	}
+	const CRForest& crForest;
+	const vector<IplImage*>& vImg;
+	int width;
+	int height;
+	// keeps the regression from being optimized away
+	unsigned long long leafs;
+};
+
+// Regression and voting of all patches of an image (detectColor) with voting mode (see CRForestDetector::SetVoting)
+class BenchVoting : public Bench {
+public:
+	BenchVoting(const CRForestDetector& det, const vector<IplImage*>& vI, int w, int h, int mode = 0) :
+		Bench(mode==1 ? "detect/voting-grouped" : "detect/voting", double(vI[0]->width-w)*(vI[0]->height-h)), crDetect(det), vImg(vI) {
+		crDetect.SetVoting(mode);
+		// one Hough image per object class
+		for(unsigned int k=0; k<det.GetNumClasses(); ++k)
+			imgDetect.push_back(cvCreateImage(cvGetSize(vImg[0]), IPL_DEPTH_32F, 1));
+		ratios.push_back(1.0f);
+	}
+	~BenchVoting() {for(unsigned int k=0; k<imgDetect.size(); ++k) cvReleaseImage(&imgDetect[k]);}
+	void run() {CRBenchmark::detectColor(crDetect, vImg, imgDetect, ratios);}
+	CRForestDetector crDetect;
+	const vector<IplImage*>& vImg;
+	vector<IplImage*> imgDetect;
+	vector<float> ratios;
+};
+
+// Functions for finding the test of the root node
+class BenchTraining : public Bench {
+public:
+	enum {evaluate, split, infgain, distmean};
+
+	BenchTraining(CRTree& t, const CRPatch& Train, int f, const char* n) : Bench(n, 1), tree(t), func(f), result(0) {
+		CRBenchmark::initTraining(tree, Train, Root);
+		test.resize(num_tests*5);
+		for(unsigned int k=0; k<num_tests; ++k)
+			CRBenchmark::generateTest(tree, &test[k*5], Train);
+		// first test with threshold for split
+		for(int t=0; t<5; ++t)
+			splitTest[t] = test[t];
+		splitTest[5] = 0;
+
+		valSet.resize(num_tests);
+		for(unsigned int k=0; k<num_tests; ++k)
+			valSet[k].resize(Root.begin.size());
+		CRBenchmark::evaluateTest(tree, valSet, &test[0], num_tests, Root);
+		vSplit.resize(Root.begin.size());
+		for(unsigned int l=0; l<vSplit.size(); ++l)
+			vSplit[l] = Root.size(l)/2;
+
+		unsigned int patches = 0;
+		for(unsigned int l=0; l<Root.begin.size(); ++l)
+			patches += Root.size(l);
+		items = func==evaluate ? patches*num_tests : (func==split ? patches : num_tests);
+	}
+	void run() {
+		switch(func) {
+			case evaluate: CRBenchmark::evaluateTest(tree, valSet, &test[0], num_tests, Root); break;
+			case split: CRBenchmark::split(tree, SetA, SetB, Root, splitTest); break;
+			case infgain:
+				for(unsigned int k=0; k<num_tests; ++k)
+					result += CRBenchmark::InfGain(tree, valSet[k], vSplit);
+				break;
+			case distmean:
+				for(unsigned int k=0; k<num_tests; ++k)
+					result += CRBenchmark::distMean(tree, valSet[k], vSplit);
+				break;
+		}
+	}
+	CRTree& tree;
+	int func;
+	static const unsigned int num_tests = 10;
+	vector<int> test;
+	int splitTest[6];
+	NodeSet Root, SetA, SetB;
+	vector<vector<vector<IntIndex> > > valSet;
+	vector<unsigned int> vSplit;
+	double result;
+};
+
+/////////////////////// Comparison with reference /////////////////////////////
+
+// Number of pixels that differ by more than tol (8 bit or float images)
+int compareImages(const IplImage* a, const IplImage* b, double tol, double* max_diff) {
+	int num = 0;
+	*max_diff = 0;
+	for(int y=0; y<a->height; ++y) {
+		for(int x=0; x<a->width; ++x) {
+			double va, vb;
+			if(a->depth==IPL_DEPTH_32F) {
+				va = ((const float*)(a->imageData + y*a->widthStep))[x];
+				vb = ((const float*)(b->imageData + y*b->widthStep))[x];
+			} else {
+				va = ((const uchar*)(a->imageData + y*a->widthStep))[x];
+				vb = ((const uchar*)(b->imageData + y*b->widthStep))[x];
+			}
+			double d = fabs(va-vb);
+			*max_diff = max(*max_diff, d);
+			if(d>tol)
+				++num;
+		}
+	}
+	return num;
+}
+
+// Report result of a comparison; returns false if the kernel differs from the reference
+bool report(const string& input, const char* kernel, int num, int total, double max_diff) {
+	if(num>0)
+		cout << "DIFFERENT " << input << " " << kernel << ": " << num << " of " << total << " values (max difference " << max_diff << ")" << endl;
+	return num==0;
+}
+
+void releaseImages(vector<IplImage*>& vImg) {
+	for(unsigned int c=0; c<vImg.size(); ++c)
+		cvReleaseImage(&vImg[c]);
+	vImg.clear();
+}
+
+// Compare detection kernels of image with the reference; all comparisons are exact
+// except for the Hough images (tolerance for the sum of votes)
+bool checkImage(const string& input, IplImage* img, const CRForest& crForest, const CRForestDetector& crDetect, int p_width, int p_height, CvRNG* pRNG) {
+	bool same = true;
+	double max_diff;
+	int num;
+	int total = img->width*img->height;
+
+	// feature channels
+	vector<IplImage*> vImg, vRef;
+	IplImage* tmp = cvCloneImage(img);
+	CRPatch::extractFeatureChannels(tmp, vImg);
+	cvCopy(img, tmp);
+	CRReference::extractFeatureChannels(tmp, vRef);
+	cvReleaseImage(&tmp);
+	for(unsigned int c=0; c<vImg.size(); ++c) {
+		char buffer[40];
+		sprintf(buffer, "extractFeatureChannels[%d]", c);
+		num = compareImages(vImg[c], vRef[c], 0, &max_diff);
+		same &= report(input, buffer, num, total, max_diff);
+	}
+
+	// stages on the reference channels
+	IplImage* I_x = cvCreateImage(cvGetSize(img), IPL_DEPTH_16S, 1);
+	IplImage* I_y = cvCreateImage(cvGetSize(img), IPL_DEPTH_16S, 1);
+	IplImage* gray = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+	IplImage* out = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+	IplImage* ref = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+	cvCvtColor(img, gray, CV_RGB2GRAY);
+	cvSobel(gray, I_x, 1, 0, 3);
+	cvSobel(gray, I_y, 0, 1, 3);
+
+	CRPatch::gradientOrientation(I_x, I_y, out);
+	CRReference::gradientOrientation(I_x, I_y, ref);
+	same &= report(input, "gradientOrientation", compareImages(out, ref, 0, &max_diff), total, max_diff);
+	vector<IplImage*> vHoG(9), vHoGRef(9);
+	for(int l=0; l<9; ++l) {
+		vHoG[l] = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+		vHoGRef[l] = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+	}
+	IplImage* orient = cvCloneImage(ref);
+	CRPatch::gradientMagnitude(I_x, I_y, out);
+	CRReference::gradientMagnitude(I_x, I_y, ref);
+	same &= report(input, "gradientMagnitude", compareImages(out, ref, 0, &max_diff), total, max_diff);
+	hog.extractOBin(orient, ref, vHoG, 0);
+	CRReference::extractOBin(orient, ref, vHoGRef, 0);
+	for(int l=0; l<9; ++l) {
+		num = compareImages(vHoG[l], vHoGRef[l], 0, &max_diff);
+		same &= report(input, "extractOBin", num, total, max_diff);
+	}
+	releaseImages(vHoG);
+	releaseImages(vHoGRef);
+	cvReleaseImage(&orient);
+
+	// min/max filter (in place and into another image) for all reference channels
+	IplImage* src = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+	IplImage* src_ref = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+	for(unsigned int c=0; c<vRef.size(); ++c) {
+		for(int k=0; k<2; ++k) {
+			cvCopy(vRef[c], src);
+			cvCopy(vRef[c], src_ref);
+			if(k==0) {
+				CRPatch::maxfilt(src, out, 5);
+				CRReference::maxfilt(src_ref, ref, 5);
+			} else {
+				CRPatch::minfilt(src, out, 5);
+				CRReference::minfilt(src_ref, ref, 5);
+			}
+			num = compareImages(out, ref, 0, &max_diff);
+			num += compareImages(src, src_ref, 0, &max_diff);
+			same &= report(input, k==0 ? "maxfilt" : "minfilt", num, 2*total, max_diff);
+
+			cvCopy(vRef[c], src);
+			cvCopy(vRef[c], src_ref);
+			if(k==0) {
+				CRPatch::maxfilt(src, 5);
+				CRReference::maxfilt(src_ref, 5);
+			} else {
+				CRPatch::minfilt(src, 5);
+				CRReference::minfilt(src_ref, 5);
+			}
+			num = compareImages(src, src_ref, 0, &max_diff);
+			same &= report(input, k==0 ? "maxfilt (in place)" : "minfilt (in place)", num, total, max_diff);
+		}
+	}
+	cvReleaseImage(&src);
+	cvReleaseImage(&src_ref);
+	cvReleaseImage(&I_x);
+	cvReleaseImage(&I_y);
+	cvReleaseImage(&gray);
+	cvReleaseImage(&out);
+	cvReleaseImage(&ref);
+
+	// regression for the feature channels and for random channels (all branches of the trees)
+	vector<IplImage*> vRand(vRef.size());
+	for(unsigned int c=0; c<vRand.size(); ++c) {
+		vRand[c] = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+		cvRandArr(pRNG, vRand[c], CV_RAND_UNI, cvScalarAll(0), cvScalarAll(256));
+	}
+	for(int k=0; k<2; ++k) {
+		const vector<IplImage*>& vCh = k==0 ? vRef : vRand;
+		int stepImg = vCh[0]->widthStep;
+		vector<uchar*> ptFCh(vCh.size());
+		vector<const FlatLeaf*> result;
+		num = 0;
+		total = 0;
+		for(int y=0; y<img->height-p_height; ++y) {
+			for(int x=0; x<img->width-p_width; ++x) {
+				for(unsigned int c=0; c<vCh.size(); ++c)
+					ptFCh[c] = (uchar*)vCh[c]->imageData + y*stepImg + x;
+				crForest.regression(result, &ptFCh[0], stepImg);
+				for(unsigned int t=0; t<result.size(); ++t, ++total)
+					if(result[t]!=CRReference::regression(*crForest.vTrees[t], &ptFCh[0], stepImg))
+						++num;
+			}
+		}
+		same &= report(input, k==0 ? "regression" : "regression (random channels)", num, total, 0);
+	}
+	releaseImages(vRand);
+
+	// voting (detectColor), direct and grouped by leaf
+	vector<float> ratios(2);
+	ratios[0] = 1.0f;
+	ratios[1] = 0.75f;
+	vector<IplImage*> vDet(ratios.size()*crForest.GetNumClasses()), vDetRef(vDet.size());
+	for(unsigned int c=0; c<vDet.size(); ++c) {
+		vDet[c] = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
+		vDetRef[c] = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
+	}
+	CRReference::vote(crForest, p_width, p_height, vRef, vDetRef, ratios);
+	for(int mode=0; mode<2; ++mode) {
+		CRForestDetector crVote(crDetect);
+		crVote.SetVoting(mode);
+		CRBenchmark::detectColor(crVote, vRef, vDet, ratios);
+		for(unsigned int c=0; c<vDet.size(); ++c) {
+			num = compareImages(vDet[c], vDetRef[c], 1e-5, &max_diff);
+			same &= report(input, mode==0 ? "detectColor" : "detectColor (grouped)", num, img->width*img->height, max_diff);
+		}
+	}
+	releaseImages(vDet);
+	releaseImages(vDetRef);
+
+	releaseImages(vImg);
+	releaseImages(vRef);
+
+	if(same)
+		cout << "Same as reference: " << input << endl;
+	return same;
+}
+
+/////////////////////// Main /////////////////////////////
+
+// Synthetic color image: smoothed noise, i.e., the same input on every machine
+IplImage* syntheticImage(int width, int height) {
+	IplImage* img = cvCreateImage(cvSize(width,height), IPL_DEPTH_8U, 3);
+	CvRNG rng = cvRNG(1);
+	cvRandArr(&rng, img, CV_RAND_UNI, cvScalarAll(0), cvScalarAll(256));
+	cvSmooth(img, img, CV_GAUSSIAN, 5);
+	return img;
+}
+
+// String as JSON string literal
+string jsonString(const string& str) {
+	string res = "\"";
+	for(unsigned int i=0; i<str.size(); ++i) {
+		unsigned char ch = str[i];
+		if(ch=='"' || ch=='\\') {
+			res += '\\';
+			res += ch;
+		} else if(ch<0x20) {
+			char buffer[8];
+			sprintf(buffer, "\\u%04x", ch);
+			res += buffer;
+		} else {
+			res += ch;
+		}
+	}
+	return res + "\"";
+}
+
+void writeJSON(const char* filename, const vector<BenchResult>& vRes, int repetitions, double min_time) {
+	ofstream out(filename);
+	if(!out.is_open()) {
+		cerr << "Could not write " << filename << endl;
+		exit(-1);
+	}
+	out.precision(10);
+	out << "{" << endl;
+	out << "  \"repetitions\": " << repetitions << "," << endl;
+	out << "  \"min_time_s\": " << min_time << "," << endl;
+	out << "  \"results\": [" << endl;
+	for(unsigned int i=0; i<vRes.size(); ++i) {
+		double s[5];
+		stats(vRes[i].vTime, s);
+		out << "    {\"name\": " << jsonString(vRes[i].name) << ", \"input\": " << jsonString(vRes[i].input) << ", ";
+		out << "\"items\": " << vRes[i].items << ", \"iterations\": " << vRes[i].iterations << ", \"samples\": " << vRes[i].vTime.size() << ", ";
+		out << "\"mean_ns\": " << 1e9*s[0] << ", \"stddev_ns\": " << 1e9*s[1] << ", \"min_ns\": " << 1e9*s[2] << ", ";
+		out << "\"median_ns\": " << 1e9*s[3] << ", \"max_ns\": " << 1e9*s[4] << ", \"median_ns_per_item\": " << 1e9*s[3]/vRes[i].items << "}";
+		out << (i+1<vRes.size() ? "," : "") << endl;
+	}
+	out << "  ]" << endl << "}" << endl;
+}
+
+void add(vector<BenchResult>& vRes, Bench& bench, const string& input, int repetitions, double min_time) {
+	vRes.push_back(runBench(bench, input, repetitions, min_time));
+	double s[5];
+	stats(vRes.back().vTime, s);
+	cout.precision(4);
+	cout << input << " " << bench.name << ": " << 1e3*s[3] << " ms (+-" << 1e3*s[1] << ", " << 1e9*s[3]/bench.items << " ns per item)" << endl;
+}
+
+int main(int argc, char* argv[]) {
+	int repetitions = 10;
+	double min_time = 0.05;
+	string outfile = "benchmark.json";
+	string treepath = "example/trees/treetable";
+	int ntrees = 10;
+	// patch size the trees were trained for (not stored in text trees)
+	int p_width = 16, p_height = 16;
+	vector<string> vInputs;
+	bool check_only = false;
+
+	for(int i=1; i<argc; ++i) {
+		if(strcmp(argv[i],"-c")==0)
+			check_only = true;
+		else if(strcmp(argv[i],"-r")==0 && i+1<argc)
+			repetitions = max(1, atoi(argv[++i]));
+		else if(strcmp(argv[i],"-o")==0 && i+1<argc)
+			outfile = argv[++i];
+		else if(strcmp(argv[i],"-t")==0 && i+2<argc) {
+			treepath = argv[++i];
+			ntrees = atoi(argv[++i]);
+		} else if(strcmp(argv[i],"-p")==0 && i+2<argc) {
+			p_width = atoi(argv[++i]);
+			p_height = atoi(argv[++i]);
+		} else
+			vInputs.push_back(argv[i]);
+	}
+	if(vInputs.empty())
+		vInputs.push_back("example/testimages/test0.png");
+	vInputs.insert(vInputs.begin(), "synthetic");
+	if(p_width<=0 || p_height<=0) {
+		cerr << "Invalid patch size: " << p_width << " " << p_height << endl;
+		exit(-1);
+	}
+
+	// Forest for detection
+	for(int i=0; i<ntrees; ++i) {
+		char buffer[400];
+		sprintf(buffer,"%s%03d.txt",treepath.c_str(),i);
+		if(!CRTree::checkTree(buffer)) {
+			cerr << "Could not read tree: " << buffer << endl;
+			exit(-1);
+		}
+	}
+	CRForest crForest(ntrees);
+	crForest.loadForest(treepath.c_str());
+	CRForestDetector crDetect(&crForest, p_width, p_height);
+
+	// Comparison with reference: random images of random size (including sizes close to the patch size) and inputs
+	CvRNG checkRNG = cvRNG(2);
+	bool same = true;
+	for(int n=0; n<4; ++n) {
+		int w = n==0 ? p_width+1 : p_width + 1 + cvRandInt(&checkRNG)%200;
+		int h = n==0 ? p_height+1 : p_height + 1 + cvRandInt(&checkRNG)%200;
+		IplImage* img = cvCreateImage(cvSize(w,h), IPL_DEPTH_8U, 3);
+		cvRandArr(&checkRNG, img, CV_RAND_UNI, cvScalarAll(0), cvScalarAll(256));
+		char buffer[40];
+		sprintf(buffer, "random%dx%d", w, h);
+		same &= checkImage(buffer, img, crForest, crDetect, p_width, p_height, &checkRNG);
+		cvReleaseImage(&img);
+	}
+	for(unsigned int n=0; n<vInputs.size(); ++n) {
+		IplImage* img = n==0 ? syntheticImage(640, 480) : cvLoadImage(vInputs[n].c_str(), CV_LOAD_IMAGE_COLOR);
+		if(!img) {
+			cerr << "Could not load image file: " << vInputs[n] << endl;
+			exit(-1);
+		}
+		same &= checkImage(vInputs[n], img, crForest, crDetect, p_width, p_height, &checkRNG);
+		cvReleaseImage(&img);
+	}
+	if(!same) {
+		cerr << "Kernels differ from reference implementation" << endl;
+		return -1;
+	}
+	if(check_only)
+		return 0;
+
+	vector<BenchResult> vRes;
+	for(unsigned int n=0; n<vInputs.size(); ++n) {
+		IplImage* img = n==0 ? syntheticImage(640, 480) : cvLoadImage(vInputs[n].c_str(), CV_LOAD_IMAGE_COLOR);
+		if(!img) {
+			cerr << "Could not load image file: " << vInputs[n] << endl;
+			exit(-1);
+		}
+		const string& input = vInputs[n];
+
+		// Feature extraction and its stages
+		{
+			BenchFeatures bench(img);
+			add(vRes, bench, input, repetitions, min_time);
+		}
+		const char* stages[] = {"features/gray", "features/sobel", "features/orientation", "features/magnitude", "features/hog",
+			"features/sobel2", "features/lab", "features/minfilt", "features/maxfilt"};
+		for(int s=0; s<9; ++s) {
+			BenchStage bench(img, s, stages[s]);
+			add(vRes, bench, input, repetitions, min_time);
+		}
+
+		// Regression and voting
+		IplImage* tmp = cvCloneImage(img);
+		vector<IplImage*> vImg;
+		CRPatch::extractFeatureChannels(tmp, vImg);
+		cvReleaseImage(&tmp);
+		{
+			BenchRegression bench(crForest, vImg, p_width, p_height);
+			add(vRes, bench, input, repetitions, min_time);
+		}
+		for(int mode=0; mode<2; ++mode) {
+			BenchVoting bench(crDetect, vImg, p_width, p_height, mode);
+			add(vRes, bench, input, repetitions, min_time);
+		}
+		for(unsigned int c=0; c<vImg.size(); ++c)
+			cvReleaseImage(&vImg[c]);
+
+		// Training: positive patches with the image center as object center, negative patches
+		CvRNG cvRNG(1);
+		CRPatch Train(&cvRNG, p_width, p_height, 2);
+		CvRect box = cvRect(0, 0, img->width, img->height);
+		vector<CvPoint> vCenter(1, cvPoint(img->width/2, img->height/2));
+		tmp = cvCloneImage(img);
+		Train.extractPatches(tmp, 5000, 1, &box, &vCenter);
+		cvReleaseImage(&tmp);
+		tmp = cvCloneImage(img);
+		Train.extractPatches(tmp, 5000, 0);
+		cvReleaseImage(&tmp);
+
+		const char* funcs[] = {"train/evaluateTest", "train/split", "train/InfGain", "train/distMean"};
+		for(int f=0; f<4; ++f) {
+			CRTree tree(20, 15, 1, cvRNG);
+			BenchTraining bench(tree, Train, f, funcs[f]);
+			add(vRes, bench, input, repetitions, min_time);
+		}
+
+		cvReleaseImage(&img);
+	}
+
+	// Direct and grouped voting on a large image
+	{
+		IplImage* img = syntheticImage(1920, 1080);
+		vector<IplImage*> vImg;
+		CRPatch::extractFeatureChannels(img, vImg);
+		for(int mode=0; mode<2; ++mode) {
+			BenchVoting bench(crDetect, vImg, p_width, p_height, mode);
+			add(vRes, bench, "synthetic1920x1080", repetitions, min_time);
+		}
+		releaseImages(vImg);
+		cvReleaseImage(&img);
+	}
+
+	writeJSON(outfile.c_str(), vRes, repetitions, min_time);
+	cout << "Results: " << outfile << endl;
+
+	return 0;
+}
@@ -0,0 +1,173 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CREvaluation.h"
+
+#include <algorithm>
+#include <functional>
+
+using namespace std;
+
+static bool greaterScore(const Hypothesis& a, const Hypothesis& b) {
+	return a.score > b.score;
+}
+
+void CREvaluation::detectMaxima(const vector<vector<IplImage*> >& vImgDetect, const vector<float>& ratios, int width, int height,
+								int obj_width, int obj_height, unsigned int max_hyp, vector<Hypothesis>& vHyp, bool joint) {
+	// local maxima
+	vector<Hypothesis> vMax;
+	for(unsigned int k=0; k<vImgDetect.size(); ++k) {
+		for(unsigned int c=0; c<ratios.size(); ++c) {
+			const IplImage* img = vImgDetect[k][c];
+			float sx = img->width / float(width);
+			float sy = img->height / float(height);
+
+			for(int y=0; y<img->height; ++y) {
+				const float* ptR = (const float*)(img->imageData + y*img->widthStep);
+				for(int x=0; x<img->width; ++x) {
+					float v = ptR[x];
+					if(v<=0)
+						continue;
+
+					// strictly greater than the previous neighbours, not smaller than the next ones (plateaus give one maximum)
+					bool is_max = true;
+					for(int dy=-1; dy<=1 && is_max; ++dy) {
+						if(y+dy<0 || y+dy>=img->height)
+							continue;
+						const float* ptN = (const float*)(img->imageData + (y+dy)*img->widthStep);
+						for(int dx=-1; dx<=1 && is_max; ++dx) {
+							if((dx==0 && dy==0) || x+dx<0 || x+dx>=img->width)
+								continue;
+							is_max = (dy<0 || (dy==0 && dx<0)) ? v>ptN[x+dx] : v>=ptN[x+dx];
+						}
+					}
+
+					// same comparison with the neighbouring bins of the scale space (smaller bin first)
+					for(int n=-1; n<=1 && joint && is_max; n+=2) {
+						if(int(k)+n<0 || int(k)+n>=int(vImgDetect.size()))
+							continue;
+						const IplImage* imgN = vImgDetect[k+n][c];
+						int xn = int(x * imgN->width / float(img->width) + 0.5f);
+						int yn = int(y * imgN->height / float(img->height) + 0.5f);
+						for(int dy=-1; dy<=1 && is_max; ++dy) {
+							if(yn+dy<0 || yn+dy>=imgN->height)
+								continue;
+							const float* ptN = (const float*)(imgN->imageData + (yn+dy)*imgN->widthStep);
+							for(int dx=-1; dx<=1 && is_max; ++dx) {
+								if(xn+dx<0 || xn+dx>=imgN->width)
+									continue;
+								is_max = n<0 ? v>ptN[xn+dx] : v>=ptN[xn+dx];
+							}
+						}
+					}
+
+					if(is_max) {
+						Hypothesis h;
+						h.width = obj_width * ratios[c] / sx;
+						h.height = obj_height / sy;
+						h.x = x / sx - h.width/2;
+						h.y = y / sy - h.height/2;
+						h.score = v;
+						h.scale = k;
+						h.ratio = c;
+						vMax.push_back(h);
+					}
+				}
+			}
+		}
+	}
+
+	// greedy non maxima suppression
+	stable_sort(vMax.begin(), vMax.end(), greaterScore);
+	vHyp.clear();
+	for(unsigned int i=0; i<vMax.size() && vHyp.size()<max_hyp; ++i) {
+		bool keep = true;
+		for(unsigned int j=0; j<vHyp.size() && keep; ++j)
+			keep = overlap(vMax[i].x, vMax[i].y, vMax[i].width, vMax[i].height, vHyp[j].x, vHyp[j].y, vHyp[j].width, vHyp[j].height) < 0.5f;
+		if(keep)
+			vHyp.push_back(vMax[i]);
+	}
+}
+
+float CREvaluation::overlap(float x1, float y1, float w1, float h1, float x2, float y2, float w2, float h2) {
+	float iw = min(x1+w1, x2+w2) - max(x1, x2);
+	float ih = min(y1+h1, y2+h2) - max(y1, y2);
+	if(iw<=0 || ih<=0)
+		return 0;
+	float inter = iw*ih;
+	return inter / (w1*h1 + w2*h2 - inter);
+}
+
+void CREvaluation::addImage(const vector<Hypothesis>& vHyp, const vector<CvRect>& vGT) {
+	num_gt += vGT.size();
+
+	// hypotheses in descending order of score; a ground truth box can only be detected once
+	vector<Hypothesis> vSorted(vHyp);
+	stable_sort(vSorted.begin(), vSorted.end(), greaterScore);
+	vector<bool> vMatched(vGT.size(), false);
+	for(unsigned int i=0; i<vSorted.size(); ++i) {
+		int best = -1;
+		float best_overlap = 0.5f;
+		for(unsigned int j=0; j<vGT.size(); ++j) {
+			if(vMatched[j])
+				continue;
+			float o = overlap(vSorted[i].x, vSorted[i].y, vSorted[i].width, vSorted[i].height, vGT[j].x, vGT[j].y, vGT[j].width, vGT[j].height);
+			if(o>=best_overlap) {
+				best = j;
+				best_overlap = o;
+			}
+		}
+		if(best>=0)
+			vMatched[best] = true;
+		vDet.push_back(pair<float,bool>(vSorted[i].score, best>=0));
+	}
+}
+
+void CREvaluation::curve(vector<float>& vScore, vector<float>& vRecall, vector<float>& vPrecision) const {
+	vector<pair<float,bool> > vSorted(vDet);
+	stable_sort(vSorted.begin(), vSorted.end(), greater<pair<float,bool> >());
+
+	vScore.clear();
+	vRecall.clear();
+	vPrecision.clear();
+	unsigned int tp = 0;
+	for(unsigned int i=0; i<vSorted.size(); ++i) {
+		if(vSorted[i].second)
+			++tp;
+		// one point per threshold
+		if(i+1<vSorted.size() && vSorted[i+1].first==vSorted[i].first)
+			continue;
+		vScore.push_back(vSorted[i].first);
+		vRecall.push_back(num_gt>0 ? tp/float(num_gt) : 0);
+		vPrecision.push_back(tp/float(i+1));
+	}
+}
+
+void CREvaluation::summary(double& ap, double& eer, double& max_recall) const {
+	vector<float> vScore, vRecall, vPrecision;
+	curve(vScore, vRecall, vPrecision);
+
+	ap = 0;
+	eer = 0;
+	max_recall = vRecall.empty() ? 0 : vRecall.back();
+
+	// precision interpolated as maximum precision for higher recall
+	vector<float> vInter(vPrecision);
+	for(int i=int(vInter.size())-2; i>=0; --i)
+		vInter[i] = max(vInter[i], vInter[i+1]);
+	float prev_recall = 0;
+	for(unsigned int i=0; i<vRecall.size(); ++i) {
+		ap += (vRecall[i]-prev_recall) * vInter[i];
+		prev_recall = vRecall[i];
+	}
+
+	// first threshold where recall reaches precision
+	for(unsigned int i=0; i<vRecall.size(); ++i) {
+		if(vRecall[i]>=vPrecision[i]) {
+			eer = 0.5*(vRecall[i]+vPrecision[i]);
+			break;
+		}
+	}
+}
@@ -0,0 +1,52 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#include <cxcore.h>
+
+#include <vector>
+
+// Detection: bounding box in the original image, value of the Hough image, scale and ratio id
+struct Hypothesis {
+	float x, y, width, height;
+	float score;
+	int scale;
+	int ratio;
+};
+
+// Evaluation of detections against ground truth (PASCAL criterion: overlap>=0.5)
+class CREvaluation {
+public:
+	CREvaluation() : num_gt(0) {}
+
+	// Local maxima of the Hough images (3x3 neighbourhood) of all scales and ratios and non maxima suppression
+	// The Hough images are given for an image of size width x height; a maximum at scale s and ratio r
+	// is an object of size obj_width*r/s x obj_height/s; at most max_hyp hypotheses with the highest score are kept
+	// (for several object classes, the Hough images of class 1 are the first ones of each scale)
+	// joint: the scales are the bins of a scale space (CRForestDetector::detectSpace) in ascending order and a maximum
+	// is also compared with the 3x3 neighbourhood of its position in the neighbouring bins
+	static void detectMaxima(const std::vector<std::vector<IplImage*> >& vImgDetect, const std::vector<float>& ratios, int width, int height,
+		int obj_width, int obj_height, unsigned int max_hyp, std::vector<Hypothesis>& vHyp, bool joint = false);
+
+	// Intersection over union of two boxes
+	static float overlap(float x1, float y1, float w1, float h1, float x2, float y2, float w2, float h2);
+
+	// Match hypotheses of an image with ground truth boxes; each box is matched by the best hypothesis
+	void addImage(const std::vector<Hypothesis>& vHyp, const std::vector<CvRect>& vGT);
+
+	// Precision recall curve with the scores as thresholds (descending)
+	void curve(std::vector<float>& vScore, std::vector<float>& vRecall, std::vector<float>& vPrecision) const;
+	// Average precision (area under the interpolated curve), equal error rate (recall=precision) and maximal recall
+	void summary(double& ap, double& eer, double& max_recall) const;
+
+	unsigned int GetNumGT() const {return num_gt;}
+	unsigned int GetNumDetections() const {return vDet.size();}
+
+private:
+	// score and whether the detection is true positive
+	std::vector<std::pair<float,bool> > vDet;
+	unsigned int num_gt;
+};
@@ -0,0 +1,153 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRFeatureCache.h"
+#include "CRFileUtil.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Header of a cache file
+struct FeatureCacheHeader {
+	char magic[8];
+	// feature version
+	unsigned int version;
+	// number of channels
+	unsigned int channels;
+	// size of channels
+	int width;
+	int height;
+	// scale of the image pyramid level
+	float scale;
+	// length of image path stored after the header
+	unsigned int pathlen;
+	// modification time of the image
+	long long mtime;
+	// offset of channel data
+	long long data;
+};
+
+static const char cacheMagic[8] = {'C','R','F','C','A','C','H','E'};
+
+string CRFeatureCache::filename(const string& image, float scale) const {
+	return CRFileUtil::imageFile(cachepath, image, scale, "fc");
+}
+
+bool CRFeatureCache::load(const string& image, float scale, int width, int height, FeatureMap& fmap) const {
+	long long mtime = CRFileUtil::fileTime(image);
+	if(mtime<0)
+		return false;
+
+	string cfile = filename(image, scale);
+	int fd = open(cfile.c_str(), O_RDONLY);
+	if(fd<0)
+		return false;
+
+	struct stat st;
+	if(fstat(fd, &st)!=0 || st.st_size<(off_t)sizeof(FeatureCacheHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void* addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr==MAP_FAILED)
+		return false;
+
+	// check whether cache file is valid and up to date
+	const FeatureCacheHeader* header = (const FeatureCacheHeader*)addr;
+	const char* path = (const char*)addr + sizeof(FeatureCacheHeader);
+	bool valid = memcmp(header->magic, cacheMagic, sizeof(cacheMagic))==0 &&
+		header->version==CRFEATURE_VERSION &&
+		header->scale==scale && header->mtime==mtime &&
+		header->width==width && header->height==height &&
+		header->pathlen==image.size() &&
+		header->data + (long long)header->channels*width*height == (long long)st.st_size &&
+		image.compare(0, image.size(), path, header->pathlen)==0;
+
+	if(!valid) {
+		munmap(addr, st.st_size);
+		return false;
+	}
+
+	// image headers pointing to the channels
+	fmap.addr = addr;
+	fmap.length = st.st_size;
+	fmap.vImg.resize(header->channels);
+	uchar* ptData = (uchar*)addr + header->data;
+	for(unsigned int c=0; c<fmap.vImg.size(); ++c, ptData += width*height) {
+		fmap.vImg[c] = cvCreateImageHeader(cvSize(width,height), IPL_DEPTH_8U, 1);
+		cvSetData(fmap.vImg[c], ptData, width);
+	}
+
+	return true;
+}
+
+bool CRFeatureCache::save(const string& image, float scale, const vector<IplImage*>& vImg) const {
+	long long mtime = CRFileUtil::fileTime(image);
+	if(mtime<0 || vImg.size()==0)
+		return false;
+
+	FeatureCacheHeader header;
+	memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+	header.version = CRFEATURE_VERSION;
+	header.channels = vImg.size();
+	header.width = vImg[0]->width;
+	header.height = vImg[0]->height;
+	header.scale = scale;
+	header.pathlen = image.size();
+	header.mtime = mtime;
+	// channel data aligned to 64 bytes
+	header.data = ((sizeof(header) + image.size() + 63)/64)*64;
+
+	string cfile = filename(image, scale);
+	string tmpfile = CRFileUtil::tempFile(cfile);
+
+	ofstream out(tmpfile.c_str(), ios::binary);
+	if(!out.is_open()) {
+		cerr << "Could not write feature cache: " << tmpfile << endl;
+		return false;
+	}
+
+	out.write((const char*)&header, sizeof(header));
+	out.write(image.c_str(), image.size());
+	for(long long i=sizeof(header)+image.size(); i<header.data; ++i)
+		out.put(0);
+
+	for(unsigned int c=0; c<vImg.size(); ++c) {
+		uchar* ptC;
+		int step;
+		cvGetRawData( vImg[c], &ptC, &step);
+		for(int y=0; y<header.height; ++y, ptC += step)
+			out.write((const char*)ptC, header.width);
+	}
+
+	bool done = CRFileUtil::replaceFile(out, tmpfile, cfile);
+	if(!done)
+		cerr << "Could not write feature cache: " << cfile << endl;
+
+	return done;
+}
+
+void CRFeatureCache::release(FeatureMap& fmap) {
+	for(unsigned int c=0; c<fmap.vImg.size(); ++c)
+		cvReleaseImageHeader(&fmap.vImg[c]);
+	fmap.vImg.clear();
+
+	if(fmap.addr!=0)
+		munmap(fmap.addr, fmap.length);
+	fmap.addr = 0;
+	fmap.length = 0;
+}
@@ -0,0 +1,48 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#include <cxcore.h>
+
+#include <vector>
+#include <string>
+
+// Version of the feature channels computed by CRPatch::extractFeatureChannels
+// Increase whenever the features change such that old cache files become stale
+#define CRFEATURE_VERSION 1
+
+// Feature channels mapped from a cache file
+struct FeatureMap {
+	FeatureMap() : addr(0), length(0) {}
+
+	// channels as image headers pointing into the mapped file (read only)
+	std::vector<IplImage*> vImg;
+
+	// mapped memory
+	void* addr;
+	size_t length;
+};
+
+// On-disk cache for the feature channels of an image at a given scale
+// One binary file per image and scale:
+// header | image path | channel 0 | ... | channel n-1 (width x height bytes each)
+class CRFeatureCache {
+public:
+	CRFeatureCache(const std::string& path) : cachepath(path) {}
+
+	// Map cached channels; returns false if the cache file is missing or stale
+	bool load(const std::string& image, float scale, int width, int height, FeatureMap& fmap) const;
+	// Store channels of image at scale
+	bool save(const std::string& image, float scale, const std::vector<IplImage*>& vImg) const;
+	// Unmap channels
+	static void release(FeatureMap& fmap);
+
+private:
+	// Cache filename for image and scale
+	std::string filename(const std::string& image, float scale) const;
+
+	std::string cachepath;
+};
@@ -0,0 +1,74 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRFileUtil.h"
+
+#include <cstdio>
+#include <iomanip>
+#include <sstream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+long long CRFileUtil::fileTime(const string& filename) {
+	struct stat st;
+	if(stat(filename.c_str(), &st)!=0)
+		return -1;
+	return (long long)st.st_mtime;
+}
+
+void CRFileUtil::putVarint(vector<uchar>& vData, unsigned int val) {
+	while(val>=0x80) {
+		vData.push_back(uchar(val | 0x80));
+		val >>= 7;
+	}
+	vData.push_back(uchar(val));
+}
+
+bool CRFileUtil::getVarint(const uchar*& pt, const uchar* end, unsigned int& val) {
+	val = 0;
+	for(int shift=0; pt<end && shift<35; shift+=7) {
+		uchar b = *pt++;
+		val |= (unsigned int)(b & 0x7f) << shift;
+		if((b & 0x80)==0)
+			return true;
+	}
+	return false;
+}
+
+string CRFileUtil::imageFile(const string& path, const string& image, float scale, const char* ext) {
+	ostringstream key;
+	key << image << "@" << scale;
+	string str = key.str();
+	unsigned long long hash = 14695981039346656037ULL;
+	for(unsigned int i=0; i<str.size(); ++i) {
+		hash ^= (unsigned char)str[i];
+		hash *= 1099511628211ULL;
+	}
+
+	ostringstream name;
+	name << path << "/" << image.substr(image.find_last_of('/')+1) << "-" << hex << setw(16) << setfill('0') << hash << "." << ext;
+	return name.str();
+}
+
+string CRFileUtil::tempFile(const string& filename) {
+	ostringstream name;
+	name << filename << "." << (int)getpid();
+	return name.str();
+}
+
+bool CRFileUtil::replaceFile(ofstream& out, const string& tmpfile, const string& filename) {
+	bool done = out.good();
+	out.close();
+
+	if(done)
+		done = rename(tmpfile.c_str(), filename.c_str())==0;
+	if(!done)
+		remove(tmpfile.c_str());
+	return done;
+}
@@ -0,0 +1,33 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#include <cxcore.h>
+
+#include <vector>
+#include <string>
+#include <fstream>
+
+// File helpers shared by the trees, the forest bundle, the feature cache, and the leaf maps
+class CRFileUtil {
+public:
+	// Modification time of file, -1 if it does not exist
+	static long long fileTime(const std::string& filename);
+
+	// Unsigned LEB128 varint; get fails if the varint exceeds end or 32 bit
+	static void putVarint(std::vector<uchar>& vData, unsigned int val);
+	static bool getVarint(const uchar*& pt, const uchar* end, unsigned int& val);
+
+	// File of image at scale in directory path: path/name-hash.ext with the image name for readability
+	// and the FNV-1a hash of image@scale (scale as with %g)
+	static std::string imageFile(const std::string& path, const std::string& image, float scale, const char* ext);
+
+	// Files are written to tempFile(filename) (filename.pid) and renamed by replaceFile such that
+	// concurrent readers never see a partial file and a mapped file can be replaced
+	// replaceFile closes out and removes the temporary file if it fails
+	static std::string tempFile(const std::string& filename);
+	static bool replaceFile(std::ofstream& out, const std::string& tmpfile, const std::string& filename);
+};
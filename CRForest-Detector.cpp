@@ -1,605 +1,1455 @@
-/* 
-// Author: Juergen Gall, BIWI, ETH Zurich
-// Email: gall@vision.ee.ethz.ch
- 
-// You may use, copy, reproduce, and distribute this Software for any 
-// non-commercial purpose, subject to the restrictions of the 
-// Microsoft Research Shared Source license agreement ("MSR-SSLA"). 
-// Some purposes which can be non-commercial are teaching, academic 
-// research, public demonstrations and personal experimentation. You 
-// may also distribute this Software with books or other teaching 
-// materials, or publish the Software on websites, that are intended 
-// to teach the use of the Software for academic or other 
-// non-commercial purposes.
-// You may not use or distribute this Software or any derivative works 
-// in any form for commercial purposes. Examples of commercial 
-// purposes would be running business operations, licensing, leasing, 
-// or selling the Software, distributing the Software for use with 
-// commercial products, using the Software in the creation or use of 
-// commercial products or any other activity which purpose is to 
-// procure a commercial gain to you or others.
-// If the Software includes source code or data, you may create 
-// derivative works of such portions of the Software and distribute 
-// the modified Software for non-commercial purposes, as provided 
-// herein.
-
-// THE SOFTWARE COMES "AS IS", WITH NO WARRANTIES. THIS MEANS NO 
-// EXPRESS, IMPLIED OR STATUTORY WARRANTY, INCLUDING WITHOUT 
-// LIMITATION, WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A 
-// PARTICULAR PURPOSE, ANY WARRANTY AGAINST INTERFERENCE WITH YOUR 
-// ENJOYMENT OF THE SOFTWARE OR ANY WARRANTY OF TITLE OR 
-// NON-INFRINGEMENT. THERE IS NO WARRANTY THAT THIS SOFTWARE WILL 
-// FULFILL ANY OF YOUR PARTICULAR PURPOSES OR NEEDS. ALSO, YOU MUST 
-// PASS THIS DISCLAIMER ON WHENEVER YOU DISTRIBUTE THE SOFTWARE OR 
-// DERIVATIVE WORKS.
-
-// NEITHER MICROSOFT NOR ANY CONTRIBUTOR TO THE SOFTWARE WILL BE 
-// LIABLE FOR ANY DAMAGES RELATED TO THE SOFTWARE OR THIS MSR-SSLA, 
-// INCLUDING DIRECT, INDIRECT, SPECIAL, CONSEQUENTIAL OR INCIDENTAL 
-// DAMAGES, TO THE MAXIMUM EXTENT THE LAW PERMITS, NO MATTER WHAT 
-// LEGAL THEORY IT IS BASED ON. ALSO, YOU MUST PASS THIS LIMITATION OF 
-// LIABILITY ON WHENEVER YOU DISTRIBUTE THE SOFTWARE OR DERIVATIVE 
-// WORKS.
-
-// When using this software, please acknowledge the effort that 
-// went into development by referencing the paper:
-//
-// Gall J. and Lempitsky V., Class-Specific Hough Forests for 
-// Object Detection, IEEE Conference on Computer Vision and Pattern 
-// Recognition (CVPR'09), 2009.
-
-// Note that this is not the original software that was used for 
-// the paper mentioned above. It is a re-implementation for Linux. 
-
-*/
-
-
-#define PATH_SEP "/"
-
-#include <stdexcept>
-
-#include <vector>
-#include <iostream>
-#include <fstream>
-#include <string>
-
-#include <highgui.h>
-
-#include "CRForestDetector.h"
-
-using namespace std;
-
-// Path to trees
-string treepath;
-// Number of trees
-int ntrees;
-// Patch width
-int p_width;
-// Patch height
-int p_height;
-// Path to images
-string impath;
-// File with names of images
-string imfiles;
-// Extract features
-bool xtrFeature;
-// Scales
-vector<float> scales;
-// Ratio
-vector<float> ratios;
-// Output path
-string outpath;
-// scale factor for output image (default: 128)
-int out_scale;
-// Path to positive examples
-string trainpospath;
-// File with postive examples
-string trainposfiles;
-// Subset of positive images -1: all images
-int subsamples_pos;
-// Sample patches from pos. examples
-unsigned int samples_pos; 
-// Path to positive examples
-string trainnegpath;
-// File with postive examples
-string trainnegfiles;
-// Subset of neg images -1: all images
-int subsamples_neg;
-// Samples from pos. examples
-unsigned int samples_neg;
-
-// offset for saving tree number
-int off_tree;
-
-
-// load config file for dataset
-void loadConfig(const char* filename, int mode) {
-	char buffer[400];
-	ifstream in(filename);
-
-	if(in.is_open()) {
-
-		// Path to trees
-		in.getline(buffer,400);
-		in.getline(buffer,400); 
-		treepath = buffer;
-		// Number of trees
-		in.getline(buffer,400); 
-		in >> ntrees;
-		in.getline(buffer,400); 
-		// Patch width
-		in.getline(buffer,400); 
-		in >> p_width;
-		in.getline(buffer,400); 
-		// Patch height
-		in.getline(buffer,400); 
-		in >> p_height;
-		in.getline(buffer,400); 
-		// Path to images
-		in.getline(buffer,400); 
-		in.getline(buffer,400); 
-		impath = buffer;
-		// File with names of images
-		in.getline(buffer,400);
-		in.getline(buffer,400);
-		imfiles = buffer;
-		// Extract features
-		in.getline(buffer,400);
-		in >> xtrFeature;
-		in.getline(buffer,400); 
-		// Scales
-		in.getline(buffer,400);
-		int size;
-		in >> size;
-		scales.resize(size);
-		for(int i=0;i<size;++i)
-			in >> scales[i];
-		in.getline(buffer,400); 
-		// Ratio
-		in.getline(buffer,400);
-		in >> size;
-		ratios.resize(size);
-		for(int i=0;i<size;++i)
-			in >> ratios[i];
-		in.getline(buffer,400); 
-		// Output path
-		in.getline(buffer,400);
-		in.getline(buffer,400);
-		outpath = buffer;
-		// Scale factor for output image (default: 128)
-		in.getline(buffer,400);
-		in >> out_scale;
-		in.getline(buffer,400);
-		// Path to positive examples
-		in.getline(buffer,400);
-		in.getline(buffer,400);
-		trainpospath = buffer;
-		// File with postive examples
-		in.getline(buffer,400);
-		in.getline(buffer,400);
-		trainposfiles = buffer;
-		// Subset of positive images -1: all images
-		in.getline(buffer,400);
-		in >> subsamples_pos;
-		in.getline(buffer,400);
-		// Samples from pos. examples
-		in.getline(buffer,400);
-		in >> samples_pos;
-		in.getline(buffer,400);
-		// Path to positive examples
-		in.getline(buffer,400);
-		in.getline(buffer,400);
-		trainnegpath = buffer;
-		// File with postive examples
-		in.getline(buffer,400);
-		in.getline(buffer,400);
-		trainnegfiles = buffer;
-		// Subset of negative images -1: all images
-		in.getline(buffer,400);
-		in >> subsamples_neg;
-		in.getline(buffer,400);
-		// Samples from pos. examples
-		in.getline(buffer,400);
-		in >> samples_neg;
-		//in.getline(buffer,400);
-
-	} else {
-		cerr << "File not found " << filename << endl;
-		exit(-1);
-	}
-	in.close();
-
-	switch ( mode ) { 
-		case 0:
-		cout << endl << "------------------------------------" << endl << endl;
-		cout << "Training:         " << endl;
-		cout << "Patches:          " << p_width << " " << p_height << endl;
-		cout << "Train pos:        " << trainpospath << endl;
-		cout << "                  " << trainposfiles << endl;
-		cout << "                  " << subsamples_pos << " " << samples_pos << endl;
-		cout << "Train neg:        " << trainnegpath << endl;
-		cout << "                  " << trainnegfiles << endl;
-		cout << "                  " << subsamples_neg << " " << samples_neg << endl;
-		cout << "Trees:            " << ntrees << " " << off_tree << " " << treepath << endl;
-		cout << endl << "------------------------------------" << endl << endl;
-		break;
-
-		case 1:
-		cout << endl << "------------------------------------" << endl << endl;
-		cout << "Show:             " << endl;
-		cout << "Trees:            " << ntrees << " " << treepath << endl;
-		cout << endl << "------------------------------------" << endl << endl;
-		break;
-
-		default:
-		cout << endl << "------------------------------------" << endl << endl;
-		cout << "Detection:        " << endl;
-		cout << "Trees:            " << ntrees << " " << treepath << endl;
-		cout << "Patches:          " << p_width << " " << p_height << endl;
-		cout << "Images:           " << impath << endl;
-		cout << "                  " << imfiles << endl;
-		cout << "Scales:           "; for(unsigned int i=0;i<scales.size();++i) cout << scales[i] << " "; cout << endl;
-		cout << "Ratios:           "; for(unsigned int i=0;i<ratios.size();++i) cout << ratios[i] << " "; cout << endl;
-		cout << "Extract Features: " << xtrFeature << endl;
-		cout << "Output:           " << out_scale << " " << outpath << endl;
-		cout << endl << "------------------------------------" << endl << endl;
-		break;
-	}
-
-}
-
-// load test image filenames
-void loadImFile(std::vector<string>& vFilenames) {
-	
-	char buffer[400];
-
-	ifstream in(imfiles.c_str());
-	if(in.is_open()) {
-
-		unsigned int size;
-		in >> size; //size = 10;
-		in.getline(buffer,400); 
-		vFilenames.resize(size);
-
-		for(unsigned int i=0; i<size; ++i) {
-			in.getline(buffer,400);      
-			vFilenames[i] = buffer;	
-		}
-
-	} else {
-		cerr << "File not found " << imfiles.c_str() << endl;
-		exit(-1);
-	}
-
-	in.close();
-}
-
-// load positive training image filenames
-void loadTrainPosFile(std::vector<string>& vFilenames, std::vector<CvRect>& vBBox, std::vector<std::vector<CvPoint> >& vCenter) {
-
-	unsigned int size, numop; 
-	ifstream in(trainposfiles.c_str());
-
-	if(in.is_open()) {
-		in >> size;
-		in >> numop;
-		cout << "Load Train Pos Examples: " << size << " - " << numop << endl;
-
-		vFilenames.resize(size);
-		vCenter.resize(size);
-		vBBox.resize(size);
-
-		for(unsigned int i=0; i<size; ++i) {
-			// Read filename
-			in >> vFilenames[i];
-
-			// Read bounding box
-			in >> vBBox[i].x; in >> vBBox[i].y; 
-			in >> vBBox[i].width;
-			vBBox[i].width -= vBBox[i].x; 
-			in >> vBBox[i].height;
-			vBBox[i].height -= vBBox[i].y;
-
-			if(vBBox[i].width<p_width || vBBox[i].height<p_height) {
-			  cout << "Width or height are too small" << endl; 
-			  cout << vFilenames[i] << endl;
-			  exit(-1); 
-			}
-
-			// Read center points
-			vCenter[i].resize(numop);
-			for(unsigned int c=0; c<numop; ++c) {			
-				in >> vCenter[i][c].x;
-				in >> vCenter[i][c].y;
-			}				
-		}
-
-		in.close();
-	} else {
-		cerr << "File not found " << trainposfiles.c_str() << endl;
-		exit(-1);
-	}
-}
-
-// load negative training image filenames
-void loadTrainNegFile(std::vector<string>& vFilenames, std::vector<CvRect>& vBBox) {
-
-	unsigned int size, numop; 
-	ifstream in(trainnegfiles.c_str());
-
-	if(in.is_open()) {
-		in >> size;
-		in >> numop;
-		cout << "Load Train Neg Examples: " << size << " - " << numop << endl;
-
-		vFilenames.resize(size);
-		if(numop>0)
-			vBBox.resize(size);
-		else
-			vBBox.clear();
-
-		for(unsigned int i=0; i<size; ++i) {
-			// Read filename
-			in >> vFilenames[i];
-
-			// Read bounding box (if available)
-			if(numop>0) {
-				in >> vBBox[i].x; in >> vBBox[i].y; 
-				in >> vBBox[i].width;
-				vBBox[i].width -= vBBox[i].x; 
-				in >> vBBox[i].height;
-				vBBox[i].height -= vBBox[i].y;
-
-				if(vBBox[i].width<p_width || vBBox[i].height<p_height) {
-				  cout << "Width or height are too small" << endl; 
-				  cout << vFilenames[i] << endl;
-				  exit(-1); 
-				}
-
-			}
-
-				
-		}
-
-		in.close();
-	} else {
-		cerr << "File not found " << trainposfiles.c_str() << endl;
-		exit(-1);
-	}
-}
-
-// Show leaves
-void show() {
-	// Init forest with number of trees
-	CRForest crForest( ntrees ); 
-
-	// Load forest
-	crForest.loadForest(treepath.c_str());	
-
-	// Show leaves
-	crForest.show(100,100);
-}
-
-
-// Run detector
-void detect(CRForestDetector& crDetect) {
-
-	// Load image names
-	vector<string> vFilenames;
-	loadImFile(vFilenames);
-				
-	char buffer[200];
-
-	// Storage for output
-	vector<vector<IplImage*> > vImgDetect(scales.size());	
-
-	// Run detector for each image
-	for(unsigned int i=0; i<vFilenames.size(); ++i) {
-
-		// Load image
-		IplImage *img = 0;
-		img = cvLoadImage((impath + "/" + vFilenames[i]).c_str(),CV_LOAD_IMAGE_COLOR);
-		if(!img) {
-			cout << "Could not load image file: " << (impath + "/" + vFilenames[i]).c_str() << endl;
-			exit(-1);
-		}	
-
-		// Prepare scales
-		for(unsigned int k=0;k<vImgDetect.size(); ++k) {
-			vImgDetect[k].resize(ratios.size());
-			for(unsigned int c=0;c<vImgDetect[k].size(); ++c) {
-				vImgDetect[k][c] = cvCreateImage( cvSize(int(img->width*scales[k]+0.5),int(img->height*scales[k]+0.5)), IPL_DEPTH_32F, 1 );
-			}
-		}
-
-		// Detection for all scales
-		crDetect.detectPyramid(img, vImgDetect, ratios);
-
-		// Store result
-		for(unsigned int k=0;k<vImgDetect.size(); ++k) {
-			IplImage* tmp = cvCreateImage( cvSize(vImgDetect[k][0]->width,vImgDetect[k][0]->height) , IPL_DEPTH_8U , 1);
-			for(unsigned int c=0;c<vImgDetect[k].size(); ++c) {
-				cvConvertScale( vImgDetect[k][c], tmp, out_scale); //80 128
-				sprintf_s(buffer,"%s/detect-%d_sc%d_c%d.png",outpath.c_str(),i,k,c);
-				cvSaveImage( buffer, tmp );
-				cvReleaseImage(&vImgDetect[k][c]);
-			}
-			cvReleaseImage(&tmp);
-		}
-
-		// Release image
-		cvReleaseImage(&img);
-
-	}
-
-}
-
-// Extract patches from training data
-void extract_Patches(CRPatch& Train, CvRNG* pRNG) {
-		
-	vector<string> vFilenames;
-	vector<CvRect> vBBox;
-	vector<vector<CvPoint> > vCenter;
-
-	// load positive file list
-	loadTrainPosFile(vFilenames,  vBBox, vCenter);
-
-	// load postive images and extract patches
-	for(int i=0; i<(int)vFilenames.size(); ++i) {
-
-	  if(i%50==0) cout << i << " " << flush;
-
-	  if(subsamples_pos <= 0 || (int)vFilenames.size()<=subsamples_pos || (cvRandReal(pRNG)*double(vFilenames.size()) < double(subsamples_pos)) ) {
-
-			// Load image
-			IplImage *img = 0;
-			img = cvLoadImage((trainpospath + "/" + vFilenames[i]).c_str(),CV_LOAD_IMAGE_COLOR);
-			if(!img) {
-				cout << "Could not load image file: " << (trainpospath + "/" + vFilenames[i]).c_str() << endl;
-				exit(-1);
-			}	
-
-			// Extract positive training patches
-			Train.extractPatches(img, samples_pos, 1, &vBBox[i], &vCenter[i]); 
-
-			// Release image
-			cvReleaseImage(&img);
-
-	  }
-			
-	}
-	cout << endl;
-
-	// load negative file list
-	loadTrainNegFile(vFilenames,  vBBox);
-
-	// load negative images and extract patches
-	for(int i=0; i<(int)vFilenames.size(); ++i) {
-
-		if(i%50==0) cout << i << " " << flush;
-
-		if(subsamples_neg <= 0 || (int)vFilenames.size()<=subsamples_neg || ( cvRandReal(pRNG)*double(vFilenames.size()) < double(subsamples_neg) ) ) {
-
-			// Load image
-			IplImage *img = 0;
-			img = cvLoadImage((trainnegpath + "/" + vFilenames[i]).c_str(),CV_LOAD_IMAGE_COLOR);
-
-			if(!img) {
-				cout << "Could not load image file: " << (trainnegpath + "/" + vFilenames[i]).c_str() << endl;
-				exit(-1);
-			}	
-
-			// Extract negative training patches
-			if(vBBox.size()==vFilenames.size())
-				Train.extractPatches(img, samples_neg, 0, &vBBox[i]); 
-			else
-				Train.extractPatches(img, samples_neg, 0); 
-
-			// Release image
-			cvReleaseImage(&img);
-
-		}
-			
-	}
-	cout << endl;
-}
-
-// Init and start detector
-void run_detect() {
-	// Init forest with number of trees
-	CRForest crForest( ntrees ); 
-
-	// Load forest
-	crForest.loadForest(treepath.c_str());	
-
-	// Init detector
-	CRForestDetector crDetect(&crForest, p_width, p_height);
-
-	// create directory for output
-	string execstr = "mkdir ";
-	execstr += outpath;
-	system( execstr.c_str() );
-
-	// run detector
-	detect(crDetect);
-}
-
-// Init and start training
-void run_train() {
-	// Init forest with number of trees
-	CRForest crForest( ntrees ); 
-
-	// Init random generator
-	time_t t = time(NULL);
-	int seed = (int)t;
-
-	CvRNG cvRNG(seed);
-						
-	// Create directory
-	string tpath(treepath);
-	tpath.erase(tpath.find_last_of(PATH_SEP));
-	string execstr = "mkdir ";
-	execstr += tpath;
-	system( execstr.c_str() );
-
-	// Init training data
-	CRPatch Train(&cvRNG, p_width, p_height, 2); 
-			
-	// Extract training patches
-	extract_Patches(Train, &cvRNG); 
-
-	// Train forest
-	crForest.trainForest(20, 15, &cvRNG, Train, 2000);
-
-	// Save forest
-	crForest.saveForest(treepath.c_str(), off_tree);
-
-}
-
-int main(int argc, char* argv[])
-{
-	int mode = 1;
-
-	// Check argument
-	if(argc<2) {
-		cout << "Usage: CRForest-Detector.exe mode [config.txt] [tree_offset]" << endl;
-		cout << "mode: 0 - train; 1 - show; 2 - detect" << endl;
-		cout << "tree_offset: output number for trees" << endl;
-		cout << "Load default: mode - 2" << endl; 
-	} else
-		mode = atoi(argv[1]);
-	
-	off_tree = 0;	
-	if(argc>3)
-		off_tree = atoi(argv[3]);
-
-	// load configuration for dataset
-	if(argc>2)
-		loadConfig(argv[2], mode);
-	else
-		loadConfig("config.txt", mode);
-
-	switch ( mode ) { 
-		case 0: 	
-			// train forest
-			run_train();
-			break;	
-
-		case 1: 
-					
-			// train forest
-			show();
-			break;	
-
-		default:
-
-			// detection
-			run_detect();
-			break;
-	}
-
-
-	return 0;
-}
-
-
+/* 
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+ 
+// You may use, copy, reproduce, and distribute this Software for any 
+// non-commercial purpose, subject to the restrictions of the 
+// Microsoft Research Shared Source license agreement ("MSR-SSLA"). 
+// Some purposes which can be non-commercial are teaching, academic 
+// research, public demonstrations and personal experimentation. You 
+// may also distribute this Software with books or other teaching 
+// materials, or publish the Software on websites, that are intended 
+// to teach the use of the Software for academic or other 
+// non-commercial purposes.
+// You may not use or distribute this Software or any derivative works 
+// in any form for commercial purposes. Examples of commercial 
+// purposes would be running business operations, licensing, leasing, 
+// or selling the Software, distributing the Software for use with 
+// commercial products, using the Software in the creation or use of 
+// commercial products or any other activity which purpose is to 
+// procure a commercial gain to you or others.
+// If the Software includes source code or data, you may create 
+// derivative works of such portions of the Software and distribute 
+// the modified Software for non-commercial purposes, as provided 
+// herein.
+
+// THE SOFTWARE COMES "AS IS", WITH NO WARRANTIES. THIS MEANS NO 
+// EXPRESS, IMPLIED OR STATUTORY WARRANTY, INCLUDING WITHOUT 
+// LIMITATION, WARRANTIES OF MERCHANTABILITY OR FITNESS FOR A 
+// PARTICULAR PURPOSE, ANY WARRANTY AGAINST INTERFERENCE WITH YOUR 
+// ENJOYMENT OF THE SOFTWARE OR ANY WARRANTY OF TITLE OR 
+// NON-INFRINGEMENT. THERE IS NO WARRANTY THAT THIS SOFTWARE WILL 
+// FULFILL ANY OF YOUR PARTICULAR PURPOSES OR NEEDS. ALSO, YOU MUST 
+// PASS THIS DISCLAIMER ON WHENEVER YOU DISTRIBUTE THE SOFTWARE OR 
+// DERIVATIVE WORKS.
+
+// NEITHER MICROSOFT NOR ANY CONTRIBUTOR TO THE SOFTWARE WILL BE 
+// LIABLE FOR ANY DAMAGES RELATED TO THE SOFTWARE OR THIS MSR-SSLA, 
+// INCLUDING DIRECT, INDIRECT, SPECIAL, CONSEQUENTIAL OR INCIDENTAL 
+// DAMAGES, TO THE MAXIMUM EXTENT THE LAW PERMITS, NO MATTER WHAT 
+// LEGAL THEORY IT IS BASED ON. ALSO, YOU MUST PASS THIS LIMITATION OF 
+// LIABILITY ON WHENEVER YOU DISTRIBUTE THE SOFTWARE OR DERIVATIVE 
+// WORKS.
+
+// When using this software, please acknowledge the effort that 
+// went into development by referencing the paper:
+//
+// Gall J. and Lempitsky V., Class-Specific Hough Forests for 
+// Object Detection, IEEE Conference on Computer Vision and Pattern 
+// Recognition (CVPR'09), 2009.
+
+// Note that this is not the original software that was used for 
+// the paper mentioned above. It is a re-implementation for Linux. 
+
+*/
+
+
+#define PATH_SEP "/"
+
+#include <stdexcept>
+
+#include <vector>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <highgui.h>
+
+#include "CRForestDetector.h"
+#include "CREvaluation.h"
+
+using namespace std;
+
+// Path to trees
+string treepath;
+// Number of trees
+int ntrees;
+// Patch width
+int p_width;
+// Patch height
+int p_height;
+// Path to images
+string impath;
+// File with names of images
+string imfiles;
+// Extract features (0: use feature cache)
+bool xtrFeature;
+// Scales
+vector<float> scales;
+// Ratio
+vector<float> ratios;
+// Output path
+string outpath;
+// scale factor for output image (default: 128)
+int out_scale;
+// Path to positive examples
+string trainpospath;
+// File with postive examples
+string trainposfiles;
+// Subset of positive images -1: all images
+int subsamples_pos;
+// Sample patches from pos. examples
+unsigned int samples_pos; 
+// Path to positive examples
+string trainnegpath;
+// File with postive examples
+string trainnegfiles;
+// Subset of neg images -1: all images
+int subsamples_neg;
+// Samples from pos. examples
+unsigned int samples_neg;
+
+// offset for saving tree number
+int off_tree;
+
+// Optional entries
+// Path to feature cache (default: output path + /features)
+string featcachepath;
+// Random seed for training (default 0: current time)
+int seed;
+// Number of threads (default 0: all cores)
+int nthreads;
+// Threshold search for training (default 0: random thresholds, 1: exact)
+int split_mode;
+// Tree growing for training (default 0: depth-first, 1: level-wise)
+int grow_mode;
+// Subsample size for scoring the tests of a node (default 0: all patches) and class balance (0: proportional, 1: balanced)
+int node_samples;
+int node_balance;
+// Path to patch store (default empty: patches are kept in memory)
+string patchstore;
+// Interval in seconds for checkpoints of training (default 0: no checkpoints)
+int ckpt_interval;
+// Leaf refill (default 0: rebuild leafs, 1: append patches to leafs)
+int refill_mode;
+// Tree format (default 0: text, 1: binary files that are mapped when loaded, 2: bundle with all trees)
+int tree_format;
+// Leaf encoding of binary trees and bundles (default 0: flat, 1: compressed)
+int leaf_encoding;
+// Number of trees used for detection (default 0: all trees)
+int ntrees_detect;
+// Name of shared memory segment with the forest for detection (default empty: forest is not shared)
+string sharedforest;
+// Number of worker processes for training (default 0: all cores) and restarts of failed workers (default 2)
+int nworkers;
+int nretries;
+// File with ground truth boxes of the test images for mode 8 (default empty: no evaluation)
+string gtfile;
+// Object size at scale 1 for the boxes of detections (default 0 0: no detections are extracted)
+int obj_width;
+int obj_height;
+// Number of object classes for training (default 1) and positive examples (path and file) of the classes 2..n
+int nclasses;
+vector<string> classpospath;
+vector<string> classposfiles;
+// Joint scale space for detection: number of bins between the smallest and largest scale (default 0: one Hough
+// image per scale) and spread of the votes of a scale over the bins in octaves
+int scale_bins;
+float scale_spread;
+// Voting for detection (default 0: direct, 1: grouped by leaf)
+int vote_mode;
+// Leaf maps of the test images (default 0: none, 1: save, 2: re-vote from the maps) and path (default: output path + /leafmaps)
+int leafmap_mode;
+string leafmappath;
+
+// Path to executable (for starting workers)
+string progpath;
+
+
+// load config file for dataset
+void loadConfig(const char* filename, int mode) {
+	char buffer[400];
+	ifstream in(filename);
+
+	if(in.is_open()) {
+
+		// Path to trees
+		in.getline(buffer,400);
+		in.getline(buffer,400); 
+		treepath = buffer;
+		// Number of trees
+		in.getline(buffer,400); 
+		in >> ntrees;
+		in.getline(buffer,400); 
+		// Patch width
+		in.getline(buffer,400); 
+		in >> p_width;
+		in.getline(buffer,400); 
+		// Patch height
+		in.getline(buffer,400); 
+		in >> p_height;
+		in.getline(buffer,400); 
+		// Path to images
+		in.getline(buffer,400); 
+		in.getline(buffer,400); 
+		impath = buffer;
+		// File with names of images
+		in.getline(buffer,400);
+		in.getline(buffer,400);
+		imfiles = buffer;
+		// Extract features
+		in.getline(buffer,400);
+		in >> xtrFeature;
+		in.getline(buffer,400); 
+		// Scales
+		in.getline(buffer,400);
+		int size;
+		in >> size;
+		scales.resize(size);
+		for(int i=0;i<size;++i)
+			in >> scales[i];
+		in.getline(buffer,400); 
+		// Ratio
+		in.getline(buffer,400);
+		in >> size;
+		ratios.resize(size);
+		for(int i=0;i<size;++i)
+			in >> ratios[i];
+		in.getline(buffer,400); 
+		// Output path
+		in.getline(buffer,400);
+		in.getline(buffer,400);
+		outpath = buffer;
+		// Scale factor for output image (default: 128)
+		in.getline(buffer,400);
+		in >> out_scale;
+		in.getline(buffer,400);
+		// Path to positive examples
+		in.getline(buffer,400);
+		in.getline(buffer,400);
+		trainpospath = buffer;
+		// File with postive examples
+		in.getline(buffer,400);
+		in.getline(buffer,400);
+		trainposfiles = buffer;
+		// Subset of positive images -1: all images
+		in.getline(buffer,400);
+		in >> subsamples_pos;
+		in.getline(buffer,400);
+		// Samples from pos. examples
+		in.getline(buffer,400);
+		in >> samples_pos;
+		in.getline(buffer,400);
+		// Path to positive examples
+		in.getline(buffer,400);
+		in.getline(buffer,400);
+		trainnegpath = buffer;
+		// File with postive examples
+		in.getline(buffer,400);
+		in.getline(buffer,400);
+		trainnegfiles = buffer;
+		// Subset of negative images -1: all images
+		in.getline(buffer,400);
+		in >> subsamples_neg;
+		in.getline(buffer,400);
+		// Samples from pos. examples
+		in.getline(buffer,400);
+		in >> samples_neg;
+		in.getline(buffer,400);
+
+		// Optional entries: comment line followed by value
+		featcachepath = outpath + "/features";
+		seed = 0;
+		nthreads = 0;
+		split_mode = 0;
+		grow_mode = 0;
+		node_samples = 0;
+		node_balance = 0;
+		patchstore.clear();
+		ckpt_interval = 0;
+		refill_mode = 0;
+		tree_format = 0;
+		ntrees_detect = 0;
+		leaf_encoding = 0;
+		sharedforest.clear();
+		nworkers = 0;
+		nretries = 2;
+		gtfile.clear();
+		obj_width = 0;
+		obj_height = 0;
+		nclasses = 1;
+		classpospath.clear();
+		classposfiles.clear();
+		scale_bins = 0;
+		scale_spread = 0;
+		vote_mode = 0;
+		leafmap_mode = mode==9 ? 2 : 0;
+		leafmappath = outpath + "/leafmaps";
+		while(in.getline(buffer,400)) {
+			string entry(buffer);
+			if(entry.find("# Feature cache")==0) {
+				in.getline(buffer,400);
+				featcachepath = buffer;
+			} else if(entry.find("# Random seed")==0) {
+				in >> seed;
+				in.getline(buffer,400);
+			} else if(entry.find("# Number of threads")==0) {
+				in >> nthreads;
+				in.getline(buffer,400);
+			} else if(entry.find("# Split search")==0) {
+				in >> split_mode;
+				in.getline(buffer,400);
+			} else if(entry.find("# Tree growing")==0) {
+				in >> grow_mode;
+				in.getline(buffer,400);
+			} else if(entry.find("# Node subsampling")==0) {
+				in >> node_samples;
+				in >> node_balance;
+				in.getline(buffer,400);
+			} else if(entry.find("# Checkpoint")==0) {
+				in >> ckpt_interval;
+				in.getline(buffer,400);
+			} else if(entry.find("# Leaf refill")==0) {
+				in >> refill_mode;
+				in.getline(buffer,400);
+			} else if(entry.find("# Tree format")==0) {
+				in >> tree_format;
+				in.getline(buffer,400);
+			} else if(entry.find("# Leaf encoding")==0) {
+				in >> leaf_encoding;
+				in.getline(buffer,400);
+			} else if(entry.find("# Shared forest")==0) {
+				in.getline(buffer,400);
+				sharedforest = buffer;
+			} else if(entry.find("# Detection trees")==0) {
+				in >> ntrees_detect;
+				in.getline(buffer,400);
+			} else if(entry.find("# Workers")==0) {
+				in >> nworkers;
+				in >> nretries;
+				in.getline(buffer,400);
+			} else if(entry.find("# Ground truth")==0) {
+				in.getline(buffer,400);
+				gtfile = buffer;
+			} else if(entry.find("# Object size")==0) {
+				in >> obj_width;
+				in >> obj_height;
+				in.getline(buffer,400);
+			} else if(entry.find("# Object classes")==0) {
+				in >> nclasses;
+				in.getline(buffer,400);
+				if(nclasses<1) nclasses = 1;
+				classpospath.resize(nclasses-1);
+				classposfiles.resize(nclasses-1);
+				for(int c=0; c<nclasses-1; ++c) {
+					in.getline(buffer,400);
+					classpospath[c] = buffer;
+					in.getline(buffer,400);
+					classposfiles[c] = buffer;
+				}
+			} else if(entry.find("# Scale space")==0) {
+				in >> scale_bins;
+				in >> scale_spread;
+				in.getline(buffer,400);
+			} else if(entry.find("# Voting")==0) {
+				in >> vote_mode;
+				in.getline(buffer,400);
+			} else if(entry.find("# Leaf maps")==0) {
+				int lm_mode;
+				in >> lm_mode;
+				in.getline(buffer,400);
+				in.getline(buffer,400);
+				leafmappath = buffer;
+				if(mode!=9)
+					leafmap_mode = lm_mode;
+			} else if(entry.find("# Patch store")==0) {
+				in.getline(buffer,400);
+				patchstore = buffer;
+			}
+		}
+
+	} else {
+		cerr << "File not found " << filename << endl;
+		exit(-1);
+	}
+	in.close();
+
+	switch ( mode ) { 
+		case 0:
+		case 3:
+		case 4:
+		case 5:
+		case 6:
+		cout << endl << "------------------------------------" << endl << endl;
+		cout << "Training:         " << endl;
+		cout << "Patches:          " << p_width << " " << p_height << endl;
+		cout << "Train pos:        " << trainpospath << endl;
+		cout << "                  " << trainposfiles << endl;
+		cout << "                  " << subsamples_pos << " " << samples_pos << endl;
+		for(int c=0; c<nclasses-1; ++c) {
+			cout << "Train class " << c+2 << ":    " << classpospath[c] << endl;
+			cout << "                  " << classposfiles[c] << endl;
+		}
+		cout << "Train neg:        " << trainnegpath << endl;
+		cout << "                  " << trainnegfiles << endl;
+		cout << "                  " << subsamples_neg << " " << samples_neg << endl;
+		cout << "Trees:            " << ntrees << " " << off_tree << " " << treepath << endl;
+		cout << "Threads:          " << nthreads << endl;
+		cout << "Split search:     " << split_mode << endl;
+		cout << "Tree growing:     " << grow_mode << endl;
+		cout << "Node subsampling: " << node_samples << " " << node_balance << endl;
+		cout << "Checkpoint:       " << ckpt_interval << endl;
+		cout << "Tree format:      " << tree_format << " " << leaf_encoding << endl;
+		if(!patchstore.empty())
+			cout << "Patch store:      " << patchstore << endl;
+		if(mode==4)
+			cout << "Workers:          " << nworkers << " " << nretries << endl;
+		if(mode==5)
+			cout << "Leaf refill:      " << refill_mode << endl;
+		cout << endl << "------------------------------------" << endl << endl;
+		break;
+
+		case 1:
+		cout << endl << "------------------------------------" << endl << endl;
+		cout << "Show:             " << endl;
+		cout << "Trees:            " << ntrees << " " << treepath << endl;
+		cout << endl << "------------------------------------" << endl << endl;
+		break;
+
+		default:
+		cout << endl << "------------------------------------" << endl << endl;
+		cout << "Detection:        " << endl;
+		cout << "Trees:            " << ntrees << " " << treepath << " " << tree_format << endl;
+		if(ntrees_detect>0)
+			cout << "Detection trees:  " << ntrees_detect << endl;
+		if(!sharedforest.empty())
+			cout << "Shared forest:    " << sharedforest << endl;
+		cout << "Patches:          " << p_width << " " << p_height << endl;
+		cout << "Images:           " << impath << endl;
+		cout << "                  " << imfiles << endl;
+		cout << "Scales:           "; for(unsigned int i=0;i<scales.size();++i) cout << scales[i] << " "; cout << endl;
+		cout << "Ratios:           "; for(unsigned int i=0;i<ratios.size();++i) cout << ratios[i] << " "; cout << endl;
+		if(scale_bins>0)
+			cout << "Scale space:      " << scale_bins << " " << scale_spread << endl;
+		if(vote_mode!=0)
+			cout << "Voting:           " << vote_mode << endl;
+		if(leafmap_mode!=0)
+			cout << "Leaf maps:        " << leafmap_mode << " " << leafmappath << endl;
+		cout << "Extract Features: " << xtrFeature << endl;
+		if(!xtrFeature)
+			cout << "Feature cache:    " << featcachepath << endl;
+		cout << "Output:           " << out_scale << " " << outpath << endl;
+		if(mode==8) {
+			cout << "Ground truth:     " << gtfile << endl;
+			cout << "Object size:      " << obj_width << " " << obj_height << endl;
+		}
+		cout << endl << "------------------------------------" << endl << endl;
+		break;
+	}
+
+}
+
+// load test image filenames
+void loadImFile(std::vector<string>& vFilenames) {
+	
+	char buffer[400];
+
+	ifstream in(imfiles.c_str());
+	if(in.is_open()) {
+
+		unsigned int size;
+		in >> size; //size = 10;
+		in.getline(buffer,400); 
+		vFilenames.resize(size);
+
+		for(unsigned int i=0; i<size; ++i) {
+			in.getline(buffer,400);      
+			vFilenames[i] = buffer;	
+		}
+
+	} else {
+		cerr << "File not found " << imfiles.c_str() << endl;
+		exit(-1);
+	}
+
+	in.close();
+}
+
+// load ground truth boxes of the test images
+// Format: number of images, then per line filename + number of boxes + boxes (top left - bottom right)
+// Test images that are not listed contain no objects
+void loadGTFile(const std::vector<string>& vFilenames, std::vector<std::vector<CvRect> >& vGT) {
+
+	unsigned int size; 
+	ifstream in(gtfile.c_str());
+
+	vGT.clear();
+	vGT.resize(vFilenames.size());
+
+	if(in.is_open()) {
+		in >> size;
+		for(unsigned int i=0; i<size; ++i) {
+			string name;
+			unsigned int num;
+			in >> name;
+			in >> num;
+
+			vector<CvRect> vBBox(num);
+			for(unsigned int b=0; b<num; ++b) {
+				in >> vBBox[b].x; in >> vBBox[b].y; 
+				in >> vBBox[b].width;
+				vBBox[b].width -= vBBox[b].x; 
+				in >> vBBox[b].height;
+				vBBox[b].height -= vBBox[b].y;
+			}
+
+			for(unsigned int k=0; k<vFilenames.size(); ++k)
+				if(vFilenames[k]==name)
+					vGT[k] = vBBox;
+		}
+
+		if(!in) {
+			cerr << "Could not read ground truth " << gtfile.c_str() << endl;
+			exit(-1);
+		}
+		in.close();
+	} else {
+		cerr << "File not found " << gtfile.c_str() << endl;
+		exit(-1);
+	}
+}
+
+// load positive training image filenames
+void loadTrainPosFile(const string& posfiles, std::vector<string>& vFilenames, std::vector<CvRect>& vBBox, std::vector<std::vector<CvPoint> >& vCenter) {
+
+	unsigned int size, numop; 
+	ifstream in(posfiles.c_str());
+
+	if(in.is_open()) {
+		in >> size;
+		in >> numop;
+		cout << "Load Train Pos Examples: " << size << " - " << numop << endl;
+
+		vFilenames.resize(size);
+		vCenter.resize(size);
+		vBBox.resize(size);
+
+		for(unsigned int i=0; i<size; ++i) {
+			// Read filename
+			in >> vFilenames[i];
+
+			// Read bounding box
+			in >> vBBox[i].x; in >> vBBox[i].y; 
+			in >> vBBox[i].width;
+			vBBox[i].width -= vBBox[i].x; 
+			in >> vBBox[i].height;
+			vBBox[i].height -= vBBox[i].y;
+
+			if(vBBox[i].width<p_width || vBBox[i].height<p_height) {
+			  cout << "Width or height are too small" << endl; 
+			  cout << vFilenames[i] << endl;
+			  exit(-1); 
+			}
+
+			// Read center points
+			vCenter[i].resize(numop);
+			for(unsigned int c=0; c<numop; ++c) {			
+				in >> vCenter[i][c].x;
+				in >> vCenter[i][c].y;
+			}				
+		}
+
+		in.close();
+	} else {
+		cerr << "File not found " << posfiles.c_str() << endl;
+		exit(-1);
+	}
+}
+
+// load negative training image filenames
+void loadTrainNegFile(std::vector<string>& vFilenames, std::vector<CvRect>& vBBox) {
+
+	unsigned int size, numop; 
+	ifstream in(trainnegfiles.c_str());
+
+	if(in.is_open()) {
+		in >> size;
+		in >> numop;
+		cout << "Load Train Neg Examples: " << size << " - " << numop << endl;
+
+		vFilenames.resize(size);
+		if(numop>0)
+			vBBox.resize(size);
+		else
+			vBBox.clear();
+
+		for(unsigned int i=0; i<size; ++i) {
+			// Read filename
+			in >> vFilenames[i];
+
+			// Read bounding box (if available)
+			if(numop>0) {
+				in >> vBBox[i].x; in >> vBBox[i].y; 
+				in >> vBBox[i].width;
+				vBBox[i].width -= vBBox[i].x; 
+				in >> vBBox[i].height;
+				vBBox[i].height -= vBBox[i].y;
+
+				if(vBBox[i].width<p_width || vBBox[i].height<p_height) {
+				  cout << "Width or height are too small" << endl; 
+				  cout << vFilenames[i] << endl;
+				  exit(-1); 
+				}
+
+			}
+
+				
+		}
+
+		in.close();
+	} else {
+		cerr << "File not found " << trainposfiles.c_str() << endl;
+		exit(-1);
+	}
+}
+
+// Show leaves
+void show() {
+	// Init forest with number of trees
+	CRForest crForest( ntrees ); 
+
+	// Load forest
+	crForest.loadForest(treepath.c_str(), tree_format);	
+
+	// Show leaves
+	crForest.show(100,100);
+}
+
+
+// Scales of the Hough images: the scales or the bins of the scale space (log-uniform from the smallest to the largest scale)
+void houghScales(vector<float>& vScales) {
+	if(scale_bins<=0) {
+		vScales = scales;
+		return;
+	}
+
+	float smin = *min_element(scales.begin(), scales.end());
+	float smax = *max_element(scales.begin(), scales.end());
+	vScales.resize(scale_bins);
+	for(int b=0; b<scale_bins; ++b)
+		vScales[b] = scale_bins>1 ? smin * pow(smax/smin, b/float(scale_bins-1)) : smin;
+}
+
+// Hough images of all scales for an image
+void detectImage(CRForestDetector& crDetect, IplImage* img, const vector<float>& vScales, vector<vector<IplImage*> >& vImgDetect, const char* filename) {
+	if(scale_bins>0)
+		crDetect.detectSpace(img, scales, vScales, vImgDetect, ratios, scale_spread, filename);
+	else
+		crDetect.detectPyramid(img, vImgDetect, ratios, filename);
+}
+
+// Run detector
+void detect(CRForestDetector& crDetect) {
+
+	// Load image names
+	vector<string> vFilenames;
+	loadImFile(vFilenames);
+				
+	char buffer[200];
+
+	// Storage for output
+	vector<float> vScales;
+	houghScales(vScales);
+	vector<vector<IplImage*> > vImgDetect(vScales.size());	
+
+	// Report of instrumented detector (built with PROFILE=1)
+	CR_PROFILE_OPEN((outpath + "/profile.jsonl").c_str());
+
+	// Run detector for each image
+	for(unsigned int i=0; i<vFilenames.size(); ++i) {
+
+		// Load image
+		IplImage *img = 0;
+		img = cvLoadImage((impath + "/" + vFilenames[i]).c_str(),CV_LOAD_IMAGE_COLOR);
+		if(!img) {
+			cout << "Could not load image file: " << (impath + "/" + vFilenames[i]).c_str() << endl;
+			exit(-1);
+		}	
+		CR_PROFILE_BEGIN(vFilenames[i].c_str());
+
+		// Prepare scales (ratios for each object class)
+		for(unsigned int k=0;k<vImgDetect.size(); ++k) {
+			vImgDetect[k].resize(ratios.size()*crDetect.GetNumClasses());
+			for(unsigned int c=0;c<vImgDetect[k].size(); ++c) {
+				vImgDetect[k][c] = cvCreateImage( cvSize(int(img->width*vScales[k]+0.5),int(img->height*vScales[k]+0.5)), IPL_DEPTH_32F, 1 );
+			}
+		}
+
+		// Detection for all scales
+		detectImage(crDetect, img, vScales, vImgDetect, (impath + "/" + vFilenames[i]).c_str());
+
+		// Store result
+		CR_PROFILE_START(t_write);
+		for(unsigned int k=0;k<vImgDetect.size(); ++k) {
+			IplImage* tmp = cvCreateImage( cvSize(vImgDetect[k][0]->width,vImgDetect[k][0]->height) , IPL_DEPTH_8U , 1);
+			for(unsigned int c=0;c<vImgDetect[k].size(); ++c) {
+				cvConvertScale( vImgDetect[k][c], tmp, out_scale); //80 128
+				if(crDetect.GetNumClasses()>1)
+					sprintf_s(buffer,"%s/detect-%d_sc%d_c%d_cl%d.png",outpath.c_str(),i,k,int(c%ratios.size()),int(c/ratios.size())+1);
+				else
+					sprintf_s(buffer,"%s/detect-%d_sc%d_c%d.png",outpath.c_str(),i,k,c);
+				cvSaveImage( buffer, tmp );
+				cvReleaseImage(&vImgDetect[k][c]);
+			}
+			cvReleaseImage(&tmp);
+		}
+		CR_PROFILE_STOP(STAGE_WRITE, t_write);
+		CR_PROFILE_END();
+
+		// Release image
+		cvReleaseImage(&img);
+
+	}
+
+	CR_PROFILE_CLOSE();
+}
+
+// Run detector on all test images and measure speed and, with ground truth, accuracy
+// Writes outpath/benchmark.json, the detections (outpath/detections.txt) and the precision recall curve (outpath/pr.txt)
+void benchmark(CRForestDetector& crDetect) {
+
+	// Load image names
+	vector<string> vFilenames;
+	loadImFile(vFilenames);
+
+	vector<vector<CvRect> > vGT(vFilenames.size());
+	bool evaluate = !gtfile.empty();
+	if(evaluate)
+		loadGTFile(vFilenames, vGT);
+	bool maxima = obj_width>0 && obj_height>0;
+	if(evaluate && !maxima) {
+		cerr << "No object size in config file" << endl;
+		exit(-1);
+	}
+
+	// Storage for output
+	vector<float> vScales;
+	houghScales(vScales);
+	vector<vector<IplImage*> > vImgDetect(vScales.size());	
+	CREvaluation crEval;
+	vector<double> vLatency(vFilenames.size());
+	ofstream detout;
+	if(maxima)
+		detout.open((outpath + "/detections.txt").c_str());
+
+	double tstart = CRProfile::now();
+	for(unsigned int i=0; i<vFilenames.size(); ++i) {
+		double t = CRProfile::now();
+
+		// Load image
+		IplImage *img = cvLoadImage((impath + "/" + vFilenames[i]).c_str(),CV_LOAD_IMAGE_COLOR);
+		if(!img) {
+			cout << "Could not load image file: " << (impath + "/" + vFilenames[i]).c_str() << endl;
+			exit(-1);
+		}	
+
+		// Prepare scales (ratios for each object class)
+		for(unsigned int k=0;k<vImgDetect.size(); ++k) {
+			vImgDetect[k].resize(ratios.size()*crDetect.GetNumClasses());
+			for(unsigned int c=0;c<vImgDetect[k].size(); ++c) {
+				vImgDetect[k][c] = cvCreateImage( cvSize(int(img->width*vScales[k]+0.5),int(img->height*vScales[k]+0.5)), IPL_DEPTH_32F, 1 );
+			}
+		}
+
+		// Detection for all scales
+		detectImage(crDetect, img, vScales, vImgDetect, (impath + "/" + vFilenames[i]).c_str());
+
+		// Detections
+		vector<Hypothesis> vHyp;
+		if(maxima)
+			CREvaluation::detectMaxima(vImgDetect, ratios, img->width, img->height, obj_width, obj_height, 100, vHyp, scale_bins>0);
+
+		vLatency[i] = CRProfile::now() - t;
+
+		crEval.addImage(vHyp, vGT[i]);
+		if(maxima) {
+			detout << vFilenames[i] << " " << vHyp.size();
+			for(unsigned int h=0; h<vHyp.size(); ++h)
+				detout << " " << int(vHyp[h].x+0.5) << " " << int(vHyp[h].y+0.5) << " " << int(vHyp[h].x+vHyp[h].width+0.5) << " " << int(vHyp[h].y+vHyp[h].height+0.5) << " " << vHyp[h].score;
+			detout << endl;
+		}
+
+		// Release images
+		for(unsigned int k=0;k<vImgDetect.size(); ++k)
+			for(unsigned int c=0;c<vImgDetect[k].size(); ++c)
+				cvReleaseImage(&vImgDetect[k][c]);
+		cvReleaseImage(&img);
+	}
+	double total = CRProfile::now() - tstart;
+	detout.close();
+
+	// Speed: latency percentiles (nearest rank) and peak memory
+	vector<double> vSorted(vLatency);
+	sort(vSorted.begin(), vSorted.end());
+	const int num_pct = 4;
+	const double pct[num_pct] = {50, 90, 99, 100};
+	double latency[num_pct];
+	for(int p=0; p<num_pct; ++p)
+		latency[p] = vSorted.empty() ? 0 : vSorted[max(0, int(ceil(pct[p]/100*vSorted.size()))-1)];
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+
+	double ap = 0, eer = 0, max_recall = 0;
+	if(evaluate) {
+		crEval.summary(ap, eer, max_recall);
+
+		vector<float> vScore, vRecall, vPrecision;
+		crEval.curve(vScore, vRecall, vPrecision);
+		ofstream out((outpath + "/pr.txt").c_str());
+		out << "% threshold recall precision" << endl;
+		for(unsigned int k=0; k<vScore.size(); ++k)
+			out << vScore[k] << " " << vRecall[k] << " " << vPrecision[k] << endl;
+	}
+
+	ofstream out((outpath + "/benchmark.json").c_str());
+	if(!out.is_open()) {
+		cerr << "Could not write " << outpath << "/benchmark.json" << endl;
+		exit(-1);
+	}
+	out.precision(6);
+	out << "{" << endl;
+	out << "  \"images\": " << vFilenames.size() << "," << endl;
+	out << "  \"trees\": " << crDetect.GetNumTrees() << "," << endl;
+	out << "  \"time_s\": " << total << "," << endl;
+	out << "  \"images_per_s\": " << (total>0 ? vFilenames.size()/total : 0) << "," << endl;
+	out << "  \"latency_s\": {\"p50\": " << latency[0] << ", \"p90\": " << latency[1] << ", \"p99\": " << latency[2] << ", \"max\": " << latency[3] << "}," << endl;
+	out << "  \"peak_rss_kb\": " << usage.ru_maxrss;
+	if(evaluate) {
+		out << "," << endl << "  \"objects\": " << crEval.GetNumGT() << "," << endl;
+		out << "  \"detections\": " << crEval.GetNumDetections() << "," << endl;
+		out << "  \"average_precision\": " << ap << "," << endl;
+		out << "  \"equal_error_rate\": " << eer << "," << endl;
+		out << "  \"max_recall\": " << max_recall;
+	}
+	out << endl << "}" << endl;
+
+	cout << "Images:           " << vFilenames.size() << " (" << (total>0 ? vFilenames.size()/total : 0) << " per sec)" << endl;
+	cout << "Latency:          " << latency[0] << " " << latency[1] << " " << latency[2] << " " << latency[3] << " sec (50% 90% 99% max)" << endl;
+	cout << "Peak memory:      " << usage.ru_maxrss << " KB" << endl;
+	if(evaluate)
+		cout << "Accuracy:         AP " << ap << ", EER " << eer << ", max recall " << max_recall << " (" << crEval.GetNumGT() << " objects)" << endl;
+}
+
+// Extract patches from training data
+// Load images and extract patches of label in parallel
+// Each image has its own random generator derived from pRNG and the image number; the patches are 
+// added in the order of the images, i.e., the patches do not depend on the number of threads
+void extract_Images(CRPatch& Train, CvRNG* pRNG, int label, const string& path, const vector<string>& vFilenames, const vector<int>& vImages, 
+					unsigned int samples, vector<CvRect>* vBBox, vector<vector<CvPoint> >* vCenter) {
+	CvRNG labelRNG = CRPatch::streamSeed(*pRNG, label);
+
+	int threads = nthreads;
+#ifdef _OPENMP
+	if(threads<=0) threads = omp_get_max_threads();
+#else
+	threads = 1;
+#endif
+
+#pragma omp parallel for ordered schedule(dynamic) num_threads(threads) if(threads>1)
+	for(int k=0; k<(int)vImages.size(); ++k) {
+		int i = vImages[k];
+
+		// Load image
+		IplImage *img = 0;
+		img = cvLoadImage((path + "/" + vFilenames[i]).c_str(),CV_LOAD_IMAGE_COLOR);
+		if(!img) {
+			cout << "Could not load image file: " << (path + "/" + vFilenames[i]).c_str() << endl;
+			exit(-1);
+		}	
+
+		// Extract training patches
+		CvRNG imgRNG = CRPatch::streamSeed(labelRNG, i);
+		CRPatch Patches(&imgRNG, p_width, p_height, Train.vLPatches.size());
+		Patches.extractPatches(img, samples, label, vBBox!=0 ? &(*vBBox)[i] : 0, vCenter!=0 ? &(*vCenter)[i] : 0); 
+
+		// Release image
+		cvReleaseImage(&img);
+
+		// Add patches in order of images
+#pragma omp ordered
+		{
+			if(k%50==0) cout << k << " " << flush;
+			Train.addPatches(Patches);
+		}
+	}
+}
+
+void extract_Patches(CRPatch& Train, CvRNG* pRNG) {
+		
+	vector<string> vFilenames;
+	vector<CvRect> vBBox;
+	vector<vector<CvPoint> > vCenter;
+
+	// positive examples of the object classes (label 1..n)
+	vector<int> vImages;
+	for(int c=1; c<(int)Train.vLPatches.size(); ++c) {
+		const string& pospath = c==1 ? trainpospath : classpospath[c-2];
+		const string& posfiles = c==1 ? trainposfiles : classposfiles[c-2];
+
+		// load positive file list
+		loadTrainPosFile(posfiles, vFilenames,  vBBox, vCenter);
+
+		// subset of positive images
+		vImages.clear();
+		for(int i=0; i<(int)vFilenames.size(); ++i)
+		  if(subsamples_pos <= 0 || (int)vFilenames.size()<=subsamples_pos || (cvRandReal(pRNG)*double(vFilenames.size()) < double(subsamples_pos)) )
+				vImages.push_back(i);
+
+		// load postive images and extract patches
+		extract_Images(Train, pRNG, c, pospath, vFilenames, vImages, samples_pos, &vBBox, &vCenter);
+		cout << endl;
+	}
+
+	// load negative file list
+	loadTrainNegFile(vFilenames,  vBBox);
+
+	// subset of negative images
+	vImages.clear();
+	for(int i=0; i<(int)vFilenames.size(); ++i)
+		if(subsamples_neg <= 0 || (int)vFilenames.size()<=subsamples_neg || ( cvRandReal(pRNG)*double(vFilenames.size()) < double(subsamples_neg) ) )
+			vImages.push_back(i);
+
+	// load negative images and extract patches
+	extract_Images(Train, pRNG, 0, trainnegpath, vFilenames, vImages, samples_neg, vBBox.size()==vFilenames.size() ? &vBBox : 0, 0);
+	cout << endl;
+}
+
+// Init and start detector (or benchmark)
+void run_detect(bool bench) {
+	// Init forest with number of trees (only the first trees are loaded for a faster detector)
+	CRForest crForest( ntrees_detect>0 && ntrees_detect<ntrees ? ntrees_detect : ntrees ); 
+
+	// Load forest
+	// or attach to the shared forest; the first process publishes its forest and uses the shared copy
+	// (a segment of another forest is removed and published again)
+	crForest.SetPatchSize(p_width, p_height);
+	if(sharedforest.empty() || !crForest.attachShared(sharedforest.c_str(), treepath.c_str(), tree_format)) {
+		crForest.loadForest(treepath.c_str(), tree_format);	
+		if(!sharedforest.empty() && crForest.publishShared(sharedforest.c_str(), treepath.c_str(), tree_format))
+			crForest.attachShared(sharedforest.c_str(), treepath.c_str(), tree_format);
+	}
+
+	// Init detector
+	CRForestDetector crDetect(&crForest, p_width, p_height);
+	crDetect.SetVoting(vote_mode);
+
+	// create directory for output
+	string execstr = "mkdir ";
+	execstr += outpath;
+	system( execstr.c_str() );
+
+	// Use cached feature channels
+	CRFeatureCache crCache(featcachepath);
+	if(!xtrFeature) {
+		execstr = "mkdir -p ";
+		execstr += featcachepath;
+		system( execstr.c_str() );
+
+		crDetect.SetFeatureCache(&crCache);
+	}
+
+	// Save leafs of the patches or re-vote from them
+	CRLeafMaps crLeafMaps(leafmappath);
+	if(leafmap_mode>0) {
+		execstr = "mkdir -p ";
+		execstr += leafmappath;
+		system( execstr.c_str() );
+
+		if(!crDetect.SetLeafMaps(&crLeafMaps, leafmap_mode)) {
+			cerr << "Leaf maps require trees with at most 65536 leafs" << endl;
+			exit(-1);
+		}
+	}
+
+	// run detector
+	if(bench)
+		benchmark(crDetect);
+	else
+		detect(crDetect);
+}
+
+// Init random seed for training
+void initSeed() {
+	if(seed==0) {
+		time_t t = time(NULL);
+		seed = (int)t;
+	}
+	cout << "Seed: " << seed << endl;
+}
+
+// Extract training patches and write them to the patch store
+void extract_Store(CRPatch& Train, CvRNG* pRNG) {
+	// Create directory
+	string execstr = "mkdir -p ";
+	execstr += patchstore;
+	system( execstr.c_str() );
+
+	Train.SetStore(patchstore);
+	extract_Patches(Train, pRNG);
+	if(!Train.closeStore()) {
+		cerr << "Could not write patch store " << patchstore << endl;
+		exit(-1);
+	}
+}
+
+// Extract training patches
+// or map them from the patch store (extracted first if it does not exist)
+void load_Patches(CRPatch& Train, CvRNG* pRNG) {
+	if(patchstore.empty()) {
+		extract_Patches(Train, pRNG); 
+	} else if(!Train.mapStore(patchstore)) {
+		extract_Store(Train, pRNG);
+		if(!Train.mapStore(patchstore)) {
+			cerr << "Could not map patch store " << patchstore << endl;
+			exit(-1);
+		}
+	}
+}
+
+// Init and start patch extraction
+void run_extract() {
+	if(patchstore.empty()) {
+		cerr << "No patch store in config file" << endl;
+		exit(-1);
+	}
+
+	// Init random generator
+	initSeed();
+	CvRNG cvRNG(seed);
+
+	// Extract training patches to patch store
+	CRPatch Train(&cvRNG, p_width, p_height, nclasses+1); 
+	extract_Store(Train, &cvRNG);
+}
+
+// Init and start training
+void run_train() {
+	// Init forest with number of trees
+	CRForest crForest( ntrees ); 
+
+	// Init random generator
+	initSeed();
+	CvRNG cvRNG(seed);
+						
+	// Create directory
+	string tpath(treepath);
+	tpath.erase(tpath.find_last_of(PATH_SEP));
+	string execstr = "mkdir ";
+	execstr += tpath;
+	system( execstr.c_str() );
+
+	// Init training data
+	CRPatch Train(&cvRNG, p_width, p_height, nclasses+1); 
+	load_Patches(Train, &cvRNG);
+
+	// Train forest
+	// Random generators of the trees do not depend on patch extraction
+	CvRNG treeRNG(seed);
+	crForest.SetSplitMode(split_mode);
+	crForest.SetGrowMode(grow_mode);
+	crForest.SetNodeSamples(node_samples, node_balance!=0);
+	crForest.SetCheckpoint(treepath.c_str(), ckpt_interval);
+	crForest.trainForest(20, 15, &treeRNG, Train, 2000, off_tree, nthreads);
+
+	// Save forest
+	// (trees with offset are saved as text files since a bundle contains the whole forest)
+	crForest.SetPatchSize(p_width, p_height);
+	crForest.SetLeafEncoding(leaf_encoding);
+	crForest.saveForest(treepath.c_str(), off_tree, off_tree>0 && tree_format==2 ? 0 : tree_format);
+
+}
+
+// Recompute the leafs of the forest from the training patches and save it
+void run_refill() {
+	// Init forest with number of trees
+	CRForest crForest( ntrees ); 
+
+	// Load forest
+	crForest.SetPatchSize(p_width, p_height);
+	crForest.SetLeafEncoding(leaf_encoding);
+	crForest.loadForest(treepath.c_str(), tree_format);	
+
+	// Init random generator
+	initSeed();
+	CvRNG cvRNG(seed);
+
+	// Init training data
+	CRPatch Train(&cvRNG, p_width, p_height, nclasses+1); 
+	load_Patches(Train, &cvRNG);
+
+	// Refill leafs
+	crForest.refillForest(Train, refill_mode==1, nthreads);
+
+	// Save forest
+	crForest.saveForest(treepath.c_str(), 0, tree_format);
+}
+
+// Remove shared forest
+void run_unshare() {
+	if(sharedforest.empty() || !CRForest::removeShared(sharedforest.c_str())) {
+		cerr << "Could not remove shared forest " << sharedforest << endl;
+		exit(-1);
+	}
+	cout << "Removed shared forest " << sharedforest << endl;
+}
+
+// Convert forest into the tree format of the config file
+// from text files, or into text files from the bundle (if it exists) or the binary files
+void run_convert() {
+	int type = 0;
+	if(tree_format==0) {
+		struct stat st;
+		type = stat((treepath + ".forest").c_str(), &st)==0 ? 2 : 1;
+	}
+
+	CRForest crForest( ntrees ); 
+	crForest.SetPatchSize(p_width, p_height);
+	crForest.SetLeafEncoding(leaf_encoding);
+	crForest.loadForest(treepath.c_str(), type);	
+	crForest.saveForest(treepath.c_str(), 0, tree_format);
+}
+
+// Shard of the forest that is trained by one worker process
+struct Shard {
+	// first tree and number of trees
+	int first;
+	int num;
+	// directory with config, log, and trees of the shard
+	string path;
+	// process id of worker (0: not running)
+	pid_t pid;
+	// number of started workers
+	int attempts;
+	bool done;
+};
+
+// Filename of tree i of a shard
+string shardTree(const Shard& shard, int i) {
+	char buffer[400];
+	string name = treepath.substr(treepath.find_last_of(PATH_SEP)+1);
+	sprintf_s(buffer,"%s%s%s%03d.txt",shard.path.c_str(),PATH_SEP,name.c_str(),i);
+	return buffer;
+}
+
+// Check whether all trees of a shard are complete
+bool check_Shard(const Shard& shard) {
+	for(int i=shard.first; i<shard.first+shard.num; ++i)
+		if(!CRTree::checkTree(shardTree(shard, i).c_str()))
+			return false;
+	return true;
+}
+
+// Write config file of a shard: copy of config with own tree path and number of trees, 
+// seed, patch store, threads, and text tree format appended
+void write_ShardConfig(const char* config, const Shard& shard, int threads) {
+	char buffer[400];
+	ifstream in(config);
+	string cfg = shard.path + "/config.txt";
+	ofstream out(cfg.c_str());
+	if(!in.is_open() || !out.is_open()) {
+		cerr << "Could not write shard config " << cfg << endl;
+		exit(-1);
+	}
+
+	string name = treepath.substr(treepath.find_last_of(PATH_SEP)+1);
+	for(int line=0; in.getline(buffer,400); ++line) {
+		if(line==1)
+			out << shard.path << PATH_SEP << name << endl;
+		else if(line==3)
+			out << shard.num << endl;
+		else
+			out << buffer << endl;
+	}
+	out << "# Random seed" << endl << seed << endl;
+	out << "# Patch store" << endl << patchstore << endl;
+	out << "# Number of threads" << endl << threads << endl;
+	out << "# Tree format" << endl << 0 << endl;
+}
+
+// Start worker process for a shard: CRForest-Detector 0 config first_tree
+void start_Shard(Shard& shard) {
+	string cfg = shard.path + "/config.txt";
+	string log = shard.path + "/log.txt";
+	char offset[20];
+	sprintf_s(offset,"%d",shard.first);
+
+	++shard.attempts;
+	cout << "Start shard " << shard.first << "-" << shard.first+shard.num-1 << " (attempt " << shard.attempts << ")" << endl;
+
+	shard.pid = fork();
+	if(shard.pid==0) {
+		// worker output goes to log of shard
+		int fd = open(log.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fd>=0) {
+			dup2(fd, 1);
+			dup2(fd, 2);
+			close(fd);
+		}
+		execlp(progpath.c_str(), progpath.c_str(), "0", cfg.c_str(), offset, (char*)0);
+		_exit(127);
+	} else if(shard.pid<0) {
+		cerr << "Could not start worker" << endl;
+		shard.pid = 0;
+	}
+}
+
+// FNV-1a hash of a file
+unsigned long long fileHash(const string& filename, long long& bytes) {
+	unsigned long long hash = 14695981039346656037ULL;
+	bytes = 0;
+	ifstream in(filename.c_str(), ios::binary);
+	char buffer[4096];
+	while(in.read(buffer, sizeof(buffer)) || in.gcount()>0) {
+		for(int i=0; i<in.gcount(); ++i) {
+			hash ^= (unsigned char)buffer[i];
+			hash *= 1099511628211ULL;
+		}
+		bytes += in.gcount();
+	}
+	return hash;
+}
+
+// Train forest with worker processes and merge the trees of the shards
+void run_workers(const char* config) {
+	if(ntrees<=0) {
+		cerr << "No trees to train in config file" << endl;
+		exit(-1);
+	}
+
+	// Init random generator
+	initSeed();
+						
+	// Create directories
+	string tpath(treepath);
+	tpath.erase(tpath.find_last_of(PATH_SEP));
+	string execstr = "mkdir -p ";
+	execstr += tpath + PATH_SEP + "shards";
+	system( execstr.c_str() );
+
+	// All workers use the same patches (extracted first if the patch store does not exist)
+	if(patchstore.empty())
+		patchstore = tpath + PATH_SEP + "patches";
+	unsigned long long data;
+	{
+		CvRNG cvRNG(seed);
+		CRPatch Train(&cvRNG, p_width, p_height, nclasses+1); 
+		load_Patches(Train, &cvRNG);
+		data = Train.checksum();
+	}
+
+	// Split trees into shards
+	int cores = sysconf(_SC_NPROCESSORS_ONLN);
+	int workers = nworkers>0 ? nworkers : cores;
+	if(workers>ntrees) workers = ntrees;
+	int threads = max(1, (nthreads>0 ? nthreads : cores) / workers);
+
+	vector<Shard> vShards(workers);
+	for(int k=0; k<workers; ++k) {
+		Shard& shard = vShards[k];
+		shard.first = off_tree + k*ntrees/workers;
+		shard.num = off_tree + (k+1)*ntrees/workers - shard.first;
+		char buffer[400];
+		sprintf_s(buffer,"%s/shards/shard%03d",tpath.c_str(),shard.first);
+		shard.path = buffer;
+		shard.pid = 0;
+		shard.attempts = 0;
+
+		// Shards that are already complete (earlier run or other machine) are skipped
+		shard.done = check_Shard(shard);
+		if(shard.done) {
+			cout << "Shard " << shard.first << "-" << shard.first+shard.num-1 << " done" << endl;
+		} else {
+			execstr = "mkdir -p ";
+			execstr += shard.path;
+			system( execstr.c_str() );
+			write_ShardConfig(config, shard, threads);
+		}
+	}
+
+	// Run workers and restart failed shards
+	int running = 0;
+	while(true) {
+		for(unsigned int k=0; k<vShards.size(); ++k) {
+			Shard& shard = vShards[k];
+			if(!shard.done && shard.pid==0 && shard.attempts<=nretries && running<workers) {
+				start_Shard(shard);
+				if(shard.pid>0) ++running;
+			}
+		}
+		if(running==0)
+			break;
+
+		int status;
+		pid_t pid = wait(&status);
+		if(pid<0)
+			break;
+		for(unsigned int k=0; k<vShards.size(); ++k) {
+			Shard& shard = vShards[k];
+			if(shard.pid!=pid) continue;
+
+			shard.pid = 0;
+			--running;
+			shard.done = WIFEXITED(status) && WEXITSTATUS(status)==0 && check_Shard(shard);
+			if(shard.done) 
+				cout << "Shard " << shard.first << "-" << shard.first+shard.num-1 << " done" << endl;
+			else
+				cerr << "Shard " << shard.first << "-" << shard.first+shard.num-1 << " failed, see " << shard.path << "/log.txt" << endl;
+		}
+	}
+
+	for(unsigned int k=0; k<vShards.size(); ++k) {
+		if(!vShards[k].done) {
+			cerr << "Training failed; complete shards are kept and skipped when restarted" << endl;
+			exit(-1);
+		}
+	}
+
+	// Merge trees into forest directory and write manifest
+	string name = treepath.substr(treepath.find_last_of(PATH_SEP)+1);
+	string manifest = tpath + PATH_SEP + "manifest.txt";
+	ofstream out(manifest.c_str());
+	out << "# Forest: trees first_tree seed patch_store config patches_checksum" << endl;
+	char datahex[20];
+	sprintf_s(datahex,"%016llx",data);
+	out << ntrees << " " << off_tree << " " << seed << " " << patchstore << " " << config << " " << datahex << endl;
+	out << "# Trees: tree file shard attempts bytes fnv1a" << endl;
+	for(unsigned int k=0; k<vShards.size(); ++k) {
+		const Shard& shard = vShards[k];
+		for(int i=shard.first; i<shard.first+shard.num; ++i) {
+			char buffer[400];
+			sprintf_s(buffer,"%s%03d.txt",treepath.c_str(),i);
+			if(rename(shardTree(shard, i).c_str(), buffer)!=0) {
+				cerr << "Could not move tree to " << buffer << endl;
+				exit(-1);
+			}
+
+			long long bytes;
+			unsigned long long hash = fileHash(buffer, bytes);
+			char hex[20];
+			sprintf_s(hex,"%016llx",hash);
+			sprintf_s(buffer,"%s%03d.txt",name.c_str(),i);
+			out << i << " " << buffer << " " << shard.first << " " << shard.attempts << " " << bytes << " " << hex << endl;
+		}
+	}
+	if(!out.good()) {
+		cerr << "Could not write manifest " << manifest << endl;
+		exit(-1);
+	}
+	cout << "Forest " << treepath << " merged from " << vShards.size() << " shards" << endl;
+
+	// Workers save text trees
+	if(tree_format!=0)
+		run_convert();
+}
+
+int main(int argc, char* argv[])
+{
+	int mode = 1;
+
+	// Check argument
+	if(argc<2) {
+		cout << "Usage: CRForest-Detector.exe mode [config.txt] [tree_offset]" << endl;
+		cout << "mode: 0 - train; 1 - show; 2 - detect; 3 - extract patches; 4 - train with worker processes; 5 - refill leafs; 6 - convert trees; 7 - remove shared forest; 8 - benchmark detection; 9 - re-vote detection from leaf maps" << endl;
+		cout << "tree_offset: output number for trees" << endl;
+		cout << "Load default: mode - 2" << endl; 
+	} else
+		mode = atoi(argv[1]);
+	
+	progpath = argv[0];
+
+	off_tree = 0;	
+	if(argc>3)
+		off_tree = atoi(argv[3]);
+
+	// load configuration for dataset
+	if(argc>2)
+		loadConfig(argv[2], mode);
+	else
+		loadConfig("config.txt", mode);
+
+	switch ( mode ) { 
+		case 0: 	
+			// train forest
+			run_train();
+			break;	
+
+		case 1: 
+					
+			// train forest
+			show();
+			break;	
+
+		case 3:
+
+			// extract patches to patch store
+			run_extract();
+			break;
+
+		case 4:
+
+			// train forest with worker processes
+			run_workers(argc>2 ? argv[2] : "config.txt");
+			break;
+
+		case 5:
+
+			// recompute leafs of forest
+			run_refill();
+			break;
+
+		case 6:
+
+			// convert trees between text and binary format
+			run_convert();
+			break;
+
+		case 7:
+
+			// remove shared forest from memory
+			run_unshare();
+			break;
+
+		case 8:
+
+			// detection with speed and accuracy report
+			run_detect(true);
+			break;
+
+		case 9:
+
+			// detection with the leafs of the leaf maps (see loadConfig)
+			run_detect(false);
+			break;
+
+		default:
+
+			// detection
+			run_detect(false);
+			break;
+	}
+
+
+	return 0;
+}
+
+
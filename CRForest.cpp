@@ -0,0 +1,347 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRForest.h"
+#include "CRFileUtil.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+// Header of a forest bundle
+// followed by the index (num_trees BundleEntry) and the binary trees (see CRTree::binaryTree)
+struct BundleHeader {
+	char magic[8];
+	// bundleOrder as written by the machine that saved the bundle
+	unsigned int order;
+	// version of the layout
+	unsigned int version;
+	unsigned int num_trees;
+	// patch size and number of center points
+	int width;
+	int height;
+	unsigned int num_cp;
+	// channels used by the tests of all trees (bit c: channel c)
+	unsigned int channels;
+	unsigned int reserved;
+	// checksum of header (without checksum) and index
+	unsigned long long checksum;
+};
+
+// Position of a binary tree in the bundle
+struct BundleEntry {
+	long long offset;
+	long long size;
+};
+
+static const char bundleMagic[8] = {'C','R','F','O','R','E','S','T'};
+static const unsigned int bundleOrder = 0x01020304;
+
+// Header of a shared forest, followed by the bundle at sharedOffset
+// Identifies the forest such that a detector does not use a segment of another forest or version
+struct SharedHeader {
+	char magic[8];
+	unsigned int order;
+	// CRBUNDLE_VERSION and CRTREE_VERSION of the publishing process
+	unsigned int bundle_version;
+	unsigned int tree_version;
+	unsigned int num_trees;
+	// checksum of the tree files the forest was loaded from (see CRForest::sourceChecksum)
+	unsigned long long source;
+};
+
+static const char sharedMagic[8] = {'C','R','S','H','A','R','E','D'};
+static const size_t sharedOffset = ((sizeof(SharedHeader) + 63)/64)*64;
+
+// Checksum of header and index
+static unsigned long long bundleChecksum(const BundleHeader& header, const BundleEntry* index) {
+	BundleHeader tmp = header;
+	tmp.checksum = 0;
+	unsigned long long hash = CRTree::checksum(&tmp, sizeof(tmp));
+	return hash ^ CRTree::checksum(index, header.num_trees*sizeof(BundleEntry));
+}
+
+// Checksum of the training data as hex number
+bool CRForest::checkData(const char* filename, unsigned long long data) {
+	ifstream in(filename);
+	unsigned long long val;
+	in >> hex >> val;
+	return in && val==data;
+}
+
+bool CRForest::saveData(const char* filename, unsigned long long data) {
+	ofstream out(filename);
+	out << hex << data << endl;
+	return out.good();
+}
+
+// Bundle in memory
+void CRForest::bundleData(vector<char>& vBundle, int encoding) const {
+	BundleHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, bundleMagic, sizeof(bundleMagic));
+	header.order = bundleOrder;
+	header.version = CRBUNDLE_VERSION;
+	header.num_trees = vTrees.size();
+	header.width = patch_width;
+	header.height = patch_height;
+	header.num_cp = vTrees.size()==0 ? 0 : (encoding==1 ? 1 : GetNumCenter());
+	for(unsigned int i=0; i<vTrees.size(); ++i)
+		header.channels |= vTrees[i]->usedChannels();
+
+	// binary trees aligned to 64 bytes
+	vector<vector<char> > vData(vTrees.size());
+	vector<BundleEntry> vIndex(vTrees.size());
+	long long offset = ((sizeof(header) + vIndex.size()*sizeof(BundleEntry) + 63)/64)*64;
+	for(unsigned int i=0; i<vTrees.size(); ++i) {
+		vTrees[i]->binaryTree(vData[i], encoding);
+		vIndex[i].offset = offset;
+		vIndex[i].size = vData[i].size();
+		offset = ((offset + vIndex[i].size + 63)/64)*64;
+	}
+	header.checksum = bundleChecksum(header, vIndex.empty() ? 0 : &vIndex[0]);
+
+	vBundle.assign(vTrees.size()>0 ? vIndex.back().offset + vIndex.back().size : sizeof(header), 0);
+	memcpy(&vBundle[0], &header, sizeof(header));
+	if(!vIndex.empty())
+		memcpy(&vBundle[sizeof(header)], &vIndex[0], vIndex.size()*sizeof(BundleEntry));
+	for(unsigned int i=0; i<vTrees.size(); ++i)
+		memcpy(&vBundle[vIndex[i].offset], &vData[i][0], vData[i].size());
+}
+
+bool CRForest::saveBundle(const char* filename) const {
+	cout << "Save Forest " << filename << endl;
+
+	vector<char> vBundle;
+	bundleData(vBundle, leaf_encoding);
+
+	string tmpfile = CRFileUtil::tempFile(filename);
+
+	ofstream out(tmpfile.c_str(), ios::binary);
+	if(!out.is_open()) {
+		cerr << "Could not write forest: " << tmpfile << endl;
+		return false;
+	}
+	out.write(&vBundle[0], vBundle.size());
+	bool done = CRFileUtil::replaceFile(out, tmpfile, filename);
+	if(!done)
+		cerr << "Could not write forest: " << filename << endl;
+
+	return done;
+}
+
+bool CRForest::loadBundle(const char* filename) {
+	cout << "Load Forest " << filename << endl;
+
+	int fd = open(filename, O_RDONLY);
+	if(fd<0)
+		return false;
+
+	struct stat st;
+	if(fstat(fd, &st)!=0) {
+		close(fd);
+		return false;
+	}
+
+	void* addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr==MAP_FAILED)
+		return false;
+
+	return setBundle(addr, st.st_size);
+}
+
+// Checksum of the tree files loaded by loadForest(filename, type): name, size, and modification time
+unsigned long long CRForest::sourceChecksum(const char* filename, int type, unsigned int num_trees) {
+	vector<string> vFiles;
+	char buffer[20];
+	if(type==2)
+		vFiles.push_back(string(filename) + ".forest");
+	for(unsigned int i=0; type!=2 && i<num_trees; ++i) {
+		sprintf(buffer, "%03d.%s", i, type==1 ? "bin" : "txt");
+		vFiles.push_back(string(filename) + buffer);
+	}
+
+	unsigned long long hash = 14695981039346656037ULL;
+	for(unsigned int i=0; i<vFiles.size(); ++i) {
+		struct stat st;
+		long long val[2] = {-1, -1};
+		if(stat(vFiles[i].c_str(), &st)==0) {
+			val[0] = (long long)st.st_size;
+			val[1] = (long long)st.st_mtime;
+		}
+		hash ^= CRTree::checksum(vFiles[i].c_str(), vFiles[i].size());
+		hash *= 1099511628211ULL;
+		hash ^= CRTree::checksum(val, sizeof(val));
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Published forest: shared header and bundle with flat trees in a POSIX shared memory segment
+// The header is written last, i.e., a segment without magic is still being written
+bool CRForest::publishShared(const char* name, const char* filename, int type) const {
+	vector<char> vBundle;
+	bundleData(vBundle, 0);
+
+	SharedHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, sharedMagic, sizeof(sharedMagic));
+	header.order = bundleOrder;
+	header.bundle_version = CRBUNDLE_VERSION;
+	header.tree_version = CRTREE_VERSION;
+	header.num_trees = vTrees.size();
+	header.source = sourceChecksum(filename, type, vTrees.size());
+	size_t length = sharedOffset + vBundle.size();
+
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if(fd<0)
+		return false;
+	void* addr = MAP_FAILED;
+	if(ftruncate(fd, length)==0)
+		addr = mmap(0, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(addr==MAP_FAILED) {
+		shm_unlink(name);
+		return false;
+	}
+
+	memcpy((char*)addr + sharedOffset, &vBundle[0], vBundle.size());
+	__sync_synchronize();
+	memcpy(addr, &header, sizeof(header));
+	munmap(addr, length);
+
+	cout << "Published forest " << name << " (" << length << " bytes)" << endl;
+	return true;
+}
+
+// Remove segment name if it is still the segment with status st (and not already republished)
+static void unlinkStale(const char* name, const struct stat& st) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd<0)
+		return;
+	struct stat cur;
+	bool same = fstat(fd, &cur)==0 && cur.st_dev==st.st_dev && cur.st_ino==st.st_ino;
+	close(fd);
+	if(same)
+		shm_unlink(name);
+}
+
+bool CRForest::attachShared(const char* name, const char* filename, int type) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if(fd<0)
+		return false;
+
+	// wait until the publishing process has written the header
+	struct stat st;
+	memset(&st, 0, sizeof(st));
+	void* addr = MAP_FAILED;
+	for(int i=0; i<100; ++i) {
+		if(fstat(fd, &st)==0 && st.st_size>=(off_t)sharedOffset) {
+			addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+			if(addr!=MAP_FAILED && memcmp(addr, sharedMagic, sizeof(sharedMagic))==0)
+				break;
+			if(addr!=MAP_FAILED)
+				munmap(addr, st.st_size);
+			addr = MAP_FAILED;
+		}
+		usleep(50000);
+	}
+	close(fd);
+	// the publishing process has died before it wrote the header
+	if(addr==MAP_FAILED) {
+		cerr << "Shared forest " << name << " is incomplete and removed" << endl;
+		unlinkStale(name, st);
+		return false;
+	}
+
+	// segment of other tree files, versions, or with fewer trees
+	const SharedHeader* header = (const SharedHeader*)addr;
+	if(header->order!=bundleOrder || header->bundle_version!=CRBUNDLE_VERSION || header->tree_version!=CRTREE_VERSION || 
+		header->num_trees<vTrees.size() || header->source!=sourceChecksum(filename, type, header->num_trees)) {
+		cerr << "Shared forest " << name << " is outdated and removed" << endl;
+		munmap(addr, st.st_size);
+		unlinkStale(name, st);
+		return false;
+	}
+
+	cout << "Attach Forest " << name << endl;
+	if(!setBundle(addr, st.st_size, sharedOffset)) {
+		unlinkStale(name, st);
+		return false;
+	}
+	return true;
+}
+
+bool CRForest::removeShared(const char* name) {
+	return shm_unlink(name)==0;
+}
+
+// Check mapped bundle and load trees from it; the bundle starts at offset of the mapping 
+// and is unmapped with the forest (or immediately if it is not valid)
+bool CRForest::setBundle(void* addr, size_t length, size_t offset) {
+	// check header and index; the trees check themselves when they are loaded
+	const char* base = (const char*)addr + offset;
+	const BundleHeader* header = (const BundleHeader*)base;
+	const BundleEntry* index = (const BundleEntry*)(base + sizeof(BundleHeader));
+	size_t size = length - offset;
+	bool valid = size>=sizeof(BundleHeader) && memcmp(header->magic, bundleMagic, sizeof(bundleMagic))==0 && header->order==bundleOrder && 
+		header->version==CRBUNDLE_VERSION && (long long)sizeof(BundleHeader) + header->num_trees*(long long)sizeof(BundleEntry) <= (long long)size &&
+		bundleChecksum(*header, index)==header->checksum;
+	for(unsigned int i=0; valid && i<header->num_trees; ++i)
+		valid = index[i].offset>=0 && index[i].size>=0 && index[i].offset + index[i].size <= (long long)size;
+	if(!valid)
+		cerr << "Forest bundle is corrupt or has another version or byte order" << endl;
+
+	if(valid && ((patch_width>0 && header->width!=patch_width) || (patch_height>0 && header->height!=patch_height))) {
+		cerr << "Forest bundle was trained for patch size " << header->width << " " << header->height << endl;
+		valid = false;
+	}
+	if(!valid) {
+		munmap(addr, length);
+		return false;
+	}
+
+	// trees of an earlier load
+	for(unsigned int i=0; i<vTrees.size(); ++i) {
+		delete vTrees[i];
+		vTrees[i] = 0;
+	}
+	releaseBundle();
+	bundle_addr = addr;
+	bundle_length = length;
+
+	patch_width = header->width;
+	patch_height = header->height;
+
+	int num_trees = vTrees.size();
+	if(num_trees==0 || num_trees>(int)header->num_trees)
+		num_trees = header->num_trees;
+	vTrees.resize(num_trees);
+	cout << "Trees " << num_trees << " of " << header->num_trees << ", center points " << header->num_cp;
+	cout << ", channels " << hex << header->channels << dec << endl;
+
+	// only the selected trees are touched
+#pragma omp parallel for schedule(dynamic)
+	for(int i=0; i<num_trees; ++i)
+		vTrees[i] = new CRTree(base + index[i].offset, index[i].size);
+
+	return true;
+}
+
+void CRForest::releaseBundle() {
+	if(bundle_addr!=0)
+		munmap(bundle_addr, bundle_length);
+	bundle_addr = 0;
+	bundle_length = 0;
+}
@@ -1,74 +1,272 @@
-/* 
-// Author: Juergen Gall, BIWI, ETH Zurich
-// Email: gall@vision.ee.ethz.ch
-*/
-
-#pragma once
-
-#include "CRTree.h"
-
-#include <vector>
-
-class CRForest {
-public:
-	// Constructors
-	CRForest(int trees = 0) {
-		vTrees.resize(trees);
-	}
-	~CRForest() {
-		for(std::vector<CRTree*>::iterator it = vTrees.begin(); it != vTrees.end(); ++it) delete *it;
-		vTrees.clear();
-	}
-
-	// Set/Get functions
-	void SetTrees(int n) {vTrees.resize(n);}
-	int GetSize() const {return vTrees.size();}
-	unsigned int GetDepth() const {return vTrees[0]->GetDepth();}
-	unsigned int GetNumCenter() const {return vTrees[0]->GetNumCenter();}
-	
-	// Regression 
-	void regression(std::vector<const LeafNode*>& result, uchar** ptFCh, int stepImg) const;
-
-	// Training
-	void trainForest(int min_s, int max_d, CvRNG* pRNG, const CRPatch& TrData, int samples);
-
-	// IO functions
-	void saveForest(const char* filename, unsigned int offset = 0);
-	void loadForest(const char* filename, int type = 0);
-	void show(int w, int h) const {vTrees[0]->showLeaves(w,h);}
-
-	// Trees
-	std::vector<CRTree*> vTrees;
-};
-
-inline void CRForest::regression(std::vector<const LeafNode*>& result, uchar** ptFCh, int stepImg) const {
-	result.resize( vTrees.size() );
-	for(int i=0; i<(int)vTrees.size(); ++i) {
-		result[i] = vTrees[i]->regression(ptFCh, stepImg);
-	}
-}
-
-//Training
-inline void CRForest::trainForest(int min_s, int max_d, CvRNG* pRNG, const CRPatch& TrData, int samples) {
-	for(int i=0; i < (int)vTrees.size(); ++i) {
-		vTrees[i] = new CRTree(min_s, max_d, TrData.vLPatches[1][0].center.size(), pRNG);
-		vTrees[i]->growTree(TrData, samples);
-	}
-}
-
-// IO Functions
-inline void CRForest::saveForest(const char* filename, unsigned int offset) {
-	char buffer[200];
-	for(unsigned int i=0; i<vTrees.size(); ++i) {
-		sprintf_s(buffer,"%s%03d.txt",filename,i+offset);
-		vTrees[i]->saveTree(buffer);
-	}
-}
-
-inline void CRForest::loadForest(const char* filename, int type) {
-	char buffer[200];
-	for(unsigned int i=0; i<vTrees.size(); ++i) {
-		sprintf_s(buffer,"%s%03d.txt",filename,i);
-		vTrees[i] = new CRTree(buffer);
-	}
-}
+/* 
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#include "CRTree.h"
+
+// Version of the forest bundle; increase whenever the layout changes
+#define CRBUNDLE_VERSION 1
+
+#include <vector>
+#include <sstream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+class CRForest {
+public:
+	// Constructors
+	CRForest(int trees = 0) : split_mode(0), grow_mode(0), node_samples(0), node_balance(false), ckpt_interval(0), patch_width(0), patch_height(0), leaf_encoding(0), bundle_addr(0), bundle_length(0) {
+		vTrees.resize(trees);
+	}
+	~CRForest() {
+		for(std::vector<CRTree*>::iterator it = vTrees.begin(); it != vTrees.end(); ++it) delete *it;
+		vTrees.clear();
+		releaseBundle();
+	}
+
+	// Set/Get functions
+	void SetTrees(int n) {vTrees.resize(n);}
+	// Threshold search for training (see CRTree::SetSplitMode)
+	void SetSplitMode(int mode) {split_mode = mode;}
+	// Tree growing for training (see CRTree::SetGrowMode)
+	void SetGrowMode(int mode) {grow_mode = mode;}
+	// Subsampling of nodes for training (see CRTree::SetNodeSamples)
+	void SetNodeSamples(unsigned int n, bool balance) {node_samples = n; node_balance = balance;}
+	// Checkpoints every interval seconds for training (default 0: none)
+	// Trees are saved to filename as soon as they are completed; completed trees of an earlier run 
+	// are loaded and growing trees continue from filename%03d.ckpt
+	// Both require the same training data (see CRPatch::checksum), stored in filename%03d.data for completed trees
+	void SetCheckpoint(const char* filename, int interval) {ckpt_path = filename; ckpt_interval = interval;}
+	// Patch size stored in a bundle; checked when a bundle is loaded (0: no check)
+	void SetPatchSize(int w, int h) {patch_width = w; patch_height = h;}
+	// Leaf encoding of binary trees and bundles (see CRTree::saveBinary)
+	void SetLeafEncoding(int encoding) {leaf_encoding = encoding;}
+	int GetSize() const {return vTrees.size();}
+	unsigned int GetDepth() const {return vTrees[0]->GetDepth();}
+	unsigned int GetNumCenter() const {return vTrees[0]->GetNumCenter();}
+	// Number of object classes (labels 1..GetNumClasses() of the training data)
+	unsigned int GetNumClasses() const {return vTrees[0]->GetNumClasses();}
+	// Checksum of the tree tables of all trees (see CRTree::testChecksum)
+	unsigned long long testChecksum() const {
+		unsigned long long hash = 14695981039346656037ULL;
+		for(unsigned int i=0; i<vTrees.size(); ++i) {
+			hash ^= vTrees[i]->testChecksum();
+			hash *= 1099511628211ULL;
+		}
+		return hash;
+	}
+	
+	// Regression 
+	void regression(std::vector<const FlatLeaf*>& result, uchar** ptFCh, int stepImg) const;
+
+	// Training
+	// Trees are grown in parallel by up to threads threads (0: all cores)
+	// Tree i is seeded from the state of pRNG and its number i+offset (see treeSeed)
+	void trainForest(int min_s, int max_d, CvRNG* pRNG, const CRPatch& TrData, int samples, unsigned int offset = 0, int threads = 0);
+	static CvRNG treeSeed(CvRNG master, unsigned int index);
+	// Recompute the leafs of all trees from training patches (see CRTree::refillLeaves)
+	void refillForest(const CRPatch& TrData, bool append, int threads = 0);
+
+	// IO functions
+	// type: 0 - text files filename%03d.txt, 1 - binary files filename%03d.bin (see CRTree::saveBinary), 
+	// 2 - bundle filename.forest with all trees (offset must be 0)
+	// Only the first GetSize() trees are loaded, in parallel
+	void saveForest(const char* filename, unsigned int offset = 0, int type = 0);
+	void loadForest(const char* filename, int type = 0);
+	// Single file: header with patch size, number of center points, and used channels | index | binary trees
+	// The bundle is mapped and only the trees that are loaded are read
+	bool saveBundle(const char* filename) const;
+	bool loadBundle(const char* filename);
+	// Forest shared by processes: the forest is published as bundle with flat trees in the POSIX shared 
+	// memory segment name (fails if it exists); attach replaces the trees by the trees of the segment (read only)
+	// The segment is tagged with the tree files loaded by loadForest(filename, type) (see sourceChecksum), 
+	// the versions, and the number of trees; attach removes a segment of other tree files or versions, 
+	// with fewer trees, or left incomplete by a failed publish
+	bool publishShared(const char* name, const char* filename, int type = 0) const;
+	bool attachShared(const char* name, const char* filename, int type = 0);
+	static bool removeShared(const char* name);
+	// Checksum of names, sizes, and modification times of the first num_trees tree files
+	static unsigned long long sourceChecksum(const char* filename, int type, unsigned int num_trees);
+	void show(int w, int h) const {vTrees[0]->showLeaves(w,h);}
+
+	// Trees
+	std::vector<CRTree*> vTrees;
+
+private:
+	// Threshold search for training
+	int split_mode;
+	// Tree growing for training
+	int grow_mode;
+	// Subsampling of nodes for training
+	unsigned int node_samples;
+	bool node_balance;
+	// Tree path and interval for checkpoints
+	std::string ckpt_path;
+	int ckpt_interval;
+	// Patch size for bundle
+	int patch_width;
+	int patch_height;
+	// Leaf encoding for saving
+	int leaf_encoding;
+	// Mapped bundle
+	void* bundle_addr;
+	size_t bundle_length;
+	void bundleData(std::vector<char>& vBundle, int encoding) const;
+	bool setBundle(void* addr, size_t length, size_t offset = 0);
+	void releaseBundle();
+	// Checksum of the training data of a completed tree
+	static bool checkData(const char* filename, unsigned long long data);
+	static bool saveData(const char* filename, unsigned long long data);
+};
+
+inline void CRForest::regression(std::vector<const FlatLeaf*>& result, uchar** ptFCh, int stepImg) const {
+	result.resize( vTrees.size() );
+	for(int i=0; i<(int)vTrees.size(); ++i) {
+		result[i] = vTrees[i]->regression(ptFCh, stepImg);
+	}
+}
+
+//Training
+inline void CRForest::trainForest(int min_s, int max_d, CvRNG* pRNG, const CRPatch& TrData, int samples, unsigned int offset, int threads) {
+	int num_trees = vTrees.size();
+
+#ifdef _OPENMP
+	if(threads<=0) threads = omp_get_max_threads();
+#else
+	threads = 1;
+#endif
+	// Threads that are not needed for growing trees concurrently evaluate the tests within the nodes
+	int tree_threads = 1;
+	if(threads>num_trees) {
+		tree_threads = threads / num_trees;
+		threads = num_trees;
+	}
+#ifdef _OPENMP
+	if(tree_threads>1) omp_set_max_active_levels(2);
+#endif
+
+	// Completed trees and checkpoints are only used for the same training data
+	unsigned long long data = ckpt_interval>0 ? TrData.checksum() : 0;
+
+	// Training data is shared (read only), each tree has its own random generator and log
+#pragma omp parallel for schedule(dynamic) num_threads(threads) if(threads>1)
+	for(int i=0; i < num_trees; ++i) {
+		char buffer[400];
+		sprintf_s(buffer,"%s%03d.txt",ckpt_path.c_str(),i+offset);
+		std::string filename(buffer);
+		sprintf_s(buffer,"%s%03d.data",ckpt_path.c_str(),i+offset);
+		std::string datafile(buffer);
+
+		// Tree has been completed by an earlier run with the same training data
+		if(ckpt_interval>0 && checkData(datafile.c_str(), data) && CRTree::checkTree(filename.c_str())) {
+			vTrees[i] = new CRTree(filename.c_str());
+			continue;
+		}
+
+		vTrees[i] = new CRTree(min_s, max_d, TrData.vLPatches[1].GetNumCenter(), treeSeed(*pRNG, i+offset), TrData.vLPatches.size()-1);
+		vTrees[i]->SetThreads(tree_threads);
+		vTrees[i]->SetSplitMode(split_mode);
+		vTrees[i]->SetGrowMode(grow_mode);
+		vTrees[i]->SetNodeSamples(node_samples, node_balance);
+		sprintf_s(buffer,"%s%03d.ckpt",ckpt_path.c_str(),i+offset);
+		vTrees[i]->SetCheckpoint(buffer, ckpt_interval);
+
+		if(threads>1) {
+			std::ostringstream log;
+			vTrees[i]->SetLog(&log);
+			vTrees[i]->growTree(TrData, samples);
+			vTrees[i]->SetLog(&std::cout);
+
+#pragma omp critical
+			std::cout << log.str() << "Tree " << i+offset << " done" << std::endl;
+
+		} else {
+			vTrees[i]->growTree(TrData, samples);
+		}
+
+		// Save completed tree and remove its checkpoint
+		if(ckpt_interval>0) {
+			vTrees[i]->saveTree(filename.c_str());
+			if(!saveData(datafile.c_str(), data))
+				std::cerr << "Could not write " << datafile << std::endl;
+			remove(buffer);
+		}
+	}
+}
+
+inline void CRForest::refillForest(const CRPatch& TrData, bool append, int threads) {
+	if(TrData.vLPatches[1].GetNumCenter()!=GetNumCenter()) {
+		std::cerr << "Number of center points of patches and trees differ";
+		if(GetNumCenter()==1)
+			std::cerr << " (trees saved with leaf encoding 1 keep only the first center point, refill them from text trees)";
+		std::cerr << std::endl;
+		exit(-1);
+	}
+	if(TrData.vLPatches.size()-1!=GetNumClasses()) {
+		std::cerr << "Number of classes of patches and trees differ" << std::endl;
+		exit(-1);
+	}
+
+#ifdef _OPENMP
+	if(threads<=0) threads = omp_get_max_threads();
+#else
+	threads = 1;
+#endif
+
+#pragma omp parallel for schedule(dynamic) num_threads(threads) if(threads>1)
+	for(int i=0; i < (int)vTrees.size(); ++i) {
+		std::ostringstream log;
+		vTrees[i]->SetLog(&log);
+		vTrees[i]->refillLeaves(TrData, append);
+		vTrees[i]->SetLog(&std::cout);
+
+#pragma omp critical
+		std::cout << "Tree " << i << " " << log.str();
+	}
+}
+
+// Seed for tree number index
+inline CvRNG CRForest::treeSeed(CvRNG master, unsigned int index) {
+	return CRPatch::streamSeed(master, index);
+}
+
+// IO Functions
+inline void CRForest::saveForest(const char* filename, unsigned int offset, int type) {
+	char buffer[200];
+	if(type==2) {
+		sprintf_s(buffer,"%s.forest",filename);
+		saveBundle(buffer);
+		return;
+	}
+	for(unsigned int i=0; i<vTrees.size(); ++i) {
+		if(type==1) {
+			sprintf_s(buffer,"%s%03d.bin",filename,i+offset);
+			vTrees[i]->saveBinary(buffer, leaf_encoding);
+		} else {
+			sprintf_s(buffer,"%s%03d.txt",filename,i+offset);
+			vTrees[i]->saveTree(buffer);
+		}
+	}
+}
+
+inline void CRForest::loadForest(const char* filename, int type) {
+	char buffer[200];
+	if(type==2) {
+		sprintf_s(buffer,"%s.forest",filename);
+		if(!loadBundle(buffer)) {
+			std::cerr << "Could not load forest bundle " << buffer << std::endl;
+			exit(-1);
+		}
+		return;
+	}
+#pragma omp parallel for schedule(dynamic) private(buffer)
+	for(int i=0; i<(int)vTrees.size(); ++i) {
+		sprintf_s(buffer,"%s%03d.%s",filename,i,type==1 ? "bin" : "txt");
+		vTrees[i] = new CRTree(buffer);
+	}
+}
@@ -1,143 +1,469 @@
-/* 
-// Author: Juergen Gall, BIWI, ETH Zurich
-// Email: gall@vision.ee.ethz.ch
-*/
-
-#include "CRForestDetector.h"
-#include <vector>
-
-
-using namespace std;
-
-
-void CRForestDetector::detectColor(IplImage *img, vector<IplImage* >& imgDetect, std::vector<float>& ratios) {
-
-	// extract features
-	vector<IplImage*> vImg;
-	CRPatch::extractFeatureChannels(img, vImg);
-
-	// reset output image
-	for(int c=0; c<(int)imgDetect.size(); ++c)
-		cvSetZero( imgDetect[c] );
-
-	// get pointers to feature channels
-	int stepImg;
-	uchar** ptFCh     = new uchar*[vImg.size()];
-	uchar** ptFCh_row = new uchar*[vImg.size()];
-	for(unsigned int c=0; c<vImg.size(); ++c) {
-		cvGetRawData( vImg[c], (uchar**)&(ptFCh[c]), &stepImg);
-	}
-	stepImg /= sizeof(ptFCh[0][0]);
-
-	// get pointer to output image
-	int stepDet;
-	float** ptDet = new float*[imgDetect.size()];
-	for(unsigned int c=0; c<imgDetect.size(); ++c)
-		cvGetRawData( imgDetect[c], (uchar**)&(ptDet[c]), &stepDet);
-	stepDet /= sizeof(ptDet[0][0]);
-
-	int xoffset = width/2;
-	int yoffset = height/2;
-	
-	int x, y, cx, cy; // x,y top left; cx,cy center of patch
-	cy = yoffset; 
-
-	for(y=0; y<img->height-height; ++y, ++cy) {
-		// Get start of row
-		for(unsigned int c=0; c<vImg.size(); ++c)
-			ptFCh_row[c] = &ptFCh[c][0];
-		cx = xoffset; 
-		
-		for(x=0; x<img->width-width; ++x, ++cx) {					
-
-			// regression for a single patch
-			vector<const LeafNode*> result;
-			crForest->regression(result, ptFCh_row, stepImg);
-			
-			// vote for all trees (leafs) 
-			for(vector<const LeafNode*>::const_iterator itL = result.begin(); itL!=result.end(); ++itL) {
-
-				// To speed up the voting, one can vote only for patches 
-			        // with a probability for foreground > 0.5
-			        // 
-				// if((*itL)->pfg>0.5) {
-
-					// voting weight for leaf 
-					float w = (*itL)->pfg / float( (*itL)->vCenter.size() * result.size() );
-
-					// vote for all points stored in the leaf
-					for(vector<vector<CvPoint> >::const_iterator it = (*itL)->vCenter.begin(); it!=(*itL)->vCenter.end(); ++it) {
-
-						for(int c=0; c<(int)imgDetect.size(); ++c) {
-						  int x = int(cx - (*it)[0].x * ratios[c] + 0.5);
-						  int y = cy-(*it)[0].y;
-						  if(y>=0 && y<imgDetect[c]->height && x>=0 && x<imgDetect[c]->width) {
-						    *(ptDet[c]+x+y*stepDet) += w;
-						  }
-						}
-					}
-
-				 // } // end if
-
-			}
-
-			// increase pointer - x
-			for(unsigned int c=0; c<vImg.size(); ++c)
-				++ptFCh_row[c];
-
-		} // end for x
-
-		// increase pointer - y
-		for(unsigned int c=0; c<vImg.size(); ++c)
-			ptFCh[c] += stepImg;
-
-	} // end for y 	
-
-	// smooth result image
-	for(int c=0; c<(int)imgDetect.size(); ++c)
-		cvSmooth( imgDetect[c], imgDetect[c], CV_GAUSSIAN, 3);
-
-	// release feature channels
-	for(unsigned int c=0; c<vImg.size(); ++c)
-		cvReleaseImage(&vImg[c]);
-	
-	delete[] ptFCh;
-	delete[] ptFCh_row;
-	delete[] ptDet;
-
-}
-
-void CRForestDetector::detectPyramid(IplImage *img, vector<vector<IplImage*> >& vImgDetect, std::vector<float>& ratios) {	
-
-	if(img->nChannels==1) {
-
-		std::cerr << "Gray color images are not supported." << std::endl;
-
-	} else { // color
-
-		cout << "Timer" << endl;
-		int tstart = clock();
-
-		for(int i=0; i<int(vImgDetect.size()); ++i) {
-			IplImage* cLevel = cvCreateImage( cvSize(vImgDetect[i][0]->width,vImgDetect[i][0]->height) , IPL_DEPTH_8U , 3);				
-			cvResize( img, cLevel, CV_INTER_LINEAR );	
-
-			// detection
-			detectColor(cLevel,vImgDetect[i],ratios);
-
-			cvReleaseImage(&cLevel);
-		}
-
-		cout << "Time " << (double)(clock() - tstart)/CLOCKS_PER_SEC << " sec" << endl;
-
-	}
-
-}
-
-
-
-
-
-
-
-
+/* 
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRForestDetector.h"
+#include "CRProfile.h"
+#include <vector>
+#include <cmath>
+
+
+using namespace std;
+
+
+void CRForestDetector::detectColor(const vector<IplImage*>& vImg, vector<IplImage* >& imgDetect, std::vector<float>& ratios) {
+
+	// reset output image
+	for(int c=0; c<(int)imgDetect.size(); ++c)
+		cvSetZero( imgDetect[c] );
+
+	// votes at the scale of the feature channels
+	vector<VoteTarget> vTarget(1);
+	vTarget[0].imgDetect = &imgDetect;
+	vTarget[0].factor = 1;
+	vTarget[0].weight = 1;
+	voteColor(vImg, vTarget, ratios);
+
+	// smooth result image
+	CR_PROFILE_START(t_smoothing);
+	for(int c=0; c<(int)imgDetect.size(); ++c)
+		cvSmooth( imgDetect[c], imgDetect[c], CV_GAUSSIAN, 3);
+	CR_PROFILE_STOP(STAGE_SMOOTHING, t_smoothing);
+
+}
+
+// Maximal number of leafs recorded for grouped voting, i.e., size of a band of rows
+static const int max_records = 1<<20;
+
+// Output images of the targets of voteColor
+struct VoteImages {
+	std::vector<VoteTarget>* vTarget;
+	std::vector<std::vector<float*> > vPtDet;
+	std::vector<int> vStepDet;
+	int num_ratios;
+	const std::vector<float>* ratios;
+};
+
+// Votes of a leaf entry of class k (count votes, num_cp offsets per vote) with weight w for the patch center (cx, cy)
+static inline void votePatch(const VoteImages& out, const CvPoint* it, unsigned int count, unsigned int num_cp, float w, unsigned int k, int cx, int cy) {
+	const vector<VoteTarget>& vTarget = *out.vTarget;
+	const vector<float>& ratios = *out.ratios;
+	int num_ratios = out.num_ratios;
+
+	for(unsigned int i=0; i<count; ++i, it += num_cp) {
+
+		for(unsigned int j=0; j<vTarget.size(); ++j) {
+			const vector<IplImage*>& imgDetect = *vTarget[j].imgDetect;
+			float* const* ptDetK = &out.vPtDet[j][k*num_ratios];
+			int stepDet = out.vStepDet[j];
+			float f = vTarget[j].factor;
+			float wj = w * vTarget[j].weight;
+
+			if(f==1) {
+				// same scale
+				for(int c=0; c<num_ratios; ++c) {
+				  int x = int(cx - it[0].x * ratios[c] + 0.5);
+				  int y = cy-it[0].y;
+				  if(y>=0 && y<imgDetect[c]->height && x>=0 && x<imgDetect[c]->width) {
+				    *(ptDetK[c]+x+y*stepDet) += wj;
+				    CR_PROFILE_COUNT(COUNT_VOTES, 1);
+				  } else {
+				    CR_PROFILE_COUNT(COUNT_VOTES_OUT, 1);
+				  }
+				}
+			} else {
+				// center mapped to the scale of the target
+				for(int c=0; c<num_ratios; ++c) {
+				  int x = int(floor((cx - it[0].x * ratios[c]) * f + 0.5f));
+				  int y = int(floor((cy - it[0].y) * f + 0.5f));
+				  if(y>=0 && y<imgDetect[c]->height && x>=0 && x<imgDetect[c]->width) {
+				    *(ptDetK[c]+x+y*stepDet) += wj;
+				    CR_PROFILE_COUNT(COUNT_VOTES, 1);
+				  } else {
+				    CR_PROFILE_COUNT(COUNT_VOTES_OUT, 1);
+				  }
+				}
+			}
+		}
+	}
+}
+
+bool CRForestDetector::SetLeafMaps(const CRLeafMaps* maps, int mode) {
+	vNumLeafs.resize(crForest->vTrees.size());
+	for(unsigned int t=0; t<crForest->vTrees.size(); ++t) {
+		vNumLeafs[t] = crForest->vTrees[t]->GetNumLeafs();
+		if(vNumLeafs[t]>65536)
+			return false;
+	}
+
+	leafMaps = maps;
+	leaf_mode = mode;
+	forest_id = crForest->testChecksum();
+	return true;
+}
+
+void CRForestDetector::voteColor(const vector<IplImage*>& vImg, vector<VoteTarget>& vTarget, std::vector<float>& ratios, 
+								const LeafMap* leafsIn, LeafMap* leafsOut) {
+
+	// get pointers to feature channels (none for leafs from map)
+	int stepImg = 0;
+	uchar** ptFCh     = new uchar*[vImg.size()];
+	uchar** ptFCh_row = new uchar*[vImg.size()];
+	for(unsigned int c=0; c<vImg.size(); ++c) {
+		cvGetRawData( vImg[c], (uchar**)&(ptFCh[c]), &stepImg);
+	}
+	stepImg /= sizeof(ptFCh[0][0]);
+
+	// Hough images of the classes: ratios of class 1, ratios of class 2, ...
+	unsigned int num_class = crForest->GetNumClasses();
+
+	// get pointers to output images of all targets
+	VoteImages out;
+	out.vTarget = &vTarget;
+	out.vPtDet.resize(vTarget.size());
+	out.vStepDet.resize(vTarget.size());
+	for(unsigned int j=0; j<vTarget.size(); ++j) {
+		vector<IplImage*>& imgDetect = *vTarget[j].imgDetect;
+		out.vPtDet[j].resize(imgDetect.size());
+		for(unsigned int c=0; c<imgDetect.size(); ++c)
+			cvGetRawData( imgDetect[c], (uchar**)&(out.vPtDet[j][c]), &out.vStepDet[j]);
+		out.vStepDet[j] /= sizeof(float);
+	}
+	out.num_ratios = vTarget[0].imgDetect->size()/num_class;
+	out.ratios = &ratios;
+
+	int xoffset = width/2;
+	int yoffset = height/2;
+	
+	int x, y, cx, cy; // x,y top left; cx,cy center of patch
+	cy = yoffset; 
+
+	// leafs of all patches of a row (the row is traversed before voting)
+	unsigned int num_trees = crForest->vTrees.size();
+	unsigned int num_cp = crForest->GetNumCenter();
+	int num_x = leafsIn!=0 ? leafsIn->width : max(vImg[0]->width-width, 0);
+	int num_y = leafsIn!=0 ? leafsIn->height : max(vImg[0]->height-height, 0);
+	if(leafsOut!=0) {
+		leafsOut->width = num_x;
+		leafsOut->height = num_y;
+		leafsOut->vLeaf.assign(num_trees, vector<unsigned short>(num_x*num_y));
+	}
+	vector<const FlatLeaf*> vLeafs(num_x*num_trees);
+	vector<const FlatLeaf*> result;
+
+	// grouped voting: the leafs of a band of rows are bucketed by leaf (buckets of tree t start at vFirst[t]) 
+	// and voted leaf by leaf with the positions of the patches (x + row in band * num_x)
+	int band_rows = 0;
+	vector<unsigned int> vFirst, vBucket, vPos, vKey;
+	if(vote_mode==1 && num_x>0) {
+		band_rows = max(1, min(num_y, max_records / int(num_x*num_trees)));
+		vFirst.resize(num_trees+1, 0);
+		for(unsigned int t=0; t<num_trees; ++t)
+			vFirst[t+1] = vFirst[t] + crForest->vTrees[t]->GetNumLeafs();
+		vBucket.resize(vFirst[num_trees]+1);
+		vKey.resize(band_rows*num_x*num_trees);
+		vPos.resize(vKey.size());
+	}
+	int band_y = 0;
+
+	for(y=0; y<num_y; ++y, ++cy) {
+		// Get start of row
+		for(unsigned int c=0; c<vImg.size(); ++c)
+			ptFCh_row[c] = &ptFCh[c][0];
+
+		CR_PROFILE_START(t_traversal);
+		if(leafsIn!=0) {
+
+			// leafs from map
+			for(x=0; x<num_x; ++x)
+				for(unsigned int t=0; t<num_trees; ++t)
+					vLeafs[x*num_trees+t] = crForest->vTrees[t]->GetLeaf(leafsIn->vLeaf[t][x+y*num_x]);
+
+		} else {
+
+			for(x=0; x<num_x; ++x) {
+
+				// regression for a single patch
+				crForest->regression(result, ptFCh_row, stepImg);
+				for(unsigned int t=0; t<num_trees; ++t)
+					vLeafs[x*num_trees+t] = result[t];
+
+				// increase pointer - x
+				for(unsigned int c=0; c<vImg.size(); ++c)
+					++ptFCh_row[c];
+
+			} // end for x
+			CR_PROFILE_COUNT(COUNT_TRAVERSALS, num_x*num_trees);
+
+			if(leafsOut!=0)
+				for(x=0; x<num_x; ++x)
+					for(unsigned int t=0; t<num_trees; ++t)
+						leafsOut->vLeaf[t][x+y*num_x] = (unsigned short)crForest->vTrees[t]->leafId(vLeafs[x*num_trees+t]);
+
+		}
+		CR_PROFILE_STOP(STAGE_TRAVERSAL, t_traversal);
+		CR_PROFILE_COUNT(COUNT_PATCHES, num_x);
+
+		CR_PROFILE_START(t_voting);
+		if(band_rows>0) {
+
+			// record leafs of row
+			unsigned int* ptKey = &vKey[(y-band_y)*num_x*num_trees];
+			for(x=0; x<num_x; ++x)
+				for(unsigned int t=0; t<num_trees; ++t)
+					*ptKey++ = vFirst[t] + crForest->vTrees[t]->leafId(vLeafs[x*num_trees+t]);
+
+			// band complete: bucket patches by leaf (counting sort) and vote leaf by leaf
+			if(y+1-band_y==band_rows || y+1==num_y) {
+				unsigned int num_rec = (y+1-band_y)*num_x*num_trees;
+				fill(vBucket.begin(), vBucket.end(), 0);
+				for(unsigned int e=0; e<num_rec; ++e)
+					++vBucket[vKey[e]+1];
+				for(unsigned int b=1; b<vBucket.size(); ++b)
+					vBucket[b] += vBucket[b-1];
+				for(unsigned int e=0; e<num_rec; ++e)
+					vPos[vBucket[vKey[e]]++] = e / num_trees;
+				// vBucket[b] is now the end of bucket b
+
+				unsigned int begin = 0;
+				for(unsigned int t=0; t<num_trees; ++t) {
+					const CRTree* tree = crForest->vTrees[t];
+					for(unsigned int l=0; l<vFirst[t+1]-vFirst[t]; ++l) {
+						unsigned int end = vBucket[vFirst[t]+l];
+						if(end==begin)
+							continue;
+
+						// one leaf entry per class
+						const FlatLeaf* itL = tree->GetLeaf(l);
+						for(unsigned int k=0; k<num_class; ++k, ++itL) {
+							float w = itL->pfg / float( itL->count * num_trees );
+							if(itL->count==0 || w==0) {
+								CR_PROFILE_COUNT(COUNT_LEAFS_SKIPPED, end-begin);
+								continue;
+							}
+							const CvPoint* it = tree->GetVotes(itL);
+							for(unsigned int p=begin; p<end; ++p)
+								votePatch(out, it, itL->count, num_cp, w, k, xoffset + vPos[p]%num_x, yoffset + band_y + vPos[p]/num_x);
+						}
+						begin = end;
+					}
+				}
+				band_y = y+1;
+			}
+
+		} else {
+
+			cx = xoffset; 
+			for(x=0; x<num_x; ++x, ++cx) {					
+
+				// vote for all trees (leafs) 
+				for(unsigned int t=0; t<num_trees; ++t) {
+					const FlatLeaf* itL = vLeafs[x*num_trees+t];
+
+					// one leaf entry per class
+					for(unsigned int k=0; k<num_class; ++k, ++itL) {
+
+						// To speed up the voting, one can vote only for patches 
+					        // with a probability for foreground > 0.5
+					        // 
+						// if(itL->pfg>0.5) {
+
+							// voting weight for leaf 
+							float w = itL->pfg / float( itL->count * num_trees );
+							if(itL->count==0 || w==0) {
+								CR_PROFILE_COUNT(COUNT_LEAFS_SKIPPED, 1);
+								continue;
+							}
+
+							// vote for all points stored in the leaf (num_cp offsets per vote)
+							votePatch(out, crForest->vTrees[t]->GetVotes(itL), itL->count, num_cp, w, k, cx, cy);
+
+						 // } // end if
+
+					}
+
+				}
+
+			} // end for x
+
+		}
+		CR_PROFILE_STOP(STAGE_VOTING, t_voting);
+
+		// increase pointer - y
+		for(unsigned int c=0; c<vImg.size(); ++c)
+			ptFCh[c] += stepImg;
+
+	} // end for y 	
+
+	delete[] ptFCh;
+	delete[] ptFCh_row;
+
+}
+
+void CRForestDetector::getFeatures(IplImage *img, int w, int h, const char* filename, FeatureMap& fmap) const {
+
+	// map feature channels from cache if available
+	CR_PROFILE_START(t_features);
+	float scale = w / float(img->width);
+	if(featCache==0 || filename==0 || !featCache->load(filename, scale, w, h, fmap)) {
+
+		CR_PROFILE_START(t_resize);
+		IplImage* cLevel = cvCreateImage( cvSize(w,h) , IPL_DEPTH_8U , 3);				
+		cvResize( img, cLevel, CV_INTER_LINEAR );	
+		CR_PROFILE_STOP(STAGE_RESIZE, t_resize);
+
+		// extract features
+		CR_PROFILE_START(t_extract);
+		fmap.vImg.clear();
+		CRPatch::extractFeatureChannels(cLevel, fmap.vImg);
+		cvReleaseImage(&cLevel);
+
+		if(featCache!=0 && filename!=0)
+			featCache->save(filename, scale, fmap.vImg);
+		CR_PROFILE_STOP(STAGE_FEATURES, t_extract);
+
+	} else {
+		CR_PROFILE_STOP(STAGE_FEATURES, t_features);
+	}
+
+}
+
+void CRForestDetector::releaseFeatures(FeatureMap& fmap) {
+	if(fmap.addr!=0) {
+		CRFeatureCache::release(fmap);
+	} else {
+		for(unsigned int c=0; c<fmap.vImg.size(); ++c)
+			cvReleaseImage(&fmap.vImg[c]);
+		fmap.vImg.clear();
+	}
+}
+
+void CRForestDetector::voteLevel(IplImage *img, int w, int h, const char* filename, vector<VoteTarget>& vTarget, std::vector<float>& ratios) {
+	float scale = w / float(img->width);
+	bool maps = leafMaps!=0 && filename!=0;
+
+	// re-voting with the leafs of the map
+	if(maps && leaf_mode==2) {
+		LeafMap lmap;
+		if(leafMaps->load(filename, scale, forest_id, vNumLeafs, lmap) && lmap.width==max(w-width, 0) && lmap.height==max(h-height, 0)) {
+			voteColor(vector<IplImage*>(), vTarget, ratios, &lmap);
+			return;
+		}
+		cout << "No leaf map for " << filename << " at scale " << scale << endl;
+	}
+
+	FeatureMap fmap;
+	getFeatures(img, w, h, filename, fmap);
+
+	// detection
+	LeafMap lmap;
+	voteColor(fmap.vImg, vTarget, ratios, 0, maps ? &lmap : 0);
+	if(maps)
+		leafMaps->save(filename, scale, forest_id, lmap);
+
+	releaseFeatures(fmap);
+}
+
+void CRForestDetector::detectPyramid(IplImage *img, vector<vector<IplImage*> >& vImgDetect, std::vector<float>& ratios, const char* filename) {	
+
+	if(img->nChannels==1) {
+
+		std::cerr << "Gray color images are not supported." << std::endl;
+
+	} else { // color
+
+		cout << "Timer" << endl;
+		double tstart = CRProfile::now();
+
+		for(int i=0; i<int(vImgDetect.size()); ++i) {
+
+			// reset output image
+			for(int c=0; c<(int)vImgDetect[i].size(); ++c)
+				cvSetZero( vImgDetect[i][c] );
+
+			// detection
+			vector<VoteTarget> vTarget(1);
+			vTarget[0].imgDetect = &vImgDetect[i];
+			vTarget[0].factor = 1;
+			vTarget[0].weight = 1;
+			voteLevel(img, vImgDetect[i][0]->width, vImgDetect[i][0]->height, filename, vTarget, ratios);
+
+			// smooth result image
+			CR_PROFILE_START(t_smoothing);
+			for(int c=0; c<(int)vImgDetect[i].size(); ++c)
+				cvSmooth( vImgDetect[i][c], vImgDetect[i][c], CV_GAUSSIAN, 3);
+			CR_PROFILE_STOP(STAGE_SMOOTHING, t_smoothing);
+		}
+
+		cout << "Time " << CRProfile::now() - tstart << " sec" << endl;
+
+	}
+
+}
+
+void CRForestDetector::detectSpace(IplImage *img, const vector<float>& scales, const vector<float>& space, vector<vector<IplImage*> >& vImgSpace, std::vector<float>& ratios, float spread, const char* filename) {	
+
+	if(img->nChannels==1) {
+
+		std::cerr << "Gray color images are not supported." << std::endl;
+
+	} else { // color
+
+		cout << "Timer" << endl;
+		double tstart = CRProfile::now();
+
+		// reset output images
+		for(unsigned int b=0; b<vImgSpace.size(); ++b)
+			for(unsigned int c=0; c<vImgSpace[b].size(); ++c)
+				cvSetZero( vImgSpace[b][c] );
+
+		for(unsigned int i=0; i<scales.size(); ++i) {
+
+			// bins within 2 spread octaves (none or spread 0: nearest bin), weighted by a Gaussian of the scale difference
+			vector<VoteTarget> vTarget;
+			unsigned int nearest = 0;
+			for(unsigned int b=0; b<space.size(); ++b) {
+				float d = log(space[b]/scales[i]) / log(2.0f);
+				if(fabs(d) < fabs(log(space[nearest]/scales[i]) / log(2.0f)))
+					nearest = b;
+				if(spread>0 && fabs(d)<=2*spread) {
+					VoteTarget target;
+					target.imgDetect = &vImgSpace[b];
+					target.factor = space[b]/scales[i];
+					target.weight = exp(-d*d / (2*spread*spread));
+					vTarget.push_back(target);
+				}
+			}
+			if(vTarget.empty()) {
+				VoteTarget target;
+				target.imgDetect = &vImgSpace[nearest];
+				target.factor = space[nearest]/scales[i];
+				target.weight = 1;
+				vTarget.push_back(target);
+			}
+
+			// every level contributes the same total weight
+			float sum = 0;
+			for(unsigned int t=0; t<vTarget.size(); ++t)
+				sum += vTarget[t].weight;
+			for(unsigned int t=0; t<vTarget.size(); ++t)
+				vTarget[t].weight /= sum;
+
+			// detection
+			voteLevel(img, int(img->width*scales[i]+0.5), int(img->height*scales[i]+0.5), filename, vTarget, ratios);
+		}
+
+		// smooth result images
+		CR_PROFILE_START(t_smoothing);
+		for(unsigned int b=0; b<vImgSpace.size(); ++b)
+			for(unsigned int c=0; c<vImgSpace[b].size(); ++c)
+				cvSmooth( vImgSpace[b][c], vImgSpace[b][c], CV_GAUSSIAN, 3);
+		CR_PROFILE_STOP(STAGE_SMOOTHING, t_smoothing);
+
+		cout << "Time " << CRProfile::now() - tstart << " sec" << endl;
+
+	}
+
+}
+
@@ -1,28 +1,78 @@
-/* 
-// Author: Juergen Gall, BIWI, ETH Zurich
-// Email: gall@vision.ee.ethz.ch
-*/
-
-#pragma once
-
-#include "CRForest.h"
-
-
-class CRForestDetector {
-public:
-	// Constructor
-	CRForestDetector(const CRForest* pRF, int w, int h) : crForest(pRF), width(w), height(h)  {}
-
-	// detect multi scale
-	void detectPyramid(IplImage *img, std::vector<std::vector<IplImage*> >& imgDetect, std::vector<float>& ratios);
-
-	// Get/Set functions
-	unsigned int GetNumCenter() const {return crForest->GetNumCenter();}
-
-private:
-	void detectColor(IplImage *img, std::vector<IplImage*>& imgDetect, std::vector<float>& ratios);
-
-	const CRForest* crForest;
-	int width;
-	int height;
-};
+/* 
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#include "CRForest.h"
+#include "CRFeatureCache.h"
+#include "CRLeafMap.h"
+
+// Hough images voted by a pyramid level: the patch centers of the level are mapped by factor
+// to the images (factor 1: same scale) and the votes are weighted by weight
+struct VoteTarget {
+	std::vector<IplImage*>* imgDetect;
+	float factor;
+	float weight;
+};
+
+class CRForestDetector {
+public:
+	// Constructor
+	CRForestDetector(const CRForest* pRF, int w, int h) : crForest(pRF), width(w), height(h), featCache(0), vote_mode(0), leafMaps(0), leaf_mode(0), forest_id(0)  {}
+
+	// detect multi scale
+	// imgDetect[scale]: Hough images of the ratios for each object class (ratios of class 1 first)
+	// filename is required for reading/writing feature channels from/to the cache
+	void detectPyramid(IplImage *img, std::vector<std::vector<IplImage*> >& imgDetect, std::vector<float>& ratios, const char* filename = 0);
+	// detect in a joint (x, y, scale) Hough space
+	// The levels scales are voted into the bins of the scale axis space (imgSpace[bin] like imgDetect[scale]); 
+	// a level votes into the bins within 2*spread octaves with weight exp(-d^2/(2*spread^2)), d: difference 
+	// in octaves, normalized to sum 1 per level (spread 0: only the nearest bin with weight 1)
+	void detectSpace(IplImage *img, const std::vector<float>& scales, const std::vector<float>& space, std::vector<std::vector<IplImage*> >& imgSpace, 
+		std::vector<float>& ratios, float spread, const char* filename = 0);
+
+	// Get/Set functions
+	unsigned int GetNumCenter() const {return crForest->GetNumCenter();}
+	unsigned int GetNumClasses() const {return crForest->GetNumClasses();}
+	int GetNumTrees() const {return crForest->GetSize();}
+	// Use cached feature channels instead of extracting them (0: no cache)
+	void SetFeatureCache(const CRFeatureCache* cache) {featCache = cache;}
+	// Voting: 0 - direct, each patch votes after the traversal of its row (default); 
+	// 1 - grouped by leaf, the leafs of a band of rows are recorded and each leaf votes for all its patches 
+	// at once, i.e., the votes of a leaf stay in cache (the sums of votes can differ by rounding)
+	void SetVoting(int mode) {vote_mode = mode;}
+	// Leaf maps of the images (0: none): mode 1 - the leafs of the patches are saved, 
+	// 2 - the leafs are read instead of extracting features and traversing the trees (re-voting), 
+	// missing or stale maps are computed and saved; fails if a tree has more than 65536 leafs
+	bool SetLeafMaps(const CRLeafMaps* maps, int mode);
+
+	// Microbenchmarks (CRBenchmark.cpp)
+	friend class CRBenchmark;
+
+private:
+	void detectColor(const std::vector<IplImage*>& vImg, std::vector<IplImage*>& imgDetect, std::vector<float>& ratios);
+	// Regression and voting of the patches of a level into several targets (not reset, not smoothed)
+	// leafsIn: leafs of the patches instead of the regression of vImg; leafsOut: the leafs are stored
+	void voteColor(const std::vector<IplImage*>& vImg, std::vector<VoteTarget>& vTarget, std::vector<float>& ratios, 
+		const LeafMap* leafsIn = 0, LeafMap* leafsOut = 0);
+	// Voting of img resized to w x h into targets with the leaf maps
+	void voteLevel(IplImage *img, int w, int h, const char* filename, std::vector<VoteTarget>& vTarget, std::vector<float>& ratios);
+	// Feature channels of img resized to w x h (fmap.vImg): mapped from the cache if available, otherwise extracted
+	void getFeatures(IplImage *img, int w, int h, const char* filename, FeatureMap& fmap) const;
+	static void releaseFeatures(FeatureMap& fmap);
+
+	const CRForest* crForest;
+	int width;
+	int height;
+
+	const CRFeatureCache* featCache;
+	int vote_mode;
+
+	const CRLeafMaps* leafMaps;
+	int leaf_mode;
+	// checksum of the tests of the forest and number of leafs of each tree
+	unsigned long long forest_id;
+	std::vector<unsigned int> vNumLeafs;
+};
@@ -0,0 +1,225 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRLeafMap.h"
+#include "CRFileUtil.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <algorithm>
+
+using namespace std;
+
+// Header of a leaf map file
+struct LeafMapHeader {
+	char magic[8];
+	// version of the layout
+	unsigned int version;
+	// number of trees
+	unsigned int trees;
+	// number of patches per row and rows
+	int width;
+	int height;
+	// scale of the image pyramid level
+	float scale;
+	// length of image path stored after the header
+	unsigned int pathlen;
+	// modification time of the image
+	long long mtime;
+	// checksum of the tests of the trees
+	unsigned long long forest;
+};
+
+static const char mapMagic[8] = {'C','R','L','E','A','F','M','P'};
+
+// Bit stream, least significant bit first
+struct BitWriter {
+	BitWriter(vector<uchar>& v) : vData(v), acc(0), num(0) {}
+	void put(unsigned int val, int bits) {
+		for(int b=0; b<bits; ++b) {
+			acc |= ((val >> b) & 1) << num;
+			if(++num==8) {
+				vData.push_back(uchar(acc));
+				acc = 0;
+				num = 0;
+			}
+		}
+	}
+	void flush() {
+		if(num>0)
+			vData.push_back(uchar(acc));
+		acc = 0;
+		num = 0;
+	}
+	vector<uchar>& vData;
+	unsigned int acc;
+	int num;
+};
+
+struct BitReader {
+	BitReader(const uchar* p, const uchar* e) : pt(p), end(e), num(0) {}
+	bool get(unsigned int& val, int bits) {
+		val = 0;
+		for(int b=0; b<bits; ++b) {
+			if(pt==end)
+				return false;
+			val |= (unsigned int)((*pt >> num) & 1) << b;
+			if(++num==8) {
+				++pt;
+				num = 0;
+			}
+		}
+		return true;
+	}
+	const uchar* pt;
+	const uchar* end;
+	int num;
+};
+
+string CRLeafMaps::filename(const string& image, float scale) const {
+	return CRFileUtil::imageFile(mappath, image, scale, "lm");
+}
+
+bool CRLeafMaps::load(const string& image, float scale, unsigned long long forest, const vector<unsigned int>& vNumLeafs, LeafMap& lmap) const {
+	long long mtime = CRFileUtil::fileTime(image);
+	if(mtime<0)
+		return false;
+
+	ifstream in(filename(image, scale).c_str(), ios::binary);
+	if(!in.is_open())
+		return false;
+	vector<char> vFile((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	in.close();
+	if(vFile.size()<sizeof(LeafMapHeader))
+		return false;
+
+	// check whether map is valid and up to date
+	const LeafMapHeader* header = (const LeafMapHeader*)&vFile[0];
+	const char* path = &vFile[0] + sizeof(LeafMapHeader);
+	bool valid = memcmp(header->magic, mapMagic, sizeof(mapMagic))==0 &&
+		header->version==CRLEAFMAP_VERSION &&
+		header->scale==scale && header->mtime==mtime && header->forest==forest && header->trees==vNumLeafs.size() &&
+		header->width>=0 && header->height>=0 &&
+		header->pathlen==image.size() && sizeof(LeafMapHeader) + header->pathlen <= vFile.size() &&
+		image.compare(0, image.size(), path, header->pathlen)==0;
+	if(!valid)
+		return false;
+
+	// decode leafs of all trees
+	lmap.width = header->width;
+	lmap.height = header->height;
+	lmap.vLeaf.resize(header->trees);
+	const uchar* pt = (const uchar*)path + header->pathlen;
+	const uchar* end = (const uchar*)&vFile[0] + vFile.size();
+	unsigned int num = lmap.width*lmap.height;
+	for(unsigned int t=0; t<lmap.vLeaf.size(); ++t) {
+		unsigned int length;
+		if(!CRFileUtil::getVarint(pt, end, length) || length>(unsigned int)(end-pt))
+			return false;
+		const uchar* tree_end = pt + length;
+
+		if(length==0 || *pt>16)
+			return false;
+		int bits = *pt;
+
+		vector<unsigned short>& vLeaf = lmap.vLeaf[t];
+		vLeaf.resize(num);
+		BitReader reader(pt+1, tree_end);
+		for(unsigned int i=0; i<num; ++i) {
+			unsigned int code, leaf;
+			if(!reader.get(code, 1))
+				return false;
+			if(code==0) {
+				if(i%lmap.width==0)
+					return false;
+				vLeaf[i] = vLeaf[i-1];
+				continue;
+			}
+			if(!reader.get(code, 1))
+				return false;
+			if(code==0) {
+				if(i<(unsigned int)lmap.width)
+					return false;
+				vLeaf[i] = vLeaf[i-lmap.width];
+				continue;
+			}
+			if(!reader.get(leaf, bits) || leaf>=vNumLeafs[t])
+				return false;
+			vLeaf[i] = (unsigned short)leaf;
+		}
+		pt = tree_end;
+	}
+
+	return pt==end;
+}
+
+bool CRLeafMaps::save(const string& image, float scale, unsigned long long forest, const LeafMap& lmap) const {
+	long long mtime = CRFileUtil::fileTime(image);
+	if(mtime<0)
+		return false;
+
+	LeafMapHeader header;
+	memcpy(header.magic, mapMagic, sizeof(mapMagic));
+	header.version = CRLEAFMAP_VERSION;
+	header.trees = lmap.vLeaf.size();
+	header.width = lmap.width;
+	header.height = lmap.height;
+	header.scale = scale;
+	header.pathlen = image.size();
+	header.mtime = mtime;
+	header.forest = forest;
+
+	// leafs of each tree: 0 - same as left patch, 10 - same as patch above, 11 - leaf index with bits bits
+	vector<uchar> vData, vTree;
+	for(unsigned int t=0; t<lmap.vLeaf.size(); ++t) {
+		const vector<unsigned short>& vLeaf = lmap.vLeaf[t];
+		unsigned int max_leaf = 0;
+		for(unsigned int i=0; i<vLeaf.size(); ++i)
+			max_leaf = max(max_leaf, (unsigned int)vLeaf[i]);
+		int bits = 0;
+		while((max_leaf >> bits)>0)
+			++bits;
+
+		vTree.assign(1, uchar(bits));
+		BitWriter writer(vTree);
+		for(unsigned int i=0; i<vLeaf.size(); ++i) {
+			if(i%lmap.width>0 && vLeaf[i]==vLeaf[i-1]) {
+				writer.put(0, 1);
+			} else if(i>=(unsigned int)lmap.width && vLeaf[i]==vLeaf[i-lmap.width]) {
+				writer.put(1, 1);
+				writer.put(0, 1);
+			} else {
+				writer.put(3, 2);
+				writer.put(vLeaf[i], bits);
+			}
+		}
+		writer.flush();
+		CRFileUtil::putVarint(vData, vTree.size());
+		vData.insert(vData.end(), vTree.begin(), vTree.end());
+	}
+
+	string mfile = filename(image, scale);
+	string tmpfile = CRFileUtil::tempFile(mfile);
+
+	ofstream out(tmpfile.c_str(), ios::binary);
+	if(!out.is_open()) {
+		cerr << "Could not write leaf map: " << tmpfile << endl;
+		return false;
+	}
+
+	out.write((const char*)&header, sizeof(header));
+	out.write(image.c_str(), image.size());
+	if(vData.size()>0)
+		out.write((const char*)&vData[0], vData.size());
+
+	bool done = CRFileUtil::replaceFile(out, tmpfile, mfile);
+	if(!done)
+		cerr << "Could not write leaf map: " << mfile << endl;
+
+	return done;
+}
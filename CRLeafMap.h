@@ -0,0 +1,49 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#include <cxcore.h>
+
+#include <string>
+#include <vector>
+
+// Version of the leaf map files; increase whenever the layout changes
+#define CRLEAFMAP_VERSION 1
+
+// Leafs of all patches of an image at a given scale: for each tree, the index of the leaf (see CRTree::leafId)
+// of the patch with top left corner (x,y) is vLeaf[tree][x+y*width]
+struct LeafMap {
+	LeafMap() : width(0), height(0) {}
+
+	// number of patches per row and rows
+	int width;
+	int height;
+
+	std::vector<std::vector<unsigned short> > vLeaf;
+};
+
+// Leaf maps of the test images on disk for voting without feature extraction and regression
+// One file per image and scale:
+// header | image path | tree 0 | ... | tree n-1 (byte length, bits of a leaf index, bit coded leafs: 
+// same as the patch to the left, same as the patch above, or leaf index)
+// A map is valid for the same image (path, modification time), scale and tests of the trees (see forest)
+class CRLeafMaps {
+public:
+	CRLeafMaps(const std::string& path) : mappath(path) {}
+
+	// Read map; returns false if the file is missing, stale or corrupt
+	// forest: checksum of the tests of the trees (see CRForest::testChecksum)
+	// vNumLeafs: number of leafs of each tree; the map must have the same number of trees and valid leaf indices
+	bool load(const std::string& image, float scale, unsigned long long forest, const std::vector<unsigned int>& vNumLeafs, LeafMap& lmap) const;
+	// Store map of image at scale
+	bool save(const std::string& image, float scale, unsigned long long forest, const LeafMap& lmap) const;
+
+private:
+	// Map filename for image and scale
+	std::string filename(const std::string& image, float scale) const;
+
+	std::string mappath;
+};
@@ -1,574 +1,915 @@
-/* 
-// Author: Juergen Gall, BIWI, ETH Zurich
-// Email: gall@vision.ee.ethz.ch
-*/
-
-#include "CRPatch.h"
-#include <highgui.h>
-
-#include <deque>
-
-using namespace std;
-
-void CRPatch::extractPatches(IplImage *img, unsigned int n, int label, CvRect* box, std::vector<CvPoint>* vCenter) {
-	// extract features
-	vector<IplImage*> vImg;
-	extractFeatureChannels(img, vImg);
-
-	CvMat tmp;
-	int offx = width/2; 
-	int offy = height/2;
-
-	// generate x,y locations
-	CvMat* locations = cvCreateMat( n, 1, CV_32SC2 );
-	if(box==0)
-		cvRandArr( cvRNG, locations, CV_RAND_UNI, cvScalar(0,0,0,0), cvScalar(img->width-width,img->height-height,0,0) );
-	else
-		cvRandArr( cvRNG, locations, CV_RAND_UNI, cvScalar(box->x,box->y,0,0), cvScalar(box->x+box->width-width,box->y+box->height-height,0,0) );
-
-	// reserve memory
-	unsigned int offset = vLPatches[label].size();
-	vLPatches[label].reserve(offset+n);
-	for(unsigned int i=0; i<n; ++i) {
-		CvPoint pt = *(CvPoint*)cvPtr1D( locations, i, 0 );
-		
-		PatchFeature pf;
-		vLPatches[label].push_back(pf);
-
-		vLPatches[label].back().roi.x = pt.x;  vLPatches[label].back().roi.y = pt.y;  
-		vLPatches[label].back().roi.width = width;  vLPatches[label].back().roi.height = height; 
-
-		if(vCenter!=0) {
-			vLPatches[label].back().center.resize(vCenter->size());
-			for(unsigned int c = 0; c<vCenter->size(); ++c) {
-				vLPatches[label].back().center[c].x = pt.x + offx - (*vCenter)[c].x;
-				vLPatches[label].back().center[c].y = pt.y + offy - (*vCenter)[c].y;
-			}
-		}
-
-		vLPatches[label].back().vPatch.resize(vImg.size());
-		for(unsigned int c=0; c<vImg.size(); ++c) {
-			cvGetSubRect( vImg[c], &tmp,  vLPatches[label].back().roi );
-			vLPatches[label].back().vPatch[c] = cvCloneMat(&tmp);
-		}
-
-	}
-
-	cvReleaseMat(&locations);
-	for(unsigned int c=0; c<vImg.size(); ++c)
-		cvReleaseImage(&vImg[c]);
-}
-
-void CRPatch::extractFeatureChannels(IplImage *img, std::vector<IplImage*>& vImg) {
-	// 32 feature channels
-	// 7+9 channels: L, a, b, |I_x|, |I_y|, |I_xx|, |I_yy|, HOGlike features with 9 bins (weighted orientations 5x5 neighborhood)
-	// 16+16 channels: minfilter + maxfilter on 5x5 neighborhood 
-
-	vImg.resize(32);
-	for(unsigned int c=0; c<vImg.size(); ++c)
-		vImg[c] = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_8U , 1); 
-
-	// Get intensity
-	cvCvtColor( img, vImg[0], CV_RGB2GRAY );
-
-	// Temporary images for computing I_x, I_y (Avoid overflow for cvSobel)
-	IplImage* I_x = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_16S, 1); 
-	IplImage* I_y = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_16S, 1); 
-	
-	// |I_x|, |I_y|
-	cvSobel(vImg[0],I_x,1,0,3);			
-
-	cvSobel(vImg[0],I_y,0,1,3);			
-
-	cvConvertScaleAbs( I_x, vImg[3], 0.25);
-
-	cvConvertScaleAbs( I_y, vImg[4], 0.25);
-	
-	{
-	  short* dataX;
-	  short* dataY;
-	  uchar* dataZ;
-	  int stepX, stepY, stepZ;
-	  CvSize size;
-	  int x, y;
-
-	  cvGetRawData( I_x, (uchar**)&dataX, &stepX, &size);
-	  cvGetRawData( I_y, (uchar**)&dataY, &stepY);
-	  cvGetRawData( vImg[1], (uchar**)&dataZ, &stepZ);
-	  stepX /= sizeof(dataX[0]);
-	  stepY /= sizeof(dataY[0]);
-	  stepZ /= sizeof(dataZ[0]);
-	  
-	  // Orientation of gradients
-	  for( y = 0; y < size.height; y++, dataX += stepX, dataY += stepY, dataZ += stepZ  )
-	    for( x = 0; x < size.width; x++ ) {
-	      // Avoid division by zero
-	      float tx = (float)dataX[x] + (float)_copysign(0.000001f, (float)dataX[x]);
-	      // Scaling [-pi/2 pi/2] -> [0 80*pi]
-	      dataZ[x]=uchar( ( atan((float)dataY[x]/tx)+3.14159265f/2.0f ) * 80 ); 
-	    }
-	}
-	
-	{
-	  short* dataX;
-	  short* dataY;
-	  uchar* dataZ;
-	  int stepX, stepY, stepZ;
-	  CvSize size;
-	  int x, y;
-	  
-	  cvGetRawData( I_x, (uchar**)&dataX, &stepX, &size);
-	  cvGetRawData( I_y, (uchar**)&dataY, &stepY);
-	  cvGetRawData( vImg[2], (uchar**)&dataZ, &stepZ);
-	  stepX /= sizeof(dataX[0]);
-	  stepY /= sizeof(dataY[0]);
-	  stepZ /= sizeof(dataZ[0]);
-	  
-	  // Magnitude of gradients
-	  for( y = 0; y < size.height; y++, dataX += stepX, dataY += stepY, dataZ += stepZ  )
-	    for( x = 0; x < size.width; x++ ) {
-	      dataZ[x] = (uchar)( sqrt((float)dataX[x]*(float)dataX[x] + (float)dataY[x]*(float)dataY[x]) );
-	    }
-	}
-
-	// 9-bin HOG feature stored at vImg[7] - vImg[15] 
-	hog.extractOBin(vImg[1], vImg[2], vImg, 7);
-	
-	// |I_xx|, |I_yy|
-
-	cvSobel(vImg[0],I_x,2,0,3);
-	cvConvertScaleAbs( I_x, vImg[5], 0.25);	
-	
-	cvSobel(vImg[0],I_y,0,2,3);
-	cvConvertScaleAbs( I_y, vImg[6], 0.25);
-	
-	// L, a, b
-	cvCvtColor( img, img, CV_RGB2Lab  );
-
-	cvReleaseImage(&I_x);
-	cvReleaseImage(&I_y);	
-	
-	cvSplit( img, vImg[0], vImg[1], vImg[2], 0);
-
-	// min filter
-	for(int c=0; c<16; ++c)
-		minfilt(vImg[c], vImg[c+16], 5);
-
-	//max filter
-	for(int c=0; c<16; ++c)
-		maxfilt(vImg[c], 5);
-
-
-	
-#if 0
-	// for debugging only
-	char buffer[40];
-	for(unsigned int i = 0; i<vImg.size();++i) {
-		sprintf_s(buffer,"out-%d.png",i);
-		cvNamedWindow(buffer,1);
-		cvShowImage(buffer, vImg[i]);
-		//cvSaveImage( buffer, vImg[i] );
-	}
-
-	cvWaitKey();
-
-	for(unsigned int i = 0; i<vImg.size();++i) {
-		sprintf_s(buffer,"%d",i);
-		cvDestroyWindow(buffer);
-	}
-#endif
-
-
-}
-
-void CRPatch::maxfilt(IplImage *src, unsigned int width) {
-
-	uchar* s_data;
-	int step;
-	CvSize size;
-
-	cvGetRawData( src, (uchar**)&s_data, &step, &size );
-	step /= sizeof(s_data[0]);
-
-	for(int  y = 0; y < size.height; y++) {
-		maxfilt(s_data+y*step, 1, size.width, width);
-	}
-
-	cvGetRawData( src, (uchar**)&s_data);
-
-	for(int  x = 0; x < size.width; x++)
-		maxfilt(s_data+x, step, size.height, width);
-
-}
-
-void CRPatch::maxfilt(IplImage *src, IplImage *dst, unsigned int width) {
-
-	uchar* s_data;
-	uchar* d_data;
-	int step;
-	CvSize size;
-
-	cvGetRawData( src, (uchar**)&s_data, &step, &size );
-	cvGetRawData( dst, (uchar**)&d_data, &step, &size );
-	step /= sizeof(s_data[0]);
-
-	for(int  y = 0; y < size.height; y++)
-		maxfilt(s_data+y*step, d_data+y*step, 1, size.width, width);
-
-	cvGetRawData( src, (uchar**)&d_data);
-
-	for(int  x = 0; x < size.width; x++)
-		maxfilt(d_data+x, step, size.height, width);
-
-}
-
-void CRPatch::minfilt(IplImage *src, unsigned int width) {
-
-	uchar* s_data;
-	int step;
-	CvSize size;
-
-	cvGetRawData( src, (uchar**)&s_data, &step, &size );
-	step /= sizeof(s_data[0]);
-
-	for(int  y = 0; y < size.height; y++)
-		minfilt(s_data+y*step, 1, size.width, width);
-
-	cvGetRawData( src, (uchar**)&s_data);
-
-	for(int  x = 0; x < size.width; x++)
-		minfilt(s_data+x, step, size.height, width);
-
-}
-
-void CRPatch::minfilt(IplImage *src, IplImage *dst, unsigned int width) {
-
-	uchar* s_data;
-	uchar* d_data;
-	int step;
-	CvSize size;
-
-	cvGetRawData( src, (uchar**)&s_data, &step, &size );
-	cvGetRawData( dst, (uchar**)&d_data, &step, &size );
-	step /= sizeof(s_data[0]);
-
-	for(int  y = 0; y < size.height; y++)
-		minfilt(s_data+y*step, d_data+y*step, 1, size.width, width);
-
-	cvGetRawData( src, (uchar**)&d_data);
-
-	for(int  x = 0; x < size.width; x++)
-		minfilt(d_data+x, step, size.height, width);
-
-}
-
-
-void CRPatch::maxfilt(uchar* data, uchar* maxvalues, unsigned int step, unsigned int size, unsigned int width) {
-
-	unsigned int d = int((width+1)/2)*step; 
-	size *= step;
-	width *= step;
-
-	maxvalues[0] = data[0];
-	for(unsigned int i=0; i < d-step; i+=step) {
-		for(unsigned int k=i; k<d+i; k+=step) {
-			if(data[k]>maxvalues[i]) maxvalues[i] = data[k];
-		}
-		maxvalues[i+step] = maxvalues[i];
-	}
-
-	maxvalues[size-step] = data[size-step];
-	for(unsigned int i=size-step; i > size-d; i-=step) {
-		for(unsigned int k=i; k>i-d; k-=step) {
-			if(data[k]>maxvalues[i]) maxvalues[i] = data[k];
-		}
-		maxvalues[i-step] = maxvalues[i];
-	}
-
-    deque<int> maxfifo;
-    for(unsigned int i = step; i < size; i+=step) {
-		if(i >= width) {
-			maxvalues[i-d] = data[maxfifo.size()>0 ? maxfifo.front(): i-step];
-		}
-    
-		if(data[i] < data[i-step]) { 
-
-			maxfifo.push_back(i-step);
-			if(i==  width+maxfifo.front()) 
-				maxfifo.pop_front();
-
-		} else {
-
-			while(maxfifo.size() > 0) {
-				if(data[i] <= data[maxfifo.back()]) {
-					if(i==  width+maxfifo.front()) 
-						maxfifo.pop_front();
-				break;
-				}
-				maxfifo.pop_back();
-			}
-
-		}
-
-    }  
-
-    maxvalues[size-d] = data[maxfifo.size()>0 ? maxfifo.front():size-step];
- 
-}
-
-void CRPatch::maxfilt(uchar* data, unsigned int step, unsigned int size, unsigned int width) {
-
-	unsigned int d = int((width+1)/2)*step; 
-	size *= step;
-	width *= step;
-
-	deque<uchar> tmp;
-
-	tmp.push_back(data[0]);
-	for(unsigned int k=step; k<d; k+=step) {
-		if(data[k]>tmp.back()) tmp.back() = data[k];
-	}
-
-	for(unsigned int i=step; i < d-step; i+=step) {
-		tmp.push_back(tmp.back());
-		if(data[i+d-step]>tmp.back()) tmp.back() = data[i+d-step];
-	}
-
-
-    deque<int> minfifo;
-    for(unsigned int i = step; i < size; i+=step) {
-		if(i >= width) {
-			tmp.push_back(data[minfifo.size()>0 ? minfifo.front(): i-step]);
-			data[i-width] = tmp.front();
-			tmp.pop_front();
-		}
-    
-		if(data[i] < data[i-step]) { 
-
-			minfifo.push_back(i-step);
-			if(i==  width+minfifo.front()) 
-				minfifo.pop_front();
-
-		} else {
-
-			while(minfifo.size() > 0) {
-				if(data[i] <= data[minfifo.back()]) {
-					if(i==  width+minfifo.front()) 
-						minfifo.pop_front();
-				break;
-				}
-				minfifo.pop_back();
-			}
-
-		}
-
-    }  
-
-	tmp.push_back(data[minfifo.size()>0 ? minfifo.front():size-step]);
-	
-	for(unsigned int k=size-step-step; k>=size-d; k-=step) {
-		if(data[k]>data[size-step]) data[size-step] = data[k];
-	}
-
-	for(unsigned int i=size-step-step; i >= size-d; i-=step) {
-		data[i] = data[i+step];
-		if(data[i-d+step]>data[i]) data[i] = data[i-d+step];
-	}
-
-	for(unsigned int i=size-width; i<=size-d; i+=step) {
-		data[i] = tmp.front();
-		tmp.pop_front();
-	}
- 
-}
-
-void CRPatch::minfilt(uchar* data, uchar* minvalues, unsigned int step, unsigned int size, unsigned int width) {
-
-	unsigned int d = int((width+1)/2)*step; 
-	size *= step;
-	width *= step;
-
-	minvalues[0] = data[0];
-	for(unsigned int i=0; i < d-step; i+=step) {
-		for(unsigned int k=i; k<d+i; k+=step) {
-			if(data[k]<minvalues[i]) minvalues[i] = data[k];
-		}
-		minvalues[i+step] = minvalues[i];
-	}
-
-	minvalues[size-step] = data[size-step];
-	for(unsigned int i=size-step; i > size-d; i-=step) {
-		for(unsigned int k=i; k>i-d; k-=step) {
-			if(data[k]<minvalues[i]) minvalues[i] = data[k];
-		}
-		minvalues[i-step] = minvalues[i];
-	}
-
-    deque<int> minfifo;
-    for(unsigned int i = step; i < size; i+=step) {
-		if(i >= width) {
-			minvalues[i-d] = data[minfifo.size()>0 ? minfifo.front(): i-step];
-		}
-    
-		if(data[i] > data[i-step]) { 
-
-			minfifo.push_back(i-step);
-			if(i==  width+minfifo.front()) 
-				minfifo.pop_front();
-
-		} else {
-
-			while(minfifo.size() > 0) {
-				if(data[i] >= data[minfifo.back()]) {
-					if(i==  width+minfifo.front()) 
-						minfifo.pop_front();
-				break;
-				}
-				minfifo.pop_back();
-			}
-
-		}
-
-    }  
-
-    minvalues[size-d] = data[minfifo.size()>0 ? minfifo.front():size-step];
- 
-}
-
-void CRPatch::minfilt(uchar* data, unsigned int step, unsigned int size, unsigned int width) {
-
-	unsigned int d = int((width+1)/2)*step; 
-	size *= step;
-	width *= step;
-
-	deque<uchar> tmp;
-
-	tmp.push_back(data[0]);
-	for(unsigned int k=step; k<d; k+=step) {
-		if(data[k]<tmp.back()) tmp.back() = data[k];
-	}
-
-	for(unsigned int i=step; i < d-step; i+=step) {
-		tmp.push_back(tmp.back());
-		if(data[i+d-step]<tmp.back()) tmp.back() = data[i+d-step];
-	}
-
-
-    deque<int> minfifo;
-    for(unsigned int i = step; i < size; i+=step) {
-		if(i >= width) {
-			tmp.push_back(data[minfifo.size()>0 ? minfifo.front(): i-step]);
-			data[i-width] = tmp.front();
-			tmp.pop_front();
-		}
-    
-		if(data[i] > data[i-step]) { 
-
-			minfifo.push_back(i-step);
-			if(i==  width+minfifo.front()) 
-				minfifo.pop_front();
-
-		} else {
-
-			while(minfifo.size() > 0) {
-				if(data[i] >= data[minfifo.back()]) {
-					if(i==  width+minfifo.front()) 
-						minfifo.pop_front();
-				break;
-				}
-				minfifo.pop_back();
-			}
-
-		}
-
-    }  
-
-	tmp.push_back(data[minfifo.size()>0 ? minfifo.front():size-step]);
-	
-	for(unsigned int k=size-step-step; k>=size-d; k-=step) {
-		if(data[k]<data[size-step]) data[size-step] = data[k];
-	}
-
-	for(unsigned int i=size-step-step; i >= size-d; i-=step) {
-		data[i] = data[i+step];
-		if(data[i-d+step]<data[i]) data[i] = data[i-d+step];
-	}
- 
-	for(unsigned int i=size-width; i<=size-d; i+=step) {
-		data[i] = tmp.front();
-		tmp.pop_front();
-	}
-}
-
-void CRPatch::maxminfilt(uchar* data, uchar* maxvalues, uchar* minvalues, unsigned int step, unsigned int size, unsigned int width) {
-
-	unsigned int d = int((width+1)/2)*step; 
-	size *= step;
-	width *= step;
-
-	maxvalues[0] = data[0];
-	minvalues[0] = data[0];
-	for(unsigned int i=0; i < d-step; i+=step) {
-		for(unsigned int k=i; k<d+i; k+=step) {
-			if(data[k]>maxvalues[i]) maxvalues[i] = data[k];
-			if(data[k]<minvalues[i]) minvalues[i] = data[k];
-		}
-		maxvalues[i+step] = maxvalues[i];
-		minvalues[i+step] = minvalues[i];
-	}
-
-	maxvalues[size-step] = data[size-step];
-	minvalues[size-step] = data[size-step];
-	for(unsigned int i=size-step; i > size-d; i-=step) {
-		for(unsigned int k=i; k>i-d; k-=step) {
-			if(data[k]>maxvalues[i]) maxvalues[i] = data[k];
-			if(data[k]<minvalues[i]) minvalues[i] = data[k];
-		}
-		maxvalues[i-step] = maxvalues[i];
-		minvalues[i-step] = minvalues[i];
-	}
-
-    deque<int> maxfifo, minfifo;
-
-    for(unsigned int i = step; i < size; i+=step) {
-		if(i >= width) {
-			maxvalues[i-d] = data[maxfifo.size()>0 ? maxfifo.front(): i-step];
-			minvalues[i-d] = data[minfifo.size()>0 ? minfifo.front(): i-step];
-		}
-    
-		if(data[i] > data[i-step]) { 
-
-			minfifo.push_back(i-step);
-			if(i==  width+minfifo.front()) 
-				minfifo.pop_front();
-			while(maxfifo.size() > 0) {
-				if(data[i] <= data[maxfifo.back()]) {
-					if (i==  width+maxfifo.front()) 
-						maxfifo.pop_front();
-					break;
-				}
-				maxfifo.pop_back();
-			}
-
-		} else {
-
-			maxfifo.push_back(i-step);
-			if (i==  width+maxfifo.front()) 
-				maxfifo.pop_front();
-			while(minfifo.size() > 0) {
-				if(data[i] >= data[minfifo.back()]) {
-					if(i==  width+minfifo.front()) 
-						minfifo.pop_front();
-				break;
-				}
-				minfifo.pop_back();
-			}
-
-		}
-
-    }  
-
-    maxvalues[size-d] = data[maxfifo.size()>0 ? maxfifo.front():size-step];
-	minvalues[size-d] = data[minfifo.size()>0 ? minfifo.front():size-step];
- 
-}
+/* 
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRPatch.h"
+#include <highgui.h>
+
+#include <deque>
+#include <cstdlib>
+#include <cstring>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+void CRPatch::extractPatches(IplImage *img, unsigned int n, int label, CvRect* box, std::vector<CvPoint>* vCenter) {
+	// extract features
+	vector<IplImage*> vImg;
+	extractFeatureChannels(img, vImg);
+
+	int offx = width/2; 
+	int offy = height/2;
+
+	// generate x,y locations
+	CvMat* locations = cvCreateMat( n, 1, CV_32SC2 );
+	if(box==0)
+		cvRandArr( cvRNG, locations, CV_RAND_UNI, cvScalar(0,0,0,0), cvScalar(img->width-width,img->height-height,0,0) );
+	else
+		cvRandArr( cvRNG, locations, CV_RAND_UNI, cvScalar(box->x,box->y,0,0), cvScalar(box->x+box->width-width,box->y+box->height-height,0,0) );
+
+	// get pointers to feature channels
+	int step;
+	vector<uchar*> ptFCh(vImg.size());
+	for(unsigned int c=0; c<vImg.size(); ++c)
+		cvGetRawData( vImg[c], &ptFCh[c], &step);
+
+	// reserve memory
+	PatchArena& patches = vLPatches[label];
+	if(patches.size()==0)
+		initLabel(label, vImg.size(), vCenter!=0 ? vCenter->size() : 0);
+	patches.reserve(patches.size()+n);
+
+	vector<CvPoint> center(patches.GetNumCenter());
+	for(unsigned int i=0; i<n; ++i) {
+		CvPoint pt = *(CvPoint*)cvPtr1D( locations, i, 0 );
+		
+		for(unsigned int c = 0; c<center.size(); ++c) {
+			center[c].x = pt.x + offx - (*vCenter)[c].x;
+			center[c].y = pt.y + offy - (*vCenter)[c].y;
+		}
+
+		// copy patch from each channel
+		uchar* ptP = patches.push_back(pt, center.size()>0 ? &center[0] : 0);
+		for(unsigned int c=0; c<vImg.size(); ++c) {
+			uchar* ptC = ptFCh[c] + pt.y*step + pt.x;
+			for(int y=0; y<height; ++y, ptC+=step, ptP+=width)
+				memcpy(ptP, ptC, width);
+		}
+
+	}
+
+	cvReleaseMat(&locations);
+	for(unsigned int c=0; c<vImg.size(); ++c)
+		cvReleaseImage(&vImg[c]);
+}
+
+void CRPatch::addPatches(const CRPatch& Other) {
+	for(unsigned int l=0; l<vLPatches.size() && l<Other.vLPatches.size(); ++l) {
+		const PatchArena& src = Other.vLPatches[l];
+		if(src.size()==0) continue;
+
+		PatchArena& patches = vLPatches[l];
+		if(patches.size()==0)
+			initLabel(l, src.GetChannels(), src.GetNumCenter());
+		patches.reserve(patches.size()+src.size());
+
+		// channels of a patch are stored consecutively
+		for(unsigned int i=0; i<src.size(); ++i) {
+			uchar* ptP = patches.push_back(src.roi(i), src.center(i));
+			memcpy(ptP, src.channel(i, 0), src.GetChannels()*width*height);
+		}
+	}
+}
+
+// FNV-1a over the number of patches, top left corners, and center points of each label
+unsigned long long CRPatch::checksum() const {
+	unsigned long long hash = 14695981039346656037ULL;
+	for(unsigned int l=0; l<vLPatches.size(); ++l) {
+		const PatchArena& patches = vLPatches[l];
+		hash ^= patches.size();
+		hash *= 1099511628211ULL;
+		for(unsigned int i=0; i<patches.size(); ++i) {
+			hash ^= (unsigned int)patches.roi(i).x | (unsigned long long)(unsigned int)patches.roi(i).y << 32;
+			hash *= 1099511628211ULL;
+			for(unsigned int c=0; c<patches.GetNumCenter(); ++c) {
+				const CvPoint& center = patches.center(i)[c];
+				hash ^= (unsigned int)center.x | (unsigned long long)(unsigned int)center.y << 32;
+				hash *= 1099511628211ULL;
+			}
+		}
+	}
+	return hash;
+}
+
+void CRPatch::initLabel(int label, int channels, int cp) {
+	vLPatches[label].init(width, height, channels, cp);
+	if(!storepath.empty() && !vLPatches[label].createStore(storeFile(storepath, label).c_str()))
+		exit(-1);
+}
+
+CvRNG CRPatch::streamSeed(CvRNG master, unsigned int index) {
+	uint64 z = master + (uint64)(index+1) * 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	z = z ^ (z >> 31);
+	return ::cvRNG(z);
+}
+
+void CRPatch::extractFeatureChannels(IplImage *img, std::vector<IplImage*>& vImg) {
+	// 32 feature channels
+	// 7+9 channels: L, a, b, |I_x|, |I_y|, |I_xx|, |I_yy|, HOGlike features with 9 bins (weighted orientations 5x5 neighborhood)
+	// 16+16 channels: minfilter + maxfilter on 5x5 neighborhood 
+
+	vImg.resize(32);
+	for(unsigned int c=0; c<vImg.size(); ++c)
+		vImg[c] = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_8U , 1); 
+
+	// Get intensity
+	cvCvtColor( img, vImg[0], CV_RGB2GRAY );
+
+	// Temporary images for computing I_x, I_y (Avoid overflow for cvSobel)
+	IplImage* I_x = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_16S, 1); 
+	IplImage* I_y = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_16S, 1); 
+	
+	// |I_x|, |I_y|
+	cvSobel(vImg[0],I_x,1,0,3);			
+
+	cvSobel(vImg[0],I_y,0,1,3);			
+
+	cvConvertScaleAbs( I_x, vImg[3], 0.25);
+
+	cvConvertScaleAbs( I_y, vImg[4], 0.25);
+	
+	// Orientation of gradients
+	gradientOrientation(I_x, I_y, vImg[1]);
+
+	// Magnitude of gradients
+	gradientMagnitude(I_x, I_y, vImg[2]);
+
+	// 9-bin HOG feature stored at vImg[7] - vImg[15] 
+	hog.extractOBin(vImg[1], vImg[2], vImg, 7);
+	
+	// |I_xx|, |I_yy|
+
+	cvSobel(vImg[0],I_x,2,0,3);
+	cvConvertScaleAbs( I_x, vImg[5], 0.25);	
+	
+	cvSobel(vImg[0],I_y,0,2,3);
+	cvConvertScaleAbs( I_y, vImg[6], 0.25);
+	
+	// L, a, b
+	cvCvtColor( img, img, CV_RGB2Lab  );
+
+	cvReleaseImage(&I_x);
+	cvReleaseImage(&I_y);	
+	
+	cvSplit( img, vImg[0], vImg[1], vImg[2], 0);
+
+	// min filter
+	for(int c=0; c<16; ++c)
+		minfilt(vImg[c], vImg[c+16], 5);
+
+	//max filter
+	for(int c=0; c<16; ++c)
+		maxfilt(vImg[c], 5);
+
+
+	
+#if 0
+	// for debugging only
+	char buffer[40];
+	for(unsigned int i = 0; i<vImg.size();++i) {
+		sprintf_s(buffer,"out-%d.png",i);
+		cvNamedWindow(buffer,1);
+		cvShowImage(buffer, vImg[i]);
+		//cvSaveImage( buffer, vImg[i] );
+	}
+
+	cvWaitKey();
+
+	for(unsigned int i = 0; i<vImg.size();++i) {
+		sprintf_s(buffer,"%d",i);
+		cvDestroyWindow(buffer);
+	}
+#endif
+
+
+}
+
+/////////////////////// Patch arena /////////////////////////////
+
+// Header of a patch store file
+struct PatchStoreHeader {
+	char magic[8];
+	int width;
+	int height;
+	int channels;
+	unsigned int num_cp;
+	unsigned int num;
+	// offsets of patch data, top left corners, center points
+	long long data;
+	long long roi;
+	long long center;
+};
+
+static const char storeMagic[8] = {'C','R','P','A','T','C','H','1'};
+// patch data starts at page boundary
+static const long long storeData = 4096;
+// number of patches buffered before writing
+static const unsigned int storeBuffer = 256;
+
+PatchArena::PatchArena(const PatchArena& a) : data(0), num(0), capacity(0), fstore(0), num_written(0), maddr(0), mlength(0) {
+	*this = a;
+}
+
+PatchArena& PatchArena::operator=(const PatchArena& a) {
+	if(this!=&a) {
+		init(a.width, a.height, a.channels, a.num_cp);
+		reserve(a.num);
+		if(a.num>0)
+			memcpy(data, a.data, (size_t)a.num*stride);
+		num = a.num;
+		vRoi = a.vRoi;
+		vCenter = a.vCenter;
+	}
+	return *this;
+}
+
+void PatchArena::release() {
+	if(fstore!=0)
+		closeStore();
+	if(maddr!=0)
+		munmap(maddr, mlength);
+	else
+		free(data);
+	data = 0;
+	maddr = 0;
+	mlength = 0;
+}
+
+void PatchArena::init(int w, int h, int c, int cp) {
+	release();
+	num = 0;
+	capacity = 0;
+	vRoi.clear();
+	vCenter.clear();
+
+	width = w;
+	height = h;
+	channels = c;
+	stride = w*h*c;
+	num_cp = cp;
+}
+
+void PatchArena::reserve(unsigned int n) {
+	// patch data of store is written in blocks
+	if(fstore!=0) {
+		vRoi.reserve(n);
+		vCenter.reserve((size_t)n*num_cp);
+		return;
+	}
+
+	if(n<=capacity) return;
+
+	if(maddr!=0) {
+		std::cerr << "Patch store is read only" << std::endl;
+		exit(-1);
+	}
+
+	// grow geometrically; buffer is aligned to cache lines
+	if(n<2*capacity) n = 2*capacity;
+	void* ptr = 0;
+	if(posix_memalign(&ptr, 64, (size_t)n*stride)!=0) {
+		std::cerr << "Could not allocate memory for " << n << " patches" << std::endl;
+		exit(-1);
+	}
+	if(num>0)
+		memcpy(ptr, data, (size_t)num*stride);
+	free(data);
+	data = (uchar*)ptr;
+	capacity = n;
+
+	vRoi.reserve(n);
+	vCenter.reserve((size_t)n*num_cp);
+}
+
+uchar* PatchArena::push_back(const CvPoint& roi, const CvPoint* center) {
+	if(fstore!=0) {
+		// write buffered patches
+		if(num-num_written==capacity && !flushStore())
+			exit(-1);
+	} else {
+		reserve(num+1);
+	}
+
+	vRoi.push_back(roi);
+	for(unsigned int c=0; c<num_cp; ++c)
+		vCenter.push_back(center[c]);
+
+	return data + (size_t)(num++ - num_written)*stride;
+}
+
+bool PatchArena::createStore(const char* filename) {
+	if(data!=0 || maddr!=0) {
+		std::cerr << "Patch store must be created before adding patches: " << filename << std::endl;
+		return false;
+	}
+
+	fstore = fopen(filename, "wb");
+	if(fstore==0) {
+		std::cerr << "Could not create patch store: " << filename << std::endl;
+		return false;
+	}
+	// header is written when store is closed
+	fseek(fstore, storeData, SEEK_SET);
+
+	num_written = num;
+	capacity = storeBuffer;
+	data = (uchar*)malloc((size_t)capacity*stride);
+	return true;
+}
+
+bool PatchArena::flushStore() {
+	size_t n = num-num_written;
+	if(n>0 && fwrite(data, stride, n, fstore)!=n) {
+		std::cerr << "Could not write patch store" << std::endl;
+		return false;
+	}
+	num_written = num;
+	return true;
+}
+
+bool PatchArena::closeStore() {
+	if(fstore==0)
+		return false;
+
+	bool done = flushStore();
+
+	PatchStoreHeader header;
+	memcpy(header.magic, storeMagic, sizeof(storeMagic));
+	header.width = width;
+	header.height = height;
+	header.channels = channels;
+	header.num_cp = num_cp;
+	header.num = num;
+	header.data = storeData;
+	header.roi = storeData + (long long)num*stride;
+	header.center = header.roi + (long long)num*sizeof(CvPoint);
+
+	if(num>0)
+		done = done && fwrite(&vRoi[0], sizeof(CvPoint), num, fstore)==num;
+	if(vCenter.size()>0)
+		done = done && fwrite(&vCenter[0], sizeof(CvPoint), vCenter.size(), fstore)==vCenter.size();
+	// a store without patches still has the size of the header block
+	done = done && fflush(fstore)==0 && ftruncate(fileno(fstore), header.center + (long long)vCenter.size()*sizeof(CvPoint))==0;
+	fseek(fstore, 0, SEEK_SET);
+	done = done && fwrite(&header, sizeof(header), 1, fstore)==1;
+	done = (fclose(fstore)==0) && done;
+	fstore = 0;
+
+	if(!done)
+		std::cerr << "Could not write patch store" << std::endl;
+
+	// patch data is only available after mapping the store
+	free(data);
+	data = 0;
+	num = 0;
+	num_written = 0;
+	capacity = 0;
+	vRoi.clear();
+	vCenter.clear();
+
+	return done;
+}
+
+bool PatchArena::mapStore(const char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if(fd<0)
+		return false;
+
+	struct stat st;
+	void* addr = MAP_FAILED;
+	if(fstat(fd, &st)==0 && st.st_size>=storeData)
+		addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(addr==MAP_FAILED) {
+		std::cerr << "Could not map patch store: " << filename << std::endl;
+		return false;
+	}
+
+	const PatchStoreHeader* header = (const PatchStoreHeader*)addr;
+	int hstride = header->width*header->height*header->channels;
+	if(memcmp(header->magic, storeMagic, sizeof(storeMagic))!=0 || 
+		header->roi != header->data + (long long)header->num*hstride ||
+		header->center + (long long)header->num*header->num_cp*(long long)sizeof(CvPoint) != (long long)st.st_size) {
+		std::cerr << "Invalid patch store: " << filename << std::endl;
+		munmap(addr, st.st_size);
+		return false;
+	}
+
+	init(header->width, header->height, header->channels, header->num_cp);
+	maddr = addr;
+	mlength = st.st_size;
+	num = header->num;
+	capacity = num;
+	data = (uchar*)addr + header->data;
+
+	const CvPoint* ptRoi = (const CvPoint*)((const char*)addr + header->roi);
+	vRoi.assign(ptRoi, ptRoi + num);
+	const CvPoint* ptCenter = (const CvPoint*)((const char*)addr + header->center);
+	vCenter.assign(ptCenter, ptCenter + (size_t)num*num_cp);
+
+	return true;
+}
+
+/////////////////////// Patch store /////////////////////////////
+
+string CRPatch::storeFile(const string& path, int label) {
+	char buffer[20];
+	sprintf(buffer, "/patches%d.bin", label);
+	return path + buffer;
+}
+
+bool CRPatch::closeStore() {
+	bool done = true;
+	for(unsigned int l=0; l<vLPatches.size(); ++l) {
+		// label without patches: empty store such that all labels can be mapped
+		if(!storepath.empty() && !vLPatches[l].isStoring() && vLPatches[l].size()==0) {
+			vLPatches[l].init(width, height, 0, 0);
+			if(!vLPatches[l].createStore(storeFile(storepath, l).c_str())) {
+				done = false;
+				continue;
+			}
+		}
+		done = vLPatches[l].closeStore() && done;
+	}
+	storepath.clear();
+	return done;
+}
+
+bool CRPatch::mapStore(const string& path) {
+	for(unsigned int l=0; l<vLPatches.size(); ++l) {
+		bool mapped = vLPatches[l].mapStore(storeFile(path, l).c_str());
+		if(mapped && (vLPatches[l].GetWidth()!=width || vLPatches[l].GetHeight()!=height)) {
+			cerr << "Patch size of patch store does not match: " << path << endl;
+			mapped = false;
+		}
+
+		// all or no labels are mapped
+		if(!mapped) {
+			for(unsigned int k=0; k<=l; ++k)
+				vLPatches[k] = PatchArena();
+			return false;
+		}
+	}
+	return true;
+}
+
+// Orientation of gradients scaled to [0 80*pi]
+void CRPatch::gradientOrientation(IplImage* I_x, IplImage* I_y, IplImage* dst) {
+	  short* dataX;
+	  short* dataY;
+	  uchar* dataZ;
+	  int stepX, stepY, stepZ;
+	  CvSize size;
+	  int x, y;
+
+	  cvGetRawData( I_x, (uchar**)&dataX, &stepX, &size);
+	  cvGetRawData( I_y, (uchar**)&dataY, &stepY);
+	  cvGetRawData( dst, (uchar**)&dataZ, &stepZ);
+	  stepX /= sizeof(dataX[0]);
+	  stepY /= sizeof(dataY[0]);
+	  stepZ /= sizeof(dataZ[0]);
+	  
+	  // Orientation of gradients
+	  for( y = 0; y < size.height; y++, dataX += stepX, dataY += stepY, dataZ += stepZ  )
+	    for( x = 0; x < size.width; x++ ) {
+	      // Avoid division by zero
+	      float tx = (float)dataX[x] + (float)_copysign(0.000001f, (float)dataX[x]);
+	      // Scaling [-pi/2 pi/2] -> [0 80*pi]
+	      dataZ[x]=uchar( ( atan((float)dataY[x]/tx)+3.14159265f/2.0f ) * 80 ); 
+	    }
+}
+
+// Magnitude of gradients
+void CRPatch::gradientMagnitude(IplImage* I_x, IplImage* I_y, IplImage* dst) {
+	  short* dataX;
+	  short* dataY;
+	  uchar* dataZ;
+	  int stepX, stepY, stepZ;
+	  CvSize size;
+	  int x, y;
+	  
+	  cvGetRawData( I_x, (uchar**)&dataX, &stepX, &size);
+	  cvGetRawData( I_y, (uchar**)&dataY, &stepY);
+	  cvGetRawData( dst, (uchar**)&dataZ, &stepZ);
+	  stepX /= sizeof(dataX[0]);
+	  stepY /= sizeof(dataY[0]);
+	  stepZ /= sizeof(dataZ[0]);
+	  
+	  // Magnitude of gradients
+	  for( y = 0; y < size.height; y++, dataX += stepX, dataY += stepY, dataZ += stepZ  )
+	    for( x = 0; x < size.width; x++ ) {
+	      dataZ[x] = (uchar)( sqrt((float)dataX[x]*(float)dataX[x] + (float)dataY[x]*(float)dataY[x]) );
+	    }
+}
+
+/////////////////////// Min/max filter /////////////////////////////
+
+void CRPatch::maxfilt(IplImage *src, unsigned int width) {
+
+	uchar* s_data;
+	int step;
+	CvSize size;
+
+	cvGetRawData( src, (uchar**)&s_data, &step, &size );
+	step /= sizeof(s_data[0]);
+
+	for(int  y = 0; y < size.height; y++) {
+		maxfilt(s_data+y*step, 1, size.width, width);
+	}
+
+	cvGetRawData( src, (uchar**)&s_data);
+
+	for(int  x = 0; x < size.width; x++)
+		maxfilt(s_data+x, step, size.height, width);
+
+}
+
+void CRPatch::maxfilt(IplImage *src, IplImage *dst, unsigned int width) {
+
+	uchar* s_data;
+	uchar* d_data;
+	int step;
+	CvSize size;
+
+	cvGetRawData( src, (uchar**)&s_data, &step, &size );
+	cvGetRawData( dst, (uchar**)&d_data, &step, &size );
+	step /= sizeof(s_data[0]);
+
+	for(int  y = 0; y < size.height; y++)
+		maxfilt(s_data+y*step, d_data+y*step, 1, size.width, width);
+
+	cvGetRawData( src, (uchar**)&d_data);
+
+	for(int  x = 0; x < size.width; x++)
+		maxfilt(d_data+x, step, size.height, width);
+
+}
+
+void CRPatch::minfilt(IplImage *src, unsigned int width) {
+
+	uchar* s_data;
+	int step;
+	CvSize size;
+
+	cvGetRawData( src, (uchar**)&s_data, &step, &size );
+	step /= sizeof(s_data[0]);
+
+	for(int  y = 0; y < size.height; y++)
+		minfilt(s_data+y*step, 1, size.width, width);
+
+	cvGetRawData( src, (uchar**)&s_data);
+
+	for(int  x = 0; x < size.width; x++)
+		minfilt(s_data+x, step, size.height, width);
+
+}
+
+void CRPatch::minfilt(IplImage *src, IplImage *dst, unsigned int width) {
+
+	uchar* s_data;
+	uchar* d_data;
+	int step;
+	CvSize size;
+
+	cvGetRawData( src, (uchar**)&s_data, &step, &size );
+	cvGetRawData( dst, (uchar**)&d_data, &step, &size );
+	step /= sizeof(s_data[0]);
+
+	for(int  y = 0; y < size.height; y++)
+		minfilt(s_data+y*step, d_data+y*step, 1, size.width, width);
+
+	cvGetRawData( src, (uchar**)&d_data);
+
+	for(int  x = 0; x < size.width; x++)
+		minfilt(d_data+x, step, size.height, width);
+
+}
+
+
+void CRPatch::maxfilt(uchar* data, uchar* maxvalues, unsigned int step, unsigned int size, unsigned int width) {
+
+	unsigned int d = int((width+1)/2)*step; 
+	size *= step;
+	width *= step;
+
+	maxvalues[0] = data[0];
+	for(unsigned int i=0; i < d-step; i+=step) {
+		for(unsigned int k=i; k<d+i; k+=step) {
+			if(data[k]>maxvalues[i]) maxvalues[i] = data[k];
+		}
+		maxvalues[i+step] = maxvalues[i];
+	}
+
+	maxvalues[size-step] = data[size-step];
+	for(unsigned int i=size-step; i > size-d; i-=step) {
+		for(unsigned int k=i; k>i-d; k-=step) {
+			if(data[k]>maxvalues[i]) maxvalues[i] = data[k];
+		}
+		maxvalues[i-step] = maxvalues[i];
+	}
+
+    deque<int> maxfifo;
+    for(unsigned int i = step; i < size; i+=step) {
+		if(i >= width) {
+			maxvalues[i-d] = data[maxfifo.size()>0 ? maxfifo.front(): i-step];
+		}
+    
+		if(data[i] < data[i-step]) { 
+
+			maxfifo.push_back(i-step);
+			if(i==  width+maxfifo.front()) 
+				maxfifo.pop_front();
+
+		} else {
+
+			while(maxfifo.size() > 0) {
+				if(data[i] <= data[maxfifo.back()]) {
+					if(i==  width+maxfifo.front()) 
+						maxfifo.pop_front();
+				break;
+				}
+				maxfifo.pop_back();
+			}
+
+		}
+
+    }  
+
+    maxvalues[size-d] = data[maxfifo.size()>0 ? maxfifo.front():size-step];
+ 
+}
+
+void CRPatch::maxfilt(uchar* data, unsigned int step, unsigned int size, unsigned int width) {
+
+	unsigned int d = int((width+1)/2)*step; 
+	size *= step;
+	width *= step;
+
+	deque<uchar> tmp;
+
+	tmp.push_back(data[0]);
+	for(unsigned int k=step; k<d; k+=step) {
+		if(data[k]>tmp.back()) tmp.back() = data[k];
+	}
+
+	for(unsigned int i=step; i < d-step; i+=step) {
+		tmp.push_back(tmp.back());
+		if(data[i+d-step]>tmp.back()) tmp.back() = data[i+d-step];
+	}
+
+
+    deque<int> minfifo;
+    for(unsigned int i = step; i < size; i+=step) {
+		if(i >= width) {
+			tmp.push_back(data[minfifo.size()>0 ? minfifo.front(): i-step]);
+			data[i-width] = tmp.front();
+			tmp.pop_front();
+		}
+    
+		if(data[i] < data[i-step]) { 
+
+			minfifo.push_back(i-step);
+			if(i==  width+minfifo.front()) 
+				minfifo.pop_front();
+
+		} else {
+
+			while(minfifo.size() > 0) {
+				if(data[i] <= data[minfifo.back()]) {
+					if(i==  width+minfifo.front()) 
+						minfifo.pop_front();
+				break;
+				}
+				minfifo.pop_back();
+			}
+
+		}
+
+    }  
+
+	tmp.push_back(data[minfifo.size()>0 ? minfifo.front():size-step]);
+	
+	for(unsigned int k=size-step-step; k>=size-d; k-=step) {
+		if(data[k]>data[size-step]) data[size-step] = data[k];
+	}
+
+	for(unsigned int i=size-step-step; i >= size-d; i-=step) {
+		data[i] = data[i+step];
+		if(data[i-d+step]>data[i]) data[i] = data[i-d+step];
+	}
+
+	for(unsigned int i=size-width; i<=size-d; i+=step) {
+		data[i] = tmp.front();
+		tmp.pop_front();
+	}
+ 
+}
+
+void CRPatch::minfilt(uchar* data, uchar* minvalues, unsigned int step, unsigned int size, unsigned int width) {
+
+	unsigned int d = int((width+1)/2)*step; 
+	size *= step;
+	width *= step;
+
+	minvalues[0] = data[0];
+	for(unsigned int i=0; i < d-step; i+=step) {
+		for(unsigned int k=i; k<d+i; k+=step) {
+			if(data[k]<minvalues[i]) minvalues[i] = data[k];
+		}
+		minvalues[i+step] = minvalues[i];
+	}
+
+	minvalues[size-step] = data[size-step];
+	for(unsigned int i=size-step; i > size-d; i-=step) {
+		for(unsigned int k=i; k>i-d; k-=step) {
+			if(data[k]<minvalues[i]) minvalues[i] = data[k];
+		}
+		minvalues[i-step] = minvalues[i];
+	}
+
+    deque<int> minfifo;
+    for(unsigned int i = step; i < size; i+=step) {
+		if(i >= width) {
+			minvalues[i-d] = data[minfifo.size()>0 ? minfifo.front(): i-step];
+		}
+    
+		if(data[i] > data[i-step]) { 
+
+			minfifo.push_back(i-step);
+			if(i==  width+minfifo.front()) 
+				minfifo.pop_front();
+
+		} else {
+
+			while(minfifo.size() > 0) {
+				if(data[i] >= data[minfifo.back()]) {
+					if(i==  width+minfifo.front()) 
+						minfifo.pop_front();
+				break;
+				}
+				minfifo.pop_back();
+			}
+
+		}
+
+    }  
+
+    minvalues[size-d] = data[minfifo.size()>0 ? minfifo.front():size-step];
+ 
+}
+
+void CRPatch::minfilt(uchar* data, unsigned int step, unsigned int size, unsigned int width) {
+
+	unsigned int d = int((width+1)/2)*step; 
+	size *= step;
+	width *= step;
+
+	deque<uchar> tmp;
+
+	tmp.push_back(data[0]);
+	for(unsigned int k=step; k<d; k+=step) {
+		if(data[k]<tmp.back()) tmp.back() = data[k];
+	}
+
+	for(unsigned int i=step; i < d-step; i+=step) {
+		tmp.push_back(tmp.back());
+		if(data[i+d-step]<tmp.back()) tmp.back() = data[i+d-step];
+	}
+
+
+    deque<int> minfifo;
+    for(unsigned int i = step; i < size; i+=step) {
+		if(i >= width) {
+			tmp.push_back(data[minfifo.size()>0 ? minfifo.front(): i-step]);
+			data[i-width] = tmp.front();
+			tmp.pop_front();
+		}
+    
+		if(data[i] > data[i-step]) { 
+
+			minfifo.push_back(i-step);
+			if(i==  width+minfifo.front()) 
+				minfifo.pop_front();
+
+		} else {
+
+			while(minfifo.size() > 0) {
+				if(data[i] >= data[minfifo.back()]) {
+					if(i==  width+minfifo.front()) 
+						minfifo.pop_front();
+				break;
+				}
+				minfifo.pop_back();
+			}
+
+		}
+
+    }  
+
+	tmp.push_back(data[minfifo.size()>0 ? minfifo.front():size-step]);
+	
+	for(unsigned int k=size-step-step; k>=size-d; k-=step) {
+		if(data[k]<data[size-step]) data[size-step] = data[k];
+	}
+
+	for(unsigned int i=size-step-step; i >= size-d; i-=step) {
+		data[i] = data[i+step];
+		if(data[i-d+step]<data[i]) data[i] = data[i-d+step];
+	}
+ 
+	for(unsigned int i=size-width; i<=size-d; i+=step) {
+		data[i] = tmp.front();
+		tmp.pop_front();
+	}
+}
+
+void CRPatch::maxminfilt(uchar* data, uchar* maxvalues, uchar* minvalues, unsigned int step, unsigned int size, unsigned int width) {
+
+	unsigned int d = int((width+1)/2)*step; 
+	size *= step;
+	width *= step;
+
+	maxvalues[0] = data[0];
+	minvalues[0] = data[0];
+	for(unsigned int i=0; i < d-step; i+=step) {
+		for(unsigned int k=i; k<d+i; k+=step) {
+			if(data[k]>maxvalues[i]) maxvalues[i] = data[k];
+			if(data[k]<minvalues[i]) minvalues[i] = data[k];
+		}
+		maxvalues[i+step] = maxvalues[i];
+		minvalues[i+step] = minvalues[i];
+	}
+
+	maxvalues[size-step] = data[size-step];
+	minvalues[size-step] = data[size-step];
+	for(unsigned int i=size-step; i > size-d; i-=step) {
+		for(unsigned int k=i; k>i-d; k-=step) {
+			if(data[k]>maxvalues[i]) maxvalues[i] = data[k];
+			if(data[k]<minvalues[i]) minvalues[i] = data[k];
+		}
+		maxvalues[i-step] = maxvalues[i];
+		minvalues[i-step] = minvalues[i];
+	}
+
+    deque<int> maxfifo, minfifo;
+
+    for(unsigned int i = step; i < size; i+=step) {
+		if(i >= width) {
+			maxvalues[i-d] = data[maxfifo.size()>0 ? maxfifo.front(): i-step];
+			minvalues[i-d] = data[minfifo.size()>0 ? minfifo.front(): i-step];
+		}
+    
+		if(data[i] > data[i-step]) { 
+
+			minfifo.push_back(i-step);
+			if(i==  width+minfifo.front()) 
+				minfifo.pop_front();
+			while(maxfifo.size() > 0) {
+				if(data[i] <= data[maxfifo.back()]) {
+					if (i==  width+maxfifo.front()) 
+						maxfifo.pop_front();
+					break;
+				}
+				maxfifo.pop_back();
+			}
+
+		} else {
+
+			maxfifo.push_back(i-step);
+			if (i==  width+maxfifo.front()) 
+				maxfifo.pop_front();
+			while(minfifo.size() > 0) {
+				if(data[i] >= data[minfifo.back()]) {
+					if(i==  width+minfifo.front()) 
+						minfifo.pop_front();
+				break;
+				}
+				minfifo.pop_back();
+			}
+
+		}
+
+    }  
+
+    maxvalues[size-d] = data[maxfifo.size()>0 ? maxfifo.front():size-step];
+	minvalues[size-d] = data[minfifo.size()>0 ? minfifo.front():size-step];
+ 
+}
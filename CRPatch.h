@@ -1,62 +1,142 @@
-/* 
-// Author: Juergen Gall, BIWI, ETH Zurich
-// Email: gall@vision.ee.ethz.ch
-*/
-
-#pragma once
-
-#define _copysign copysign
-
-#include <cxcore.h>
-#include <cv.h>
-
-#include <vector>
-#include <iostream>
-
-#include "HoG.h"
-
-// structure for image patch
-struct PatchFeature {
-	PatchFeature() {}
-
-	CvRect roi;
-	std::vector<CvPoint> center;
-
-	std::vector<CvMat*> vPatch;
-	void print() const {
-		std::cout << roi.x << " " << roi.y << " " << roi.width << " " << roi.height;
-		for(unsigned int i=0; i<center.size(); ++i) std::cout << " " << center[i].x << " " << center[i].y; std::cout << std::endl;
-	}
-	void show(int delay) const;
-};
-
-static HoG hog; 
-
-class CRPatch {
-public:
-	CRPatch(CvRNG* pRNG, int w, int h, int num_l) : cvRNG(pRNG), width(w), height(h) { vLPatches.resize(num_l);}
-
-	// Extract patches from image
-	void extractPatches(IplImage *img, unsigned int n, int label, CvRect* box = 0, std::vector<CvPoint>* vCenter = 0);
-
-	// Extract features from image
-	static void extractFeatureChannels(IplImage *img, std::vector<IplImage*>& vImg);
-
-	// min/max filter
-	static void maxfilt(uchar* data, uchar* maxvalues, unsigned int step, unsigned int size, unsigned int width);
-	static void maxfilt(uchar* data, unsigned int step, unsigned int size, unsigned int width);
-	static void minfilt(uchar* data, uchar* minvalues, unsigned int step, unsigned int size, unsigned int width);
-	static void minfilt(uchar* data, unsigned int step, unsigned int size, unsigned int width);
-	static void maxminfilt(uchar* data, uchar* maxvalues, uchar* minvalues, unsigned int step, unsigned int size, unsigned int width);
-	static void maxfilt(IplImage *src, unsigned int width);
-	static void maxfilt(IplImage *src, IplImage *dst, unsigned int width);
-	static void minfilt(IplImage *src, unsigned int width);
-	static void minfilt(IplImage *src, IplImage *dst, unsigned int width);
-
-	std::vector<std::vector<PatchFeature> > vLPatches;
-private:
-	CvRNG *cvRNG;
-	int width;
-	int height;
-};
-
+/* 
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#define _copysign copysign
+
+#include <cxcore.h>
+#include <cv.h>
+
+#include <vector>
+#include <iostream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+
+#include "HoG.h"
+
+// Patches of one label stored in one aligned buffer 
+// layout: patch x channel x row x col
+// top left corners and center points as arrays
+class PatchArena {
+public:
+	PatchArena() : data(0), num(0), capacity(0), width(0), height(0), channels(0), stride(0), num_cp(0), fstore(0), num_written(0), maddr(0), mlength(0) {}
+	PatchArena(const PatchArena& a);
+	PatchArena& operator=(const PatchArena& a);
+	~PatchArena() {release();}
+
+	// Set patch size, number of channels and center points
+	void init(int w, int h, int c, int cp);
+	void reserve(unsigned int n);
+	// Append patch with top left corner roi and center points (num_cp), returns channel data of patch
+	uchar* push_back(const CvPoint& roi, const CvPoint* center);
+
+	// Patch store on disk
+	// header | patch data (page aligned) | top left corners | center points
+	// Stream all patches appended by push_back to file (patch data cannot be accessed)
+	bool createStore(const char* filename);
+	bool closeStore();
+	// Map patch store read only
+	bool mapStore(const char* filename);
+	bool isMapped() const {return maddr!=0;}
+	bool isStoring() const {return fstore!=0;}
+
+	// Get functions
+	unsigned int size() const {return num;}
+	int GetWidth() const {return width;}
+	int GetHeight() const {return height;}
+	int GetChannels() const {return channels;}
+	unsigned int GetNumCenter() const {return num_cp;}
+	// Channel c of patch i (height x width)
+	const uchar* channel(unsigned int i, unsigned int c) const {return data + (size_t)i*stride + c*width*height;}
+	// Top left corner of patch i
+	const CvPoint& roi(unsigned int i) const {return vRoi[i];}
+	// Center points of patch i
+	const CvPoint* center(unsigned int i) const {return &vCenter[(size_t)i*num_cp];}
+
+private:
+	void release();
+	bool flushStore();
+
+	uchar* data;
+	unsigned int num;
+	unsigned int capacity;
+
+	int width;
+	int height;
+	int channels;
+	// bytes per patch
+	int stride;
+
+	unsigned int num_cp;
+
+	std::vector<CvPoint> vRoi;
+	std::vector<CvPoint> vCenter;
+
+	// patch store that is written: data is a buffer for the patches not written yet
+	FILE* fstore;
+	unsigned int num_written;
+
+	// mapped patch store
+	void* maddr;
+	size_t mlength;
+};
+
+static HoG hog; 
+
+class CRPatch {
+public:
+	CRPatch(CvRNG* pRNG, int w, int h, int num_l) : cvRNG(pRNG), width(w), height(h) { vLPatches.resize(num_l);}
+
+	// Stream extracted patches to a patch store in directory path (one file per label)
+	void SetStore(const std::string& path) {storepath = path;}
+	bool closeStore();
+	// Map patches from a patch store
+	bool mapStore(const std::string& path);
+	static std::string storeFile(const std::string& path, int label);
+
+	// Extract patches from image
+	void extractPatches(IplImage *img, unsigned int n, int label, CvRect* box = 0, std::vector<CvPoint>* vCenter = 0);
+	// Append patches of another patch set with the same patch size
+	void addPatches(const CRPatch& Other);
+	// Checksum of the patches of all labels (number, top left corners, and center points); 
+	// identifies the training data for checkpoints
+	unsigned long long checksum() const;
+
+	// Independent random generator number index derived from master (splitmix64)
+	static CvRNG streamSeed(CvRNG master, unsigned int index);
+
+	// Extract features from image
+	static void extractFeatureChannels(IplImage *img, std::vector<IplImage*>& vImg);
+
+	// Orientation and magnitude of gradients I_x, I_y (16 bit) 
+	static void gradientOrientation(IplImage* I_x, IplImage* I_y, IplImage* dst);
+	static void gradientMagnitude(IplImage* I_x, IplImage* I_y, IplImage* dst);
+
+	// min/max filter
+	static void maxfilt(uchar* data, uchar* maxvalues, unsigned int step, unsigned int size, unsigned int width);
+	static void maxfilt(uchar* data, unsigned int step, unsigned int size, unsigned int width);
+	static void minfilt(uchar* data, uchar* minvalues, unsigned int step, unsigned int size, unsigned int width);
+	static void minfilt(uchar* data, unsigned int step, unsigned int size, unsigned int width);
+	static void maxminfilt(uchar* data, uchar* maxvalues, uchar* minvalues, unsigned int step, unsigned int size, unsigned int width);
+	static void maxfilt(IplImage *src, unsigned int width);
+	static void maxfilt(IplImage *src, IplImage *dst, unsigned int width);
+	static void minfilt(IplImage *src, unsigned int width);
+	static void minfilt(IplImage *src, IplImage *dst, unsigned int width);
+
+	std::vector<PatchArena> vLPatches;
+private:
+	// Init patches of label when the first patch is added
+	void initLabel(int label, int channels, int cp);
+
+	CvRNG *cvRNG;
+	int width;
+	int height;
+
+	// patch store for extracted patches (empty: memory)
+	std::string storepath;
+};
+
@@ -0,0 +1,129 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRProfile.h"
+
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+using namespace std;
+
+__thread double CRProfile::vTime[NUM_STAGES];
+__thread unsigned long long CRProfile::vCount[NUM_COUNTERS];
+
+static const char* stageNames[NUM_STAGES] = {"resize", "features", "traversal", "voting", "smoothing", "write"};
+static const char* counterNames[NUM_COUNTERS] = {"patches", "traversals", "nodes", "votes", "votes_out", "leafs_skipped"};
+
+// Hardware counters of the detecting thread (user space only)
+static const int num_hw = 4;
+static const char* hwNames[num_hw] = {"cycles", "instructions", "cache_misses", "branch_misses"};
+static const unsigned long long hwConfig[num_hw] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+static int hwFd[num_hw] = {-1, -1, -1, -1};
+
+static ofstream report;
+static __thread double imageStart;
+static string imageName;
+
+double CRProfile::now() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + 1e-9*ts.tv_nsec;
+}
+
+void CRProfile::open(const char* filename) {
+	report.open(filename);
+	if(!report.is_open())
+		cerr << "Could not write profile: " << filename << endl;
+	report.precision(9);
+
+	// counters are optional, e.g., not available in virtual machines or with perf_event_paranoid>2
+	for(int i=0; i<num_hw; ++i) {
+		struct perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = hwConfig[i];
+		attr.disabled = 1;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		hwFd[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	}
+	if(hwFd[0]<0)
+		cout << "Hardware counters are not available" << endl;
+}
+
+void CRProfile::begin(const char* image) {
+	memset(vTime, 0, sizeof(vTime));
+	memset(vCount, 0, sizeof(vCount));
+	imageName = image;
+
+	for(int i=0; i<num_hw; ++i) {
+		if(hwFd[i]>=0) {
+			ioctl(hwFd[i], PERF_EVENT_IOC_RESET, 0);
+			ioctl(hwFd[i], PERF_EVENT_IOC_ENABLE, 0);
+		}
+	}
+	imageStart = now();
+}
+
+void CRProfile::end() {
+	double total = now() - imageStart;
+
+	unsigned long long hw[num_hw];
+	for(int i=0; i<num_hw; ++i) {
+		if(hwFd[i]>=0) {
+			ioctl(hwFd[i], PERF_EVENT_IOC_DISABLE, 0);
+			if(read(hwFd[i], &hw[i], sizeof(hw[i]))!=sizeof(hw[i]))
+				hw[i] = 0;
+		}
+	}
+
+	if(!report.is_open())
+		return;
+
+	string name;
+	for(unsigned int i=0; i<imageName.size(); ++i) {
+		if(imageName[i]=='"' || imageName[i]=='\\')
+			name += '\\';
+		name += imageName[i];
+	}
+
+	report << "{\"image\": \"" << name << "\", \"time_s\": {\"total\": " << total;
+	for(int s=0; s<NUM_STAGES; ++s)
+		report << ", \"" << stageNames[s] << "\": " << vTime[s];
+	report << "}, \"counters\": {";
+	for(int c=0; c<NUM_COUNTERS; ++c)
+		report << (c>0 ? ", " : "") << "\"" << counterNames[c] << "\": " << vCount[c];
+	report << ", \"avg_depth\": " << (vCount[COUNT_TRAVERSALS]>0 ? double(vCount[COUNT_NODES])/vCount[COUNT_TRAVERSALS] : 0.0) << "}";
+	if(hwFd[0]>=0) {
+		report << ", \"hardware\": {";
+		bool first = true;
+		for(int i=0; i<num_hw; ++i) {
+			if(hwFd[i]>=0) {
+				report << (first ? "" : ", ") << "\"" << hwNames[i] << "\": " << hw[i];
+				first = false;
+			}
+		}
+		report << "}";
+	}
+	report << "}" << endl;
+}
+
+void CRProfile::close() {
+	report.close();
+	for(int i=0; i<num_hw; ++i) {
+		if(hwFd[i]>=0)
+			::close(hwFd[i]);
+		hwFd[i] = -1;
+	}
+}
@@ -0,0 +1,59 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+// Instrumentation of the detector (compile with -DCR_PROFILE, i.e., make PROFILE=1)
+// Wall time per stage and counters are recorded per thread and written as one line of
+// JSON per image; without CR_PROFILE the macros are empty
+
+// Stages of detection
+enum CRStage {STAGE_RESIZE, STAGE_FEATURES, STAGE_TRAVERSAL, STAGE_VOTING, STAGE_SMOOTHING, STAGE_WRITE, NUM_STAGES};
+
+// Counters of detection
+// nodes: inner nodes visited by all traversals (average depth = nodes/traversals)
+// votes_out: votes outside of the Hough image; leafs_skipped: leafs without votes or weight
+enum CRCounter {COUNT_PATCHES, COUNT_TRAVERSALS, COUNT_NODES, COUNT_VOTES, COUNT_VOTES_OUT, COUNT_LEAFS_SKIPPED, NUM_COUNTERS};
+
+class CRProfile {
+public:
+	// Wall time in seconds (monotonic clock)
+	static double now();
+
+	// Open report file (truncated) and hardware counters if available
+	static void open(const char* filename);
+	// Start record of image
+	static void begin(const char* image);
+	// Append record of image to report
+	static void end();
+	// Close report file and hardware counters
+	static void close();
+
+	static void addTime(int stage, double t) {vTime[stage] += t;}
+	static void count(int counter, unsigned long long n) {vCount[counter] += n;}
+
+private:
+	static __thread double vTime[NUM_STAGES];
+	static __thread unsigned long long vCount[NUM_COUNTERS];
+};
+
+#ifdef CR_PROFILE
+#define CR_PROFILE_OPEN(filename) CRProfile::open(filename)
+#define CR_PROFILE_BEGIN(image) CRProfile::begin(image)
+#define CR_PROFILE_END() CRProfile::end()
+#define CR_PROFILE_CLOSE() CRProfile::close()
+// Time of stage from CR_PROFILE_START(t) to CR_PROFILE_STOP(stage, t)
+#define CR_PROFILE_START(t) double t = CRProfile::now()
+#define CR_PROFILE_STOP(stage, t) CRProfile::addTime(stage, CRProfile::now() - t)
+#define CR_PROFILE_COUNT(counter, n) CRProfile::count(counter, n)
+#else
+#define CR_PROFILE_OPEN(filename)
+#define CR_PROFILE_BEGIN(image)
+#define CR_PROFILE_END()
+#define CR_PROFILE_CLOSE()
+#define CR_PROFILE_START(t)
+#define CR_PROFILE_STOP(stage, t)
+#define CR_PROFILE_COUNT(counter, n)
+#endif
@@ -0,0 +1,240 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRReference.h"
+
+#include <cmath>
+#include <algorithm>
+
+using namespace std;
+
+const FlatLeaf* CRReference::regression(const CRTree& tree, uchar** ptFCh, int stepImg) {
+	int node = 0;
+	const int* pnode = &tree.treetable[0];
+	while(pnode[0]==-1) {
+		// test on channel pnode[5]: p1 - p2 >= t -> right child
+		const uchar* ptC = ptFCh[pnode[5]];
+		int p1 = ptC[pnode[1] + pnode[2]*stepImg];
+		int p2 = ptC[pnode[3] + pnode[4]*stepImg];
+		node = 2*node + 1 + (p1 - p2 >= pnode[6] ? 1 : 0);
+		pnode = &tree.treetable[node*7];
+	}
+	return &tree.flatleaf[pnode[0]];
+}
+
+void CRReference::extractFeatureChannels(IplImage* img, vector<IplImage*>& vImg) {
+	vImg.resize(32);
+	for(unsigned int c=0; c<vImg.size(); ++c)
+		vImg[c] = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_8U , 1);
+
+	// intensity
+	cvCvtColor( img, vImg[0], CV_RGB2GRAY );
+
+	// |I_x|, |I_y|, orientation, magnitude
+	IplImage* I_x = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_16S, 1);
+	IplImage* I_y = cvCreateImage(cvSize(img->width,img->height), IPL_DEPTH_16S, 1);
+	cvSobel(vImg[0],I_x,1,0,3);
+	cvSobel(vImg[0],I_y,0,1,3);
+	cvConvertScaleAbs( I_x, vImg[3], 0.25);
+	cvConvertScaleAbs( I_y, vImg[4], 0.25);
+	gradientOrientation(I_x, I_y, vImg[1]);
+	gradientMagnitude(I_x, I_y, vImg[2]);
+
+	// orientation histograms
+	extractOBin(vImg[1], vImg[2], vImg, 7);
+
+	// |I_xx|, |I_yy|
+	cvSobel(vImg[0],I_x,2,0,3);
+	cvConvertScaleAbs( I_x, vImg[5], 0.25);
+	cvSobel(vImg[0],I_y,0,2,3);
+	cvConvertScaleAbs( I_y, vImg[6], 0.25);
+	cvReleaseImage(&I_x);
+	cvReleaseImage(&I_y);
+
+	// L, a, b
+	cvCvtColor( img, img, CV_RGB2Lab  );
+	cvSplit( img, vImg[0], vImg[1], vImg[2], 0);
+
+	// min filter, max filter
+	for(int c=0; c<16; ++c)
+		minfilt(vImg[c], vImg[c+16], 5);
+	for(int c=0; c<16; ++c)
+		maxfilt(vImg[c], 5);
+}
+
+void CRReference::gradientOrientation(const IplImage* I_x, const IplImage* I_y, IplImage* dst) {
+	for(int y=0; y<I_x->height; ++y) {
+		const short* dataX = (const short*)(I_x->imageData + y*I_x->widthStep);
+		const short* dataY = (const short*)(I_y->imageData + y*I_y->widthStep);
+		uchar* dataZ = (uchar*)(dst->imageData + y*dst->widthStep);
+		for(int x=0; x<I_x->width; ++x) {
+			float tx = (float)dataX[x] + (float)_copysign(0.000001f, (float)dataX[x]);
+			dataZ[x] = uchar( ( atan((float)dataY[x]/tx)+3.14159265f/2.0f ) * 80 );
+		}
+	}
+}
+
+void CRReference::gradientMagnitude(const IplImage* I_x, const IplImage* I_y, IplImage* dst) {
+	for(int y=0; y<I_x->height; ++y) {
+		const short* dataX = (const short*)(I_x->imageData + y*I_x->widthStep);
+		const short* dataY = (const short*)(I_y->imageData + y*I_y->widthStep);
+		uchar* dataZ = (uchar*)(dst->imageData + y*dst->widthStep);
+		for(int x=0; x<I_x->width; ++x)
+			dataZ[x] = (uchar)( sqrt((float)dataX[x]*(float)dataX[x] + (float)dataY[x]*(float)dataY[x]) );
+	}
+}
+
+// Maximum (max=true) or minimum of the width neighbourhood in a row (dx=1) or column (dy=1) clipped at the border
+static void filt1D(const IplImage* src, IplImage* dst, int width, int dx, int dy, bool max) {
+	int r = width/2;
+	for(int y=0; y<src->height; ++y) {
+		uchar* ptD = (uchar*)(dst->imageData + y*dst->widthStep);
+		for(int x=0; x<src->width; ++x) {
+			uchar v = max ? 0 : 255;
+			for(int k=-r; k<=r; ++k) {
+				int xx = x + k*dx;
+				int yy = y + k*dy;
+				if(xx<0 || yy<0 || xx>=src->width || yy>=src->height)
+					continue;
+				uchar s = ((const uchar*)(src->imageData + yy*src->widthStep))[xx];
+				v = max ? std::max(v, s) : std::min(v, s);
+			}
+			ptD[x] = v;
+		}
+	}
+}
+
+void CRReference::maxfilt(IplImage* src, int width) {
+	IplImage* tmp = cvCreateImage(cvSize(src->width,src->height), IPL_DEPTH_8U, 1);
+	filt1D(src, tmp, width, 1, 0, true);
+	filt1D(tmp, src, width, 0, 1, true);
+	cvReleaseImage(&tmp);
+}
+
+void CRReference::minfilt(IplImage* src, int width) {
+	IplImage* tmp = cvCreateImage(cvSize(src->width,src->height), IPL_DEPTH_8U, 1);
+	filt1D(src, tmp, width, 1, 0, false);
+	filt1D(tmp, src, width, 0, 1, false);
+	cvReleaseImage(&tmp);
+}
+
+void CRReference::maxfilt(IplImage* src, IplImage* dst, int width) {
+	IplImage* tmp = cvCreateImage(cvSize(src->width,src->height), IPL_DEPTH_8U, 1);
+	filt1D(src, dst, width, 1, 0, true);
+	filt1D(src, tmp, width, 0, 1, true);
+	cvCopy(tmp, src);
+	cvReleaseImage(&tmp);
+}
+
+void CRReference::minfilt(IplImage* src, IplImage* dst, int width) {
+	IplImage* tmp = cvCreateImage(cvSize(src->width,src->height), IPL_DEPTH_8U, 1);
+	filt1D(src, dst, width, 1, 0, false);
+	filt1D(src, tmp, width, 0, 1, false);
+	cvCopy(tmp, src);
+	cvReleaseImage(&tmp);
+}
+
+void CRReference::extractOBin(const IplImage* Iorient, const IplImage* Imagn, vector<IplImage*>& out, int off) {
+	const int bins = 9;
+	const float binsize = (3.14159265f*80.0f)/float(bins);
+	const int g_w = 5;
+
+	// Gaussian weights (computed like HoG)
+	CvMat* Gauss = cvCreateMat( g_w, g_w, CV_32FC1 );
+	double a = -(g_w-1)/2.0;
+	double sigma2 = 2*(0.5*g_w)*(0.5*g_w);
+	double count = 0;
+	for(int x = 0; x<g_w; ++x) {
+		for(int y = 0; y<g_w; ++y) {
+			double tmp = exp(-( (a+x)*(a+x)+(a+y)*(a+y) )/sigma2);
+			count += tmp;
+			cvSet2D( Gauss, x, y, cvScalar(tmp) );
+		}
+	}
+	cvConvertScale( Gauss, Gauss, 1.0/count);
+	float weight[g_w][g_w];
+	for(int y = 0; y<g_w; ++y)
+		for(int x = 0; x<g_w; ++x)
+			weight[y][x] = (float)cvmGet( Gauss, x, y );
+	cvReleaseMat(&Gauss);
+
+	// border is 0; the histogram of the neighbourhood with top left (x,y) is stored at (x+2,y+2)
+	for(int k=off; k<bins+off; ++k)
+		cvSetZero( out[k] );
+	for(int y=0; y<Iorient->height-g_w; ++y) {
+		for(int x=0; x<Iorient->width-g_w; ++x) {
+			double desc[bins];
+			for(int l=0; l<bins; ++l)
+				desc[l] = 0;
+
+			for(int dy=0; dy<g_w; ++dy) {
+				const uchar* ptO = (const uchar*)(Iorient->imageData + (y+dy)*Iorient->widthStep) + x;
+				const uchar* ptM = (const uchar*)(Imagn->imageData + (y+dy)*Imagn->widthStep) + x;
+				for(int dx=0; dx<g_w; ++dx) {
+					// linear interpolation between the two closest bins (cyclic)
+					float v = (float)ptO[dx]/binsize;
+					float w = (float)ptM[dx] * weight[dy][dx];
+					int bin1 = int(v);
+					int bin2;
+					float delta = v-bin1-0.5f;
+					if(delta<0) {
+						bin2 = bin1 < 1 ? bins-1 : bin1-1;
+						delta = -delta;
+					} else
+						bin2 = bin1 < bins-1 ? bin1+1 : 0;
+					desc[bin1] += (1-delta)*w;
+					desc[bin2] += delta*w;
+				}
+			}
+
+			for(int l=0; l<bins; ++l)
+				((uchar*)(out[l+off]->imageData + (y+g_w/2)*out[l+off]->widthStep))[x+g_w/2] = (uchar)desc[l];
+		}
+	}
+}
+
+void CRReference::vote(const CRForest& forest, int width, int height, const vector<IplImage*>& vImg, vector<IplImage*>& imgDetect, const vector<float>& ratios) {
+	for(unsigned int c=0; c<imgDetect.size(); ++c)
+		cvSetZero( imgDetect[c] );
+
+	int stepImg = vImg[0]->widthStep;
+	vector<uchar*> ptFCh(vImg.size());
+	unsigned int num_trees = forest.vTrees.size();
+	unsigned int num_cp = forest.GetNumCenter();
+	unsigned int num_class = forest.GetNumClasses();
+	unsigned int num_ratios = ratios.size();
+
+	for(int y=0; y<vImg[0]->height-height; ++y) {
+		for(int x=0; x<vImg[0]->width-width; ++x) {
+			for(unsigned int c=0; c<vImg.size(); ++c)
+				ptFCh[c] = (uchar*)vImg[c]->imageData + y*stepImg + x;
+
+			// center of patch
+			int cx = x + width/2;
+			int cy = y + height/2;
+
+			for(unsigned int t=0; t<num_trees; ++t) {
+				// entries of the classes follow each other
+				const FlatLeaf* leaf = regression(*forest.vTrees[t], &ptFCh[0], stepImg);
+				for(unsigned int k=0; k<num_class; ++k, ++leaf) {
+					float w = leaf->pfg / float( leaf->count * num_trees );
+					const CvPoint* it = forest.vTrees[t]->GetVotes(leaf);
+					for(unsigned int i=0; i<leaf->count; ++i, it += num_cp) {
+						for(unsigned int c=0; c<num_ratios; ++c) {
+							IplImage* img = imgDetect[k*num_ratios+c];
+							int vx = int(cx - it[0].x * ratios[c] + 0.5);
+							int vy = cy - it[0].y;
+							if(vy>=0 && vy<img->height && vx>=0 && vx<img->width)
+								((float*)(img->imageData + vy*img->widthStep))[vx] += w;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	for(unsigned int c=0; c<imgDetect.size(); ++c)
+		cvSmooth( imgDetect[c], imgDetect[c], CV_GAUSSIAN, 3);
+}
@@ -0,0 +1,40 @@
+/*
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#include "CRForest.h"
+
+#include <vector>
+
+// Reference implementations of the detection kernels
+// Plain versions that define the results of the optimized functions; CRBenchmark -c compares them
+class CRReference {
+public:
+	// Leaf of tree for patch: walk through the tree table by node index (children 2n+1, 2n+2)
+	static const FlatLeaf* regression(const CRTree& tree, uchar** ptFCh, int stepImg);
+
+	// 32 feature channels like CRPatch::extractFeatureChannels (img is converted to Lab)
+	static void extractFeatureChannels(IplImage* img, std::vector<IplImage*>& vImg);
+
+	// Orientation of gradients scaled to [0 80*pi] and magnitude of gradients I_x, I_y (16 bit)
+	static void gradientOrientation(const IplImage* I_x, const IplImage* I_y, IplImage* dst);
+	static void gradientMagnitude(const IplImage* I_x, const IplImage* I_y, IplImage* dst);
+
+	// Maximum/minimum of width x width neighbourhood clipped at the image border (in place)
+	static void maxfilt(IplImage* src, int width);
+	static void minfilt(IplImage* src, int width);
+	// Like CRPatch::maxfilt/minfilt(src, dst, width), on which the features of the trained trees depend:
+	// dst is the maximum/minimum of the width neighbourhood in the row, src is replaced by the one in the column
+	static void maxfilt(IplImage* src, IplImage* dst, int width);
+	static void minfilt(IplImage* src, IplImage* dst, int width);
+
+	// 9 bin orientation histograms of 5x5 neighbourhoods weighted by magnitude and Gaussian (channels off..off+8)
+	static void extractOBin(const IplImage* Iorient, const IplImage* Imagn, std::vector<IplImage*>& out, int off);
+
+	// Hough images of forest for feature channels of an image (patch size width x height), smoothed
+	// imgDetect: the ratios for each object class of the forest
+	static void vote(const CRForest& forest, int width, int height, const std::vector<IplImage*>& vImg, std::vector<IplImage*>& imgDetect, const std::vector<float>& ratios);
+};
@@ -1,480 +1,1979 @@
-/* 
-// Author: Juergen Gall, BIWI, ETH Zurich
-// Email: gall@vision.ee.ethz.ch
-*/
-
-#include "CRTree.h"
-#include <fstream>
-#include <highgui.h>
-#include <algorithm>
-
-using namespace std;
-
-/////////////////////// Constructors /////////////////////////////
-
-// Read tree from file
-CRTree::CRTree(const char* filename) {
-	cout << "Load Tree " << filename << endl;
-
-	int dummy;
-
-	ifstream in(filename);
-	if(in.is_open()) {
-		// allocate memory for tree table
-		in >> max_depth;
-		num_nodes = (int)pow(2.0,int(max_depth+1))-1;
-		// num_nodes x 7 matrix as vector
-		treetable = new int[num_nodes * 7];
-		int* ptT = &treetable[0];
-		
-		// allocate memory for leafs
-		in >> num_leaf;
-		leaf = new LeafNode[num_leaf];
-
-		// number of center points per patch 
-		in >> num_cp;
-
-		// read tree nodes
-		for(unsigned int n=0; n<num_nodes; ++n) {
-			in >> dummy; in >> dummy;
-			for(unsigned int i=0; i<7; ++i, ++ptT) {
-				in >> *ptT;
-			}
-		}
-
-		// read tree leafs
-		LeafNode* ptLN = &leaf[0];
-		for(unsigned int l=0; l<num_leaf; ++l, ++ptLN) {
-			in >> dummy;
-			in >> ptLN->pfg;
-			
-			// number of positive patches
-			in >> dummy;
-			ptLN->vCenter.resize(dummy);
-			for(int i=0; i<dummy; ++i) {
-				ptLN->vCenter[i].resize(num_cp);
-				for(unsigned int k=0; k<num_cp; ++k) {
-					in >> ptLN->vCenter[i][k].x;
-					in >> ptLN->vCenter[i][k].y;
-				}
-			}
-		}
-
-	} else {
-		cerr << "Could not read tree: " << filename << endl;
-	}
-
-	in.close();
-
-}
-
-
-/////////////////////// IO Function /////////////////////////////
-
-bool CRTree::saveTree(const char* filename) const {
-	cout << "Save Tree " << filename << endl;
-
-	bool done = false;
-
-	ofstream out(filename);
-	if(out.is_open()) {
-
-		out << max_depth << " " << num_leaf << " " << num_cp << endl;
-
-		// save tree nodes
-		int* ptT = &treetable[0];
-		int depth = 0;
-		unsigned int step = 2;
-		for(unsigned int n=0; n<num_nodes; ++n) {
-			// get depth from node
-			if(n==step-1) {
-				++depth;
-				step *= 2;
-			}
-
-			out << n << " " << depth << " ";
-			for(unsigned int i=0; i<7; ++i, ++ptT) {
-				out << *ptT << " ";
-			}
-			out << endl;
-		}
-		out << endl;
-
-		// save tree leafs
-		LeafNode* ptLN = &leaf[0];
-		for(unsigned int l=0; l<num_leaf; ++l, ++ptLN) {
-			out << l << " " << ptLN->pfg << " " << ptLN->vCenter.size() << " ";
-			
-			for(unsigned int i=0; i<ptLN->vCenter.size(); ++i) {
-				for(unsigned int k=0; k<ptLN->vCenter[i].size(); ++k) {
-					out << ptLN->vCenter[i][k].x << " " << ptLN->vCenter[i][k].y << " ";
-				}
-			}
-			out << endl;
-		}
-
-		out.close();
-
-		done = true;
-	}
-
-
-	return done;
-}
-
-/////////////////////// Training Function /////////////////////////////
-
-// Start grow tree
-void CRTree::growTree(const CRPatch& TrData, int samples) {
-	// Get ratio positive patches/negative patches
-	int pos = 0;
-	vector<vector<const PatchFeature*> > TrainSet( TrData.vLPatches.size() );
-	for(unsigned int l=0; l<TrainSet.size(); ++l) {
-		TrainSet[l].resize(TrData.vLPatches[l].size());
-		
-		if(l>0) pos += TrainSet[l].size();
-		
-		for(unsigned int i=0; i<TrainSet[l].size(); ++i) {
-			TrainSet[l][i] = &TrData.vLPatches[l][i];
-		}
-	}
-
-	// Grow tree
-	grow(TrainSet, 0, 0, samples, pos / float(TrainSet[0].size()) );
-}
-
-// Called by growTree
-void CRTree::grow(const vector<vector<const PatchFeature*> >& TrainSet, int node, unsigned int depth, int samples, float pnratio) {
-
-	if(depth<max_depth && TrainSet[1].size()>0) {	
-
-		vector<vector<const PatchFeature*> > SetA;
-		vector<vector<const PatchFeature*> > SetB;
-		int test[6];
-
-		// Set measure mode for split: 0 - classification, 1 - regression
-		unsigned int measure_mode = 1;
-		if( float(TrainSet[0].size()) / float(TrainSet[0].size()+TrainSet[1].size()) >= 0.05 && depth < max_depth-2 )
-			measure_mode = cvRandInt( cvRNG ) % 2;
-
-		cout << "MeasureMode " << depth << " " << measure_mode << " " << TrainSet[0].size() << " " << TrainSet[1].size() << endl;
-	
-		// Find optimal test
-		if( optimizeTest(SetA, SetB, TrainSet, test, samples, measure_mode) ) {
-	
-			// Store binary test for current node
-			int* ptT = &treetable[node*7];
-			ptT[0] = -1; ++ptT; 
-			for(int t=0; t<6; ++t)
-				ptT[t] = test[t];
-
-			double countA = 0;
-			double countB = 0;
-			for(unsigned int l=0; l<TrainSet.size(); ++l) {
-				cout << "Final_Split A/B " << l << " " << SetA[l].size() << " " << SetB[l].size() << endl; 
-				countA += SetA[l].size(); countB += SetB[l].size();
-			}
-			for(unsigned int l=0; l<TrainSet.size(); ++l) {
-				cout << "Final_SplitA: " << SetA[l].size()/countA << "% "; 
-			}
-			cout << endl;
-			for(unsigned int l=0; l<TrainSet.size(); ++l) {
-				cout << "Final_SplitB: " << SetB[l].size()/countB << "% "; 
-			}
-			cout << endl;
-
-			// Go left
-			// If enough patches are left continue growing else stop
-			if(SetA[0].size()+SetA[1].size()>min_samples) {
-				grow(SetA, 2*node+1, depth+1, samples, pnratio);
-			} else {
-				makeLeaf(SetA, pnratio, 2*node+1);
-			}
-
-			// Go right
-			// If enough patches are left continue growing else stop
-			if(SetB[0].size()+SetB[1].size()>min_samples) {
-				grow(SetB, 2*node+2, depth+1, samples, pnratio);
-			} else {
-				makeLeaf(SetB, pnratio, 2*node+2);
-			}
-
-		} else {
-
-			// Could not find split (only invalid one leave split)
-			makeLeaf(TrainSet, pnratio, node);
-	
-		}	
-
-	} else {
-
-		// Only negative patches are left or maximum depth is reached
-		makeLeaf(TrainSet, pnratio, node);
-	
-	}
-}
-
-// Create leaf node from patches 
-void CRTree::makeLeaf(const std::vector<std::vector<const PatchFeature*> >& TrainSet, float pnratio, int node) {
-	// Get pointer
-	treetable[node*7] = num_leaf;
-	LeafNode* ptL = &leaf[num_leaf];
-
-	// Store data
-	ptL->pfg = TrainSet[1].size() / float(pnratio*TrainSet[0].size()+TrainSet[1].size());
-	ptL->vCenter.resize( TrainSet[1].size() );
-	for(unsigned int i = 0; i<TrainSet[1].size(); ++i) {
-		ptL->vCenter[i] = TrainSet[1][i]->center;
-	}
-
-	// Increase leaf counter
-	++num_leaf;
-}
-
-bool CRTree::optimizeTest(vector<vector<const PatchFeature*> >& SetA, vector<vector<const PatchFeature*> >& SetB, const vector<vector<const PatchFeature*> >& TrainSet, int* test, unsigned int iter, unsigned int measure_mode) {
-	
-	bool found = false;
-
-	// temporary data for split into Set A and Set B
-	vector<vector<const PatchFeature*> > tmpA(TrainSet.size());
-	vector<vector<const PatchFeature*> > tmpB(TrainSet.size());
-
-	// temporary data for finding best test
-	vector<vector<IntIndex> > valSet(TrainSet.size());
-	double tmpDist;
-	// maximize!!!!
-	double bestDist = -DBL_MAX; 
-	int tmpTest[6];
-
-	// Find best test of ITER iterations
-	for(unsigned int i =0; i<iter; ++i) {
-
-		// reset temporary data for split
-		for(unsigned int l =0; l<TrainSet.size(); ++l) {
-			tmpA[l].clear();
-			tmpB[l].clear(); 
-		}
-
-		// generate binary test without threshold
-		generateTest(&tmpTest[0], TrainSet[1][0]->roi.width, TrainSet[1][0]->roi.height, TrainSet[1][0]->vPatch.size());
-
-		// compute value for each patch
-		evaluateTest(valSet, &tmpTest[0], TrainSet);
-
-		// find min/max values for threshold
-		int vmin = INT_MAX;
-		int vmax = INT_MIN;
-		for(unsigned int l = 0; l<TrainSet.size(); ++l) {
-			if(valSet[l].size()>0) {
-				if(vmin>valSet[l].front().val)  vmin = valSet[l].front().val;
-				if(vmax<valSet[l].back().val )  vmax = valSet[l].back().val;
-			}
-		}
-		int d = vmax-vmin;
-
-		if(d>0) {
-
-			// Find best threshold
-			for(unsigned int j=0; j<10; ++j) { 
-
-				// Generate some random thresholds
-				int tr = (cvRandInt( cvRNG ) % (d)) + vmin; 
-
-				// Split training data into two sets A,B accroding to threshold t 
-				split(tmpA, tmpB, TrainSet, valSet, tr);
-
-				// Do not allow empty set split (all patches end up in set A or B)
-				if( tmpA[0].size()+tmpA[1].size()>0 && tmpB[0].size()+tmpB[1].size()>0 ) {
-
-					// Measure quality of split with measure_mode 0 - classification, 1 - regression
-					tmpDist = measureSet(tmpA, tmpB, measure_mode);
-
-					// Take binary test with best split
-					if(tmpDist>bestDist) {
-
-						found = true;
-						bestDist = tmpDist;
-						for(int t=0; t<5;++t) test[t] = tmpTest[t];
-						test[5] = tr;
-						SetA = tmpA;
-						SetB = tmpB;
-					}
-
-				}
-
-			} // end for j
-
-		}
-
-	} // end iter
-
-	// return true if a valid test has been found
-	// test is invalid if only splits with an empty set A or B has been created
-	return found;
-}
-
-void CRTree::evaluateTest(std::vector<std::vector<IntIndex> >& valSet, const int* test, const std::vector<std::vector<const PatchFeature*> >& TrainSet) {
-	for(unsigned int l=0;l<TrainSet.size();++l) {
-		valSet[l].resize(TrainSet[l].size());
-		for(unsigned int i=0;i<TrainSet[l].size();++i) {
-
-			// pointer to channel
-			CvMat* ptC = TrainSet[l][i]->vPatch[test[4]];
-			// get pixel values 
-			int p1 = (int)*(uchar*)cvPtr2D( ptC, test[1], test[0]);
-			int p2 = (int)*(uchar*)cvPtr2D( ptC, test[3], test[2]);
-		
-			valSet[l][i].val = p1 - p2;
-			valSet[l][i].index = i;			
-		}
-		sort( valSet[l].begin(), valSet[l].end() );
-	}
-}
-
-void CRTree::split(vector<vector<const PatchFeature*> >& SetA, vector<vector<const PatchFeature*> >& SetB, const vector<vector<const PatchFeature*> >& TrainSet, const vector<vector<IntIndex> >& valSet, int t) {
-	for(unsigned int l = 0; l<TrainSet.size(); ++l) {
-		// search largest value such that val<t 
-		vector<IntIndex>::const_iterator it = valSet[l].begin();
-		while(it!=valSet[l].end() && it->val<t) {
-			++it;
-		}
-
-		SetA[l].resize(it-valSet[l].begin());
-		SetB[l].resize(TrainSet[l].size()-SetA[l].size());
-
-		it = valSet[l].begin();
-		for(unsigned int i=0; i<SetA[l].size(); ++i, ++it) {
-			SetA[l][i] = TrainSet[l][it->index];
-		}
-		
-		it = valSet[l].begin()+SetA[l].size();
-		for(unsigned int i=0; i<SetB[l].size(); ++i, ++it) {
-			SetB[l][i] = TrainSet[l][it->index];
-		}
-
-	}
-}
-
-double CRTree::distMean(const std::vector<const PatchFeature*>& SetA, const std::vector<const PatchFeature*>& SetB) {
-	vector<double> meanAx(num_cp,0);
-	vector<double> meanAy(num_cp,0);
-	for(vector<const PatchFeature*>::const_iterator it = SetA.begin(); it != SetA.end(); ++it) {
-		for(unsigned int c = 0; c<num_cp; ++c) {
-			meanAx[c] += (*it)->center[c].x;
-			meanAy[c] += (*it)->center[c].y;
-		}
-	}
-
-	for(unsigned int c = 0; c<num_cp; ++c) {
-		meanAx[c] /= (double)SetA.size();
-		meanAy[c] /= (double)SetA.size();
-	}
-
-	vector<double> distA(num_cp,0);
-	for(std::vector<const PatchFeature*>::const_iterator it = SetA.begin(); it != SetA.end(); ++it) {
-		for(unsigned int c = 0; c<num_cp; ++c) {
-			double tmp = (*it)->center[c].x - meanAx[c];
-			distA[c] += tmp*tmp;
-			tmp = (*it)->center[c].y - meanAy[c];
-			distA[c] += tmp*tmp;
-		}
-	}
-
-	vector<double> meanBx(num_cp,0);
-	vector<double> meanBy(num_cp,0);
-	for(vector<const PatchFeature*>::const_iterator it = SetB.begin(); it != SetB.end(); ++it) {
-		for(unsigned int c = 0; c<num_cp; ++c) {
-			meanBx[c] += (*it)->center[c].x;
-			meanBy[c] += (*it)->center[c].y;
-		}
-	}
-
-	for(unsigned int c = 0; c<num_cp; ++c) {
-		meanBx[c] /= (double)SetB.size();
-		meanBy[c] /= (double)SetB.size();
-	}
-
-	vector<double> distB(num_cp,0);
-	for(std::vector<const PatchFeature*>::const_iterator it = SetB.begin(); it != SetB.end(); ++it) {
-		for(unsigned int c = 0; c<num_cp; ++c) {
-			double tmp = (*it)->center[c].x - meanBx[c];
-			distB[c] += tmp*tmp;
-			tmp = (*it)->center[c].y - meanBy[c];
-			distB[c] += tmp*tmp;
-		}
-	}
-
-	double minDist = DBL_MAX;
-
-	for(unsigned int c = 0; c<num_cp; ++c) {
-		distA[c] += distB[c];
-		if(distA[c] < minDist) minDist = distA[c];
-	}
-
-	return minDist/double( SetA.size() + SetB.size() ); 
-}
-
-double CRTree::InfGain(const vector<vector<const PatchFeature*> >& SetA, const vector<vector<const PatchFeature*> >& SetB) {
-
-	// get size of set A
-	double sizeA = 0;
-	for(vector<vector<const PatchFeature*> >::const_iterator it = SetA.begin(); it != SetA.end(); ++it) {
-		sizeA += it->size();
-	}
-
-	// negative entropy: sum_i p_i*log(p_i)
-	double n_entropyA = 0;
-	for(vector<vector<const PatchFeature*> >::const_iterator it = SetA.begin(); it != SetA.end(); ++it) {
-		double p = double( it->size() ) / sizeA;
-		if(p>0) n_entropyA += p*log(p); 
-	}
-
-	// get size of set B
-	double sizeB = 0;
-	for(vector<vector<const PatchFeature*> >::const_iterator it = SetB.begin(); it != SetB.end(); ++it) {
-		sizeB += it->size();
-	}
-
-	// negative entropy: sum_i p_i*log(p_i)
-	double n_entropyB = 0;
-	for(vector<vector<const PatchFeature*> >::const_iterator it = SetB.begin(); it != SetB.end(); ++it) {
-		double p = double( it->size() ) / sizeB;
-		if(p>0) n_entropyB += p*log(p); 
-	}
-
-	return (sizeA*n_entropyA+sizeB*n_entropyB)/(sizeA+sizeB); 
-}
-
-/////////////////////// IO functions /////////////////////////////
-
-void LeafNode::show(int delay, int width, int height) {
-	char buffer[200];
-
-	print();
-
-	if(vCenter.size()>0) {
-		vector<IplImage*> iShow(vCenter[0].size());
-		for(unsigned int c = 0; c<iShow.size(); ++c) {
-			iShow[c] = cvCreateImage( cvSize(width,height), IPL_DEPTH_8U , 1 );
-			cvSetZero( iShow[c] );
-			for(unsigned int i = 0; i<vCenter.size(); ++i) {
-				int y = height/2+vCenter[i][c].y;
-				int x = width/2+vCenter[i][c].x;
-
-				if(x>=0 && y>=0 && x<width && y<height)
-					cvSetReal2D( iShow[c],  y,  x, 255 );
-			}
-			sprintf_s(buffer,"Leaf%d",c);
-			cvNamedWindow(buffer,1);
-			cvShowImage(buffer, iShow[c]);
-		}
-		
-		cvWaitKey(delay);
-		
-		for(unsigned int c = 0; c<iShow.size(); ++c) {
-			sprintf_s(buffer,"Leaf%d",c);
-			cvDestroyWindow(buffer);
-			cvReleaseImage(&iShow[c]);
-		}
-	}
-}
+/* 
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#include "CRTree.h"
+#include "CRFileUtil.h"
+#include <fstream>
+#include <sstream>
+#include <highgui.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+/////////////////////// Constructors /////////////////////////////
+
+// Header of a binary tree file
+// followed by tree table (num_nodes x 7 int), leafs (num_leaf FlatLeaf, num_class entries per leaf) and votes (num_votes x num_cp CvPoint)
+// or, for encoding 1, the encoded tree table and leafs (see encodeNodes, encodeLeaves)
+// Since version 4, the file ends with the weights of the leafs (num_leaf float, see LeafNode)
+struct TreeFileHeader {
+	char magic[8];
+	// byteOrder as written by the machine that saved the tree
+	unsigned int order;
+	// version of the layout
+	unsigned int version;
+	unsigned int max_depth;
+	unsigned int num_leaf;
+	unsigned int num_cp;
+	unsigned int num_votes;
+	// leaf encoding: 0 - flat leafs and votes, 1 - compressed
+	unsigned int encoding;
+	// number of object classes (version 2: one class)
+	unsigned int num_class;
+	// offsets of tree table, leafs, and votes (encoding 1: end of encoded leafs); file size
+	long long nodes;
+	long long leafs;
+	long long votes;
+	long long size;
+	// checksum of everything after the header
+	unsigned long long checksum;
+};
+
+static const char treeMagic[8] = {'C','R','T','R','E','E','B','N'};
+static const unsigned int byteOrder = 0x01020304;
+
+// Signed values as varints: 0, -1, 1, -2, ... -> 0, 1, 2, 3, ...
+static unsigned int zigzag(int val) {return ((unsigned int)val << 1) ^ (unsigned int)(val >> 31);}
+static int unzigzag(unsigned int val) {return (int)(val >> 1) ^ -(int)(val & 1);}
+
+// Votes of a leaf sorted by y and x for delta coding
+struct VoteLess {
+	bool operator()(const CvPoint& a, const CvPoint& b) const {return a.y<b.y || (a.y==b.y && a.x<b.x);}
+};
+
+// FNV-1a over 32 bit words (all sections consist of 32 bit values)
+unsigned long long CRTree::checksum(const void* data, size_t bytes) {
+	unsigned long long hash = 14695981039346656037ULL;
+	const unsigned int* pt = (const unsigned int*)data;
+	for(size_t i=0; i<bytes/4; ++i) {
+		hash ^= pt[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// Read tree from file
+CRTree::CRTree(const char* filename) : num_class(1), leaf(0), flatleaf(0), votes(0), weights(0), mapped(false), map_addr(0), map_length(0), cvRNG(-1), out(&cout), trData(0) {
+#pragma omp critical
+	cout << "Load Tree " << filename << endl;
+
+	int dummy;
+
+	ifstream in(filename);
+
+	// binary trees are mapped
+	char magic[sizeof(treeMagic)];
+	if(in.is_open() && in.read(magic, sizeof(magic)) && memcmp(magic, treeMagic, sizeof(magic))==0) {
+		in.close();
+		if(!mapTree(filename)) {
+			cerr << "Could not map tree: " << filename << endl;
+			exit(-1);
+		}
+		return;
+	}
+	in.clear();
+	in.seekg(0);
+
+	if(in.is_open()) {
+		// allocate memory for tree table
+		in >> max_depth;
+		num_nodes = (int)pow(2.0,int(max_depth+1))-1;
+		// num_nodes x 7 matrix as vector
+		treetable = new int[num_nodes * 7];
+		int* ptT = &treetable[0];
+		
+		// allocate memory for leafs
+		in >> num_leaf;
+		leaf = new LeafNode[num_leaf];
+
+		// number of center points per patch 
+		in >> num_cp;
+
+		// number of object classes (only given for more than one class)
+		string line;
+		getline(in, line);
+		istringstream(line) >> num_class;
+
+		// read tree nodes
+		for(unsigned int n=0; n<num_nodes; ++n) {
+			in >> dummy; in >> dummy;
+			for(unsigned int i=0; i<7; ++i, ++ptT) {
+				in >> *ptT;
+			}
+		}
+
+		// read tree leafs
+		LeafNode* ptLN = &leaf[0];
+		for(unsigned int l=0; l<num_leaf; ++l, ++ptLN) {
+			in >> dummy;
+			in >> ptLN->pfg;
+			
+			// number of positive patches
+			in >> dummy;
+			ptLN->vCenter.resize(dummy);
+			for(int i=0; i<dummy; ++i) {
+				ptLN->vCenter[i].resize(num_cp);
+				for(unsigned int k=0; k<num_cp; ++k) {
+					in >> ptLN->vCenter[i][k].x;
+					in >> ptLN->vCenter[i][k].y;
+				}
+			}
+
+			// weight of the leaf (not given by trees saved before)
+			float weight;
+			getline(in, line);
+			if(istringstream(line) >> weight)
+				ptLN->weight = weight;
+		}
+
+		// flat leafs for detection
+		flattenLeaves(vFlatLeaf, vVotes);
+		flatleaf = vFlatLeaf.empty() ? 0 : &vFlatLeaf[0];
+		votes = vVotes.empty() ? 0 : &vVotes[0];
+
+	} else {
+		cerr << "Could not read tree: " << filename << endl;
+	}
+
+	in.close();
+
+}
+
+// Tree in binary format in memory that stays valid (e.g. part of a mapped forest bundle)
+CRTree::CRTree(const void* data, size_t length) : num_class(1), leaf(0), flatleaf(0), votes(0), weights(0), mapped(false), map_addr(0), map_length(0), cvRNG(-1), out(&cout), trData(0) {
+	if(!setBinary(data, length)) {
+		cerr << "Could not read tree from forest bundle" << endl;
+		exit(-1);
+	}
+}
+
+CRTree::~CRTree() {
+	delete[] leaf; 
+	if(!mapped)
+		delete[] treetable;
+	if(map_addr!=0)
+		munmap(map_addr, map_length);
+}
+
+// Map binary tree file; tree table, leafs and votes point into the file
+bool CRTree::mapTree(const char* filename) {
+	int fd = open(filename, O_RDONLY);
+	if(fd<0)
+		return false;
+
+	struct stat st;
+	if(fstat(fd, &st)!=0 || st.st_size<(off_t)sizeof(TreeFileHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void* addr = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if(addr==MAP_FAILED)
+		return false;
+
+	if(!setBinary(addr, st.st_size)) {
+		munmap(addr, st.st_size);
+		return false;
+	}
+
+	map_addr = addr;
+	map_length = st.st_size;
+
+	return true;
+}
+
+// Check binary tree and set tree table, leafs and votes to it
+bool CRTree::setBinary(const void* addr, size_t length) {
+	const TreeFileHeader* header = (const TreeFileHeader*)addr;
+	if(length<sizeof(TreeFileHeader) || memcmp(header->magic, treeMagic, sizeof(treeMagic))!=0)
+		return false;
+	if(header->order!=byteOrder) {
+		cerr << "Tree file has different byte order (convert it from text format)" << endl;
+		return false;
+	}
+
+	// check sizes, offsets, and checksum
+	// (end: start of the leaf weights)
+	long long nodes = (1LL<<(header->max_depth+1))-1;
+	long long end = header->size - (header->version>=4 ? header->num_leaf*(long long)sizeof(float) : 0);
+	bool valid = header->version>=2 && header->version<=CRTREE_VERSION && header->max_depth<31 && header->encoding<=1 &&
+		header->size==(long long)length && header->nodes>=(long long)sizeof(TreeFileHeader);
+	if(valid && header->encoding==0)
+		valid = header->nodes + nodes*7*(long long)sizeof(int) <= header->leafs &&
+			header->leafs + header->num_leaf*(long long)sizeof(FlatLeaf) <= header->votes &&
+			header->votes + (long long)header->num_votes*header->num_cp*(long long)sizeof(CvPoint) == end;
+	if(valid && header->encoding==1)
+		valid = header->nodes <= header->leafs && header->leafs <= header->votes && header->votes <= end && end%4==0;
+	if(valid)
+		valid = checksum((const char*)addr + sizeof(TreeFileHeader), header->size - sizeof(TreeFileHeader))==header->checksum;
+	if(!valid) {
+		cerr << "Tree file is corrupt or has another version" << endl;
+		return false;
+	}
+
+	max_depth = header->max_depth;
+	num_nodes = nodes;
+	num_leaf = header->num_leaf;
+	num_cp = header->num_cp;
+	num_class = header->version==2 || header->num_class==0 ? 1 : header->num_class;
+	weights = header->version>=4 ? (const float*)((const char*)addr + end) : 0;
+	if(header->encoding==0) {
+		mapped = true;
+		treetable = (int*)((char*)addr + header->nodes);
+		flatleaf = (const FlatLeaf*)((const char*)addr + header->leafs);
+		votes = (const CvPoint*)((const char*)addr + header->votes);
+	} else {
+		treetable = new int[num_nodes * 7];
+		if(!decodeNodes((const uchar*)addr + header->nodes, header->leafs - header->nodes) ||
+			!decodeLeaves((const uchar*)addr + header->leafs, header->votes - header->leafs, header->num_votes)) {
+			cerr << "Tree file is corrupt" << endl;
+			return false;
+		}
+	}
+
+	// the checksum only protects against damaged files, not against wrong tables
+	if(!checkTables(header->num_votes)) {
+		cerr << "Tree file has invalid tree table or leafs" << endl;
+		return false;
+	}
+
+	return true;
+}
+
+// Check that the traversal and the votes stay within the tables: children of split nodes and channels of 
+// the tests, leaf indices (entry of class 1 of a leaf), and votes of the leafs
+bool CRTree::checkTables(unsigned int num_votes) const {
+	if(num_class==0 || num_leaf%num_class!=0)
+		return false;
+
+	vector<bool> vReach(num_nodes, false);
+	vReach[0] = true;
+	for(unsigned int n=0; n<num_nodes; ++n) {
+		if(!vReach[n])
+			continue;
+		const int* pnode = &treetable[n*7];
+		if(pnode[0]==-1) {
+			if(2*(unsigned long long)n+2>=num_nodes || pnode[5]<0 || pnode[5]>=32)
+				return false;
+			vReach[2*n+1] = true;
+			vReach[2*n+2] = true;
+		} else if(pnode[0]<0 || (unsigned int)pnode[0]>=num_leaf || pnode[0]%num_class!=0) {
+			return false;
+		}
+	}
+
+	for(unsigned int l=0; l<num_leaf; ++l)
+		if(flatleaf[l].first>num_votes || flatleaf[l].count>num_votes-flatleaf[l].first)
+			return false;
+
+	return true;
+}
+
+// Compressed tree table: nodes that are reached from the root in the order of the table 
+// split node: 0, x1, y1, x2, y2, channel, zigzag threshold; leaf: leaf index+1 (varints)
+void CRTree::encodeNodes(vector<uchar>& vData) const {
+	vector<bool> vReach(num_nodes, false);
+	vReach[0] = true;
+	for(unsigned int n=0; n<num_nodes; ++n) {
+		if(!vReach[n])
+			continue;
+		const int* pnode = &treetable[n*7];
+		if(pnode[0]==-1) {
+			CRFileUtil::putVarint(vData, 0);
+			for(unsigned int i=1; i<6; ++i)
+				CRFileUtil::putVarint(vData, pnode[i]);
+			CRFileUtil::putVarint(vData, zigzag(pnode[6]));
+			vReach[2*n+1] = true;
+			vReach[2*n+2] = true;
+		} else {
+			CRFileUtil::putVarint(vData, pnode[0]+1);
+		}
+	}
+}
+
+bool CRTree::decodeNodes(const uchar* data, size_t length) {
+	const uchar* end = data + length;
+	for(unsigned int i=0; i<num_nodes*7; ++i) treetable[i] = 0;
+
+	vector<bool> vReach(num_nodes, false);
+	vReach[0] = true;
+	unsigned int val;
+	for(unsigned int n=0; n<num_nodes; ++n) {
+		if(!vReach[n])
+			continue;
+		int* pnode = &treetable[n*7];
+		if(!CRFileUtil::getVarint(data, end, val))
+			return false;
+		if(val==0) {
+			if(2*n+2>=num_nodes)
+				return false;
+			pnode[0] = -1;
+			for(unsigned int i=1; i<6; ++i) {
+				if(!CRFileUtil::getVarint(data, end, val)) return false;
+				pnode[i] = val;
+			}
+			if(!CRFileUtil::getVarint(data, end, val)) return false;
+			pnode[6] = unzigzag(val);
+			vReach[2*n+1] = true;
+			vReach[2*n+2] = true;
+		} else {
+			if(val>num_leaf) return false;
+			pnode[0] = val-1;
+		}
+	}
+	return true;
+}
+
+// Compressed leafs: for each leaf pfg quantized to 16 bit, number of votes, and the offsets 
+// of the first center point (the one used by the detector) sorted by y and x and delta coded as varints:
+// first vote zigzag x, zigzag y; then dy and, if dy==0, dx or otherwise zigzag x
+void CRTree::encodeLeaves(vector<uchar>& vData, const FlatLeaf* ptL, const CvPoint* ptV) const {
+	vector<CvPoint> vLeaf;
+	for(unsigned int l=0; l<num_leaf; ++l) {
+		unsigned int q = (unsigned int)(std::min(std::max(ptL[l].pfg, 0.0f), 1.0f)*65535.0f + 0.5f);
+		vData.push_back(uchar(q & 0xff));
+		vData.push_back(uchar(q >> 8));
+		CRFileUtil::putVarint(vData, ptL[l].count);
+
+		vLeaf.resize(ptL[l].count);
+		for(unsigned int i=0; i<ptL[l].count; ++i)
+			vLeaf[i] = ptV[(ptL[l].first+i)*num_cp];
+		sort(vLeaf.begin(), vLeaf.end(), VoteLess());
+
+		for(unsigned int i=0; i<vLeaf.size(); ++i) {
+			if(i==0) {
+				CRFileUtil::putVarint(vData, zigzag(vLeaf[i].x));
+				CRFileUtil::putVarint(vData, zigzag(vLeaf[i].y));
+			} else {
+				unsigned int dy = vLeaf[i].y - vLeaf[i-1].y;
+				CRFileUtil::putVarint(vData, dy);
+				if(dy==0)
+					CRFileUtil::putVarint(vData, vLeaf[i].x - vLeaf[i-1].x);
+				else
+					CRFileUtil::putVarint(vData, zigzag(vLeaf[i].x));
+			}
+		}
+	}
+}
+
+bool CRTree::decodeLeaves(const uchar* data, size_t length, unsigned int num_votes) {
+	const uchar* end = data + length;
+	vFlatLeaf.resize(num_leaf);
+	vVotes.resize((size_t)num_votes*num_cp);
+
+	unsigned int first = 0;
+	for(unsigned int l=0; l<num_leaf; ++l) {
+		if(end-data<2)
+			return false;
+		vFlatLeaf[l].pfg = (data[0] | (data[1] << 8)) / 65535.0f;
+		data += 2;
+		if(!CRFileUtil::getVarint(data, end, vFlatLeaf[l].count) || vFlatLeaf[l].count>num_votes-first)
+			return false;
+		vFlatLeaf[l].first = first;
+
+		CvPoint* ptV = vVotes.empty() ? 0 : &vVotes[first];
+		unsigned int val;
+		for(unsigned int i=0; i<vFlatLeaf[l].count; ++i) {
+			if(i==0) {
+				if(!CRFileUtil::getVarint(data, end, val)) return false;
+				ptV[i].x = unzigzag(val);
+				if(!CRFileUtil::getVarint(data, end, val)) return false;
+				ptV[i].y = unzigzag(val);
+			} else {
+				if(!CRFileUtil::getVarint(data, end, val)) return false;
+				ptV[i].y = ptV[i-1].y + val;
+				if(val==0) {
+					if(!CRFileUtil::getVarint(data, end, val)) return false;
+					ptV[i].x = ptV[i-1].x + val;
+				} else {
+					if(!CRFileUtil::getVarint(data, end, val)) return false;
+					ptV[i].x = unzigzag(val);
+				}
+			}
+		}
+		first += vFlatLeaf[l].count;
+	}
+	if(first!=num_votes)
+		return false;
+
+	flatleaf = vFlatLeaf.empty() ? 0 : &vFlatLeaf[0];
+	votes = vVotes.empty() ? 0 : &vVotes[0];
+	return true;
+}
+
+// Channels used by the tests (bit c: channel c)
+unsigned int CRTree::usedChannels() const {
+	unsigned int channels = 0;
+	for(unsigned int n=0; n<num_nodes; ++n)
+		if(treetable[n*7]==-1)
+			channels |= 1u << treetable[n*7+5];
+	return channels;
+}
+
+// Flat leafs from leafs: votes of all leafs in one array
+void CRTree::flattenLeaves(vector<FlatLeaf>& vFL, vector<CvPoint>& vV) const {
+	unsigned int num_votes = 0;
+	for(unsigned int l=0; l<num_leaf; ++l)
+		num_votes += leaf[l].vCenter.size();
+
+	vFL.resize(num_leaf);
+	vV.clear();
+	vV.reserve(num_votes*num_cp);
+	for(unsigned int l=0; l<num_leaf; ++l) {
+		vFL[l].pfg = leaf[l].pfg;
+		vFL[l].count = leaf[l].vCenter.size();
+		vFL[l].first = vV.size()/num_cp;
+		for(unsigned int i=0; i<leaf[l].vCenter.size(); ++i)
+			vV.insert(vV.end(), leaf[l].vCenter[i].begin(), leaf[l].vCenter[i].end());
+	}
+}
+
+// Leafs from flat leafs (for modifying a mapped tree)
+void CRTree::expandLeaves() {
+	leaf = new LeafNode[num_leaf];
+	for(unsigned int l=0; l<num_leaf; ++l) {
+		leaf[l].pfg = flatleaf[l].pfg;
+		leaf[l].weight = weights!=0 ? weights[l] : -1;
+		leaf[l].vCenter.resize(flatleaf[l].count);
+		const CvPoint* ptV = GetVotes(&flatleaf[l]);
+		for(unsigned int i=0; i<flatleaf[l].count; ++i, ptV += num_cp)
+			leaf[l].vCenter[i].assign(ptV, ptV+num_cp);
+	}
+}
+
+
+/////////////////////// IO Function /////////////////////////////
+
+bool CRTree::saveTree(const char* filename) const {
+	cout << "Save Tree " << filename << endl;
+
+	bool done = false;
+
+	ofstream out(filename);
+	if(out.is_open()) {
+
+		out << max_depth << " " << num_leaf << " " << num_cp;
+		if(num_class>1)
+			out << " " << num_class;
+		out << endl;
+
+		// save tree nodes
+		int* ptT = &treetable[0];
+		int depth = 0;
+		unsigned int step = 2;
+		for(unsigned int n=0; n<num_nodes; ++n) {
+			// get depth from node
+			if(n==step-1) {
+				++depth;
+				step *= 2;
+			}
+
+			out << n << " " << depth << " ";
+			for(unsigned int i=0; i<7; ++i, ++ptT) {
+				out << *ptT << " ";
+			}
+			out << endl;
+		}
+		out << endl;
+
+		// save tree leafs
+		if(leaf!=0) {
+			LeafNode* ptLN = &leaf[0];
+			for(unsigned int l=0; l<num_leaf; ++l, ++ptLN) {
+				out << l << " " << ptLN->pfg << " " << ptLN->vCenter.size() << " ";
+			
+				for(unsigned int i=0; i<ptLN->vCenter.size(); ++i) {
+					for(unsigned int k=0; k<ptLN->vCenter[i].size(); ++k) {
+						out << ptLN->vCenter[i][k].x << " " << ptLN->vCenter[i][k].y << " ";
+					}
+				}
+				out << ptLN->weight << endl;
+			}
+		} else {
+			// mapped tree
+			for(unsigned int l=0; l<num_leaf; ++l) {
+				out << l << " " << flatleaf[l].pfg << " " << flatleaf[l].count << " ";
+
+				const CvPoint* ptV = GetVotes(&flatleaf[l]);
+				for(unsigned int i=0; i<flatleaf[l].count*num_cp; ++i)
+					out << ptV[i].x << " " << ptV[i].y << " ";
+				out << (weights!=0 ? weights[l] : -1.0f) << endl;
+			}
+		}
+
+		out.close();
+
+		done = true;
+	}
+
+
+	return done;
+}
+
+void CRTree::binaryTree(vector<char>& vData, int encoding) const {
+	// flat leafs of a trained or loaded tree
+	vector<FlatLeaf> vFL;
+	vector<CvPoint> vV;
+	const FlatLeaf* ptL = flatleaf;
+	const CvPoint* ptV = votes;
+	unsigned int num_votes = 0;
+	if(leaf!=0) {
+		flattenLeaves(vFL, vV);
+		ptL = vFL.empty() ? 0 : &vFL[0];
+		ptV = vV.empty() ? 0 : &vV[0];
+		num_votes = vV.size()/num_cp;
+	} else {
+		for(unsigned int l=0; l<num_leaf; ++l)
+			num_votes += flatleaf[l].count;
+	}
+	vector<float> vWeight(num_leaf, -1.0f);
+	for(unsigned int l=0; l<num_leaf; ++l) {
+		if(leaf!=0)
+			vWeight[l] = leaf[l].weight;
+		else if(weights!=0)
+			vWeight[l] = weights[l];
+	}
+
+	// sections aligned to 64 bytes
+	TreeFileHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, treeMagic, sizeof(treeMagic));
+	header.order = byteOrder;
+	header.version = CRTREE_VERSION;
+	header.max_depth = max_depth;
+	header.num_leaf = num_leaf;
+	header.num_cp = num_cp;
+	header.num_votes = num_votes;
+	header.encoding = encoding;
+	header.num_class = num_class;
+	header.nodes = ((sizeof(header)+63)/64)*64;
+
+	if(encoding==1) {
+		// only the first center point is kept; padded to 32 bit for the checksum
+		vector<uchar> vNodes;
+		vector<uchar> vLeafs;
+		encodeNodes(vNodes);
+		encodeLeaves(vLeafs, ptL, ptV);
+		header.num_cp = 1;
+		header.leafs = header.nodes + vNodes.size();
+		header.votes = header.leafs + vLeafs.size();
+		header.size = ((header.votes + 3)/4)*4 + num_leaf*sizeof(float);
+
+		vData.assign(header.size, 0);
+		memcpy(&vData[header.nodes], &vNodes[0], vNodes.size());
+		if(!vLeafs.empty())
+			memcpy(&vData[header.leafs], &vLeafs[0], vLeafs.size());
+	} else {
+		header.leafs = ((header.nodes + num_nodes*7*sizeof(int) + 63)/64)*64;
+		header.votes = ((header.leafs + num_leaf*sizeof(FlatLeaf) + 63)/64)*64;
+		header.size = header.votes + (long long)num_votes*num_cp*sizeof(CvPoint) + num_leaf*sizeof(float);
+
+		vData.assign(header.size, 0);
+		if(num_leaf>0)
+			memcpy(&vData[header.leafs], ptL, num_leaf*sizeof(FlatLeaf));
+		if(num_votes>0)
+			memcpy(&vData[header.votes], ptV, (size_t)num_votes*num_cp*sizeof(CvPoint));
+		memcpy(&vData[header.nodes], treetable, num_nodes*7*sizeof(int));
+	}
+	if(num_leaf>0)
+		memcpy(&vData[header.size - num_leaf*sizeof(float)], &vWeight[0], num_leaf*sizeof(float));
+	header.checksum = checksum(&vData[sizeof(header)], vData.size()-sizeof(header));
+	memcpy(&vData[0], &header, sizeof(header));
+}
+
+bool CRTree::saveBinary(const char* filename, int encoding) const {
+	cout << "Save Tree " << filename << endl;
+
+	vector<char> vData;
+	binaryTree(vData, encoding);
+
+	string tmpfile = CRFileUtil::tempFile(filename);
+
+	ofstream out(tmpfile.c_str(), ios::binary);
+	if(!out.is_open()) {
+		cerr << "Could not write tree: " << tmpfile << endl;
+		return false;
+	}
+	out.write(&vData[0], vData.size());
+	bool done = CRFileUtil::replaceFile(out, tmpfile, filename);
+	if(!done)
+		cerr << "Could not write tree: " << filename << endl;
+
+	return done;
+}
+
+void CRTree::showLeaves(int width, int height) const {
+	for(unsigned int l=0; l<num_leaf; ++l) {
+		if(leaf!=0) {
+			leaf[l].show(5000, width, height);
+		} else {
+			// mapped tree
+			LeafNode tmp;
+			tmp.pfg = flatleaf[l].pfg;
+			const CvPoint* ptV = GetVotes(&flatleaf[l]);
+			for(unsigned int i=0; i<flatleaf[l].count; ++i, ptV += num_cp)
+				tmp.vCenter.push_back(vector<CvPoint>(ptV, ptV+num_cp));
+			tmp.show(5000, width, height);
+		}
+	}
+}
+
+bool CRTree::checkTree(const char* filename) {
+	ifstream in(filename);
+	if(!in.is_open())
+		return false;
+
+	unsigned int depth, leafs, cp;
+	in >> depth >> leafs >> cp;
+	if(!in || depth>30)
+		return false;
+	string line;
+	getline(in, line);
+
+	// tree nodes: node depth leafindex x1 y1 x2 y2 channel thres
+	unsigned int nodes = (1<<(depth+1))-1;
+	int val[9];
+	for(unsigned int n=0; n<nodes; ++n) {
+		for(unsigned int i=0; i<9; ++i)
+			in >> val[i];
+		if(!in || val[0]!=(int)n || val[2]>=(int)leafs)
+			return false;
+	}
+
+	// tree leafs: leaf pfg number_of_patches offsets
+	for(unsigned int l=0; l<leafs; ++l) {
+		float pfg;
+		int num;
+		in >> val[0] >> pfg >> num;
+		if(!in || val[0]!=(int)l || num<0)
+			return false;
+		for(unsigned int i=0; i<num*cp*2; ++i)
+			in >> val[1];
+		// weight (optional)
+		getline(in, line);
+	}
+
+	return !in.fail();
+}
+
+// Write/read vector with number of elements
+template<typename T> static void writeVector(ostream& out, const vector<T>& vec) {
+	unsigned int size = vec.size();
+	out.write((const char*)&size, sizeof(size));
+	if(size>0) out.write((const char*)&vec[0], size*sizeof(T));
+}
+
+template<typename T> static bool readVector(istream& in, vector<T>& vec) {
+	unsigned int size = 0;
+	in.read((char*)&size, sizeof(size));
+	if(!in) return false;
+	vec.resize(size);
+	if(size>0) in.read((char*)&vec[0], size*sizeof(T));
+	return !in.fail();
+}
+
+static const char ckptMagic[8] = {'C','R','C','K','P','T','0','3'};
+
+// Checkpoint: checksum of the training data (see CRPatch::checksum), tree table, leafs, random generator, and nodes that still have to be grown
+// depth-first: index arrays and stack; level-wise: node of each patch and nodes of current depth
+void CRTree::saveCheckpoint(const vector<vector<int> >& vPos, const vector<LevelNode>& vLevel, bool force) {
+	if(ckpt_interval<=0 || (!force && time(NULL)-ckpt_time<ckpt_interval))
+		return;
+
+	// write to temporary file first such that a checkpoint is never incomplete
+	string tmpfile = ckpt_file + ".tmp";
+	ofstream out(tmpfile.c_str(), ios::binary);
+	out.write(ckptMagic, sizeof(ckptMagic));
+	int header[5] = {grow_mode, (int)max_depth, (int)num_cp, (int)trData->vLPatches.size(), (int)num_leaf};
+	out.write((const char*)header, sizeof(header));
+	out.write((const char*)&ckpt_data, sizeof(ckpt_data));
+	for(unsigned int l=0; l<trData->vLPatches.size(); ++l) {
+		unsigned int size = trData->vLPatches[l].size();
+		out.write((const char*)&size, sizeof(size));
+	}
+	out.write((const char*)&cvRNG, sizeof(cvRNG));
+	out.write((const char*)treetable, num_nodes*7*sizeof(int));
+
+	for(unsigned int l=0; l<num_leaf; ++l) {
+		out.write((const char*)&leaf[l].pfg, sizeof(float));
+		out.write((const char*)&leaf[l].weight, sizeof(float));
+		vector<CvPoint> vCenter;
+		for(unsigned int i=0; i<leaf[l].vCenter.size(); ++i)
+			vCenter.insert(vCenter.end(), leaf[l].vCenter[i].begin(), leaf[l].vCenter[i].end());
+		writeVector(out, vCenter);
+	}
+
+	if(grow_mode==1) {
+		for(unsigned int l=0; l<vPos.size(); ++l)
+			writeVector(out, vPos[l]);
+		unsigned int size = vLevel.size();
+		out.write((const char*)&size, sizeof(size));
+		for(unsigned int n=0; n<vLevel.size(); ++n) {
+			out.write((const char*)&vLevel[n].node, sizeof(int));
+			writeVector(out, vLevel[n].vCount);
+		}
+	} else {
+		for(unsigned int l=0; l<vIndex.size(); ++l)
+			writeVector(out, vIndex[l]);
+		unsigned int size = vStack.size();
+		out.write((const char*)&size, sizeof(size));
+		for(unsigned int n=0; n<vStack.size(); ++n) {
+			int entry[3] = {vStack[n].node, (int)vStack[n].depth, vStack[n].leaf};
+			out.write((const char*)entry, sizeof(entry));
+			writeVector(out, vStack[n].begin);
+			writeVector(out, vStack[n].end);
+		}
+	}
+
+	bool done = out.good();
+	out.close();
+	if(done)
+		done = rename(tmpfile.c_str(), ckpt_file.c_str())==0;
+	if(!done)
+		cerr << "Could not write checkpoint " << ckpt_file << endl;
+
+	ckpt_time = time(NULL);
+}
+
+// Restore state from checkpoint file if it exists and matches the training data
+// (the same number of patches can be extracted with another seed, the patches themselves are compared)
+void CRTree::loadCheckpoint(vector<vector<int> >& vPos, vector<LevelNode>& vLevel) {
+	ckpt_time = time(NULL);
+	if(ckpt_interval<=0)
+		return;
+	ckpt_data = trData->checksum();
+
+	ifstream in(ckpt_file.c_str(), ios::binary);
+	if(!in.is_open())
+		return;
+
+	char magic[8];
+	int header[5];
+	unsigned long long data;
+	in.read(magic, sizeof(magic));
+	in.read((char*)header, sizeof(header));
+	in.read((char*)&data, sizeof(data));
+	bool valid = in && memcmp(magic, ckptMagic, sizeof(magic))==0 && header[0]==grow_mode && 
+		header[1]==(int)max_depth && header[2]==(int)num_cp && header[3]==(int)trData->vLPatches.size() && data==ckpt_data;
+	for(unsigned int l=0; valid && l<trData->vLPatches.size(); ++l) {
+		unsigned int size;
+		in.read((char*)&size, sizeof(size));
+		valid = in && size==trData->vLPatches[l].size();
+	}
+	if(!valid) {
+		cerr << "Checkpoint " << ckpt_file << " does not match training data" << endl;
+		return;
+	}
+
+	in.read((char*)&cvRNG, sizeof(cvRNG));
+	in.read((char*)treetable, num_nodes*7*sizeof(int));
+
+	num_leaf = header[4];
+	for(unsigned int l=0; l<num_leaf; ++l) {
+		in.read((char*)&leaf[l].pfg, sizeof(float));
+		in.read((char*)&leaf[l].weight, sizeof(float));
+		vector<CvPoint> vCenter;
+		readVector(in, vCenter);
+		leaf[l].vCenter.resize(vCenter.size()/num_cp);
+		for(unsigned int i=0; i<leaf[l].vCenter.size(); ++i)
+			leaf[l].vCenter[i].assign(vCenter.begin()+i*num_cp, vCenter.begin()+(i+1)*num_cp);
+	}
+
+	unsigned int size = 0;
+	if(grow_mode==1) {
+		vPos.resize(trData->vLPatches.size());
+		for(unsigned int l=0; l<vPos.size(); ++l)
+			readVector(in, vPos[l]);
+		in.read((char*)&size, sizeof(size));
+		vLevel.resize(size);
+		for(unsigned int n=0; n<vLevel.size(); ++n) {
+			in.read((char*)&vLevel[n].node, sizeof(int));
+			readVector(in, vLevel[n].vCount);
+		}
+	} else {
+		for(unsigned int l=0; l<vIndex.size(); ++l)
+			readVector(in, vIndex[l]);
+		in.read((char*)&size, sizeof(size));
+		vStack.resize(size);
+		for(unsigned int n=0; n<vStack.size(); ++n) {
+			int entry[3];
+			in.read((char*)entry, sizeof(entry));
+			vStack[n].node = entry[0];
+			vStack[n].depth = entry[1];
+			vStack[n].leaf = entry[2]!=0;
+			readVector(in, vStack[n].begin);
+			readVector(in, vStack[n].end);
+		}
+	}
+
+	if(!in) {
+		cerr << "Could not read checkpoint " << ckpt_file << endl;
+		exit(-1);
+	}
+
+	*out << "Continue from checkpoint " << ckpt_file << ": " << num_leaf << " leafs, " << size << " open nodes" << endl;
+}
+
+/////////////////////// Training Function /////////////////////////////
+
+// Start grow tree
+void CRTree::growTree(const CRPatch& TrData, int samples) {
+	trData = &TrData;
+
+	// Get ratios of the numbers of patches of the classes
+	classRatios(TrData);
+
+	if(grow_mode==1) {
+
+		// Grow tree level by level
+		growLevels(samples);
+
+	} else {
+
+		// Index array for each class: every node owns a range [begin, end) that is partitioned for its children
+		unsigned int max_size = 0;
+		vIndex.resize(TrData.vLPatches.size());
+		for(unsigned int l=0; l<vIndex.size(); ++l) {
+			vIndex[l].resize(TrData.vLPatches[l].size());
+			if(vIndex[l].size()>max_size) max_size = vIndex[l].size();
+			
+			for(unsigned int i=0; i<vIndex[l].size(); ++i) {
+				vIndex[l][i] = i;
+			}
+		}
+		vBuffer.resize(max_size);
+
+		// Root node owns all patches
+		vStack.resize(1);
+		vStack[0].node = 0;
+		vStack[0].depth = 0;
+		vStack[0].leaf = false;
+		vStack[0].begin.assign(vIndex.size(), 0);
+		vStack[0].end.resize(vIndex.size());
+		for(unsigned int l=0; l<vIndex.size(); ++l)
+			vStack[0].end[l] = vIndex[l].size();
+
+		// Continue from checkpoint
+		vector<vector<int> > vPos;
+		vector<LevelNode> vLevel;
+		loadCheckpoint(vPos, vLevel);
+
+		// Grow tree
+		grow(samples);
+
+	}
+
+	// Release training data
+	vector<float>().swap(vRatio);
+	vector<vector<unsigned int> >().swap(vIndex);
+	vector<unsigned int>().swap(vBuffer);
+	vector<StackNode>().swap(vStack);
+	trData = 0;
+}
+
+// Called by growTree: grows the nodes on the stack depth-first (same order as recursion)
+void CRTree::grow(int samples) {
+
+	while(vStack.size()>0) {
+
+		// Save state before next node
+		saveCheckpoint(vector<vector<int> >(), vector<LevelNode>(), false);
+
+		StackNode current = vStack.back();
+		vStack.pop_back();
+		int node = current.node;
+		unsigned int depth = current.depth;
+
+		NodeSet TrainSet;
+		TrainSet.begin.resize(vIndex.size());
+		TrainSet.end.resize(vIndex.size());
+		for(unsigned int l=0; l<vIndex.size(); ++l) {
+			TrainSet.begin[l] = indexBase(l) + current.begin[l];
+			TrainSet.end[l] = indexBase(l) + current.end[l];
+		}
+
+		// Not enough patches are left
+		if(current.leaf) {
+			makeLeaf(TrainSet, node);
+			continue;
+		}
+
+		// Number of positive patches (all object classes)
+		unsigned int pos = 0;
+		for(unsigned int l=1; l<vIndex.size(); ++l)
+			pos += TrainSet.size(l);
+
+		if(depth<max_depth && pos>0) {	
+
+			NodeSet SetA;
+			NodeSet SetB;
+			int test[6];
+
+			// Set measure mode for split: 0 - classification, 1 - regression
+			unsigned int measure_mode = 1;
+			if( float(TrainSet.size(0)) / float(TrainSet.size(0)+pos) >= 0.05 && depth < max_depth-2 )
+				measure_mode = cvRandInt( &cvRNG ) % 2;
+
+			*out << "MeasureMode " << depth << " " << measure_mode << " " << TrainSet.size(0) << " " << pos << endl;
+		
+			// Find optimal test
+			if( optimizeTest(TrainSet, test, samples, measure_mode) ) {
+		
+				// Store binary test for current node
+				int* ptT = &treetable[node*7];
+				ptT[0] = -1; ++ptT; 
+				for(int t=0; t<6; ++t)
+					ptT[t] = test[t];
+
+				// Partition patches of the node in place
+				split(SetA, SetB, TrainSet, test);
+
+				double countA = 0;
+				double countB = 0;
+				for(unsigned int l=0; l<TrainSet.begin.size(); ++l) {
+					*out << "Final_Split A/B " << l << " " << SetA.size(l) << " " << SetB.size(l) << endl; 
+					countA += SetA.size(l); countB += SetB.size(l);
+				}
+				for(unsigned int l=0; l<TrainSet.begin.size(); ++l) {
+					*out << "Final_SplitA: " << SetA.size(l)/countA << "% "; 
+				}
+				*out << endl;
+				for(unsigned int l=0; l<TrainSet.begin.size(); ++l) {
+					*out << "Final_SplitB: " << SetB.size(l)/countB << "% "; 
+				}
+				*out << endl;
+
+				// Push right and then left node such that the left one is grown first
+				// If enough patches are left continue growing else stop
+				StackNode child;
+				child.depth = depth+1;
+				child.begin.resize(vIndex.size());
+				child.end.resize(vIndex.size());
+
+				child.node = 2*node+2;
+				child.leaf = countB<=min_samples;
+				for(unsigned int l=0; l<vIndex.size(); ++l) {
+					child.begin[l] = SetB.begin[l] - indexBase(l);
+					child.end[l] = SetB.end[l] - indexBase(l);
+				}
+				vStack.push_back(child);
+
+				child.node = 2*node+1;
+				child.leaf = countA<=min_samples;
+				for(unsigned int l=0; l<vIndex.size(); ++l) {
+					child.begin[l] = SetA.begin[l] - indexBase(l);
+					child.end[l] = SetA.end[l] - indexBase(l);
+				}
+				vStack.push_back(child);
+
+			} else {
+
+				// Could not find split (only invalid one leave split)
+				makeLeaf(TrainSet, node);
+		
+			}	
+
+		} else {
+
+			// Only negative patches are left or maximum depth is reached
+			makeLeaf(TrainSet, node);
+		
+		}
+	}
+}
+
+// Create leaf node from patches: one entry per object class
+// The probability of a class is given by the patches of the leaf normalized by the number of training patches per class
+void CRTree::makeLeaf(const NodeSet& TrainSet, int node) {
+	unsigned int num_l = TrainSet.begin.size();
+
+	// Get pointer
+	treetable[node*7] = num_leaf;
+
+	for(unsigned int c=1; c<num_l; ++c) {
+		LeafNode* ptL = &leaf[num_leaf+c-1];
+
+		// Store data
+		float other = 0;
+		for(unsigned int l=0; l<num_l; ++l)
+			if(l!=c) other += vRatio[c*num_l+l]*TrainSet.size(l);
+		// (0 for a class without training patches)
+		float all = other+TrainSet.size(c);
+		ptL->pfg = all>0 ? TrainSet.size(c) / all : 0;
+		ptL->weight = all;
+		ptL->vCenter.resize( TrainSet.size(c) );
+		for(unsigned int i = 0; i<TrainSet.size(c); ++i) {
+			const CvPoint* center = trData->vLPatches[c].center(TrainSet.begin[c][i]);
+			ptL->vCenter[i].assign(center, center+num_cp);
+		}
+	}
+
+	// Increase leaf counter
+	num_leaf += num_l-1;
+}
+
+// Ratios of the numbers of training patches of the classes (for two classes: positive/negative patches)
+// A class without patches keeps ratio 1 (none of its patches reach a leaf)
+void CRTree::classRatios(const CRPatch& TrData) {
+	unsigned int num_l = TrData.vLPatches.size();
+	vRatio.assign(num_l*num_l, 1.0f);
+	for(unsigned int c=1; c<num_l; ++c)
+		for(unsigned int l=0; l<num_l; ++l)
+			if(l!=c && TrData.vLPatches[l].size()>0) vRatio[c*num_l+l] = TrData.vLPatches[c].size() / float(TrData.vLPatches[l].size());
+}
+
+// Grow tree level by level
+// The tests of all nodes of a depth are evaluated together with one pass over all patches 
+// (one pass per chunk of nodes if the histograms do not fit into max_level_memory)
+void CRTree::growLevels(int samples) {
+	unsigned int num_l = trData->vLPatches.size();
+	const PatchArena& pos = trData->vLPatches[1];
+
+	// node of the current depth for each patch (-1: patch has reached a leaf)
+	vector<vector<int> > vPos(num_l);
+	vector<LevelNode> vLevel(1);
+	vLevel[0].node = 0;
+	vLevel[0].vCount.resize(num_l);
+	for(unsigned int l=0; l<num_l; ++l) {
+		vPos[l].assign(trData->vLPatches[l].size(), 0);
+		vLevel[0].vCount[l] = trData->vLPatches[l].size();
+	}
+
+	// Continue from checkpoint
+	loadCheckpoint(vPos, vLevel);
+	unsigned int depth = 0;
+	if(vLevel.size()>0)
+		while((2u<<depth)-1 <= (unsigned int)vLevel[0].node) ++depth;
+
+	for(; vLevel.size()>0; ++depth) {
+
+		// Save state before next depth
+		saveCheckpoint(vPos, vLevel, false);
+
+		*out << "Level " << depth << " " << vLevel.size() << endl;
+
+		// Draw measure modes and tests of the nodes in order
+		for(unsigned int n=0; n<vLevel.size(); ++n) {
+			LevelNode& ln = vLevel[n];
+			unsigned int size0 = ln.vCount[0];
+			unsigned int size1 = 0;
+			for(unsigned int l=1; l<num_l; ++l)
+				size1 += ln.vCount[l];
+
+			ln.split = depth<max_depth && size1>0;
+			if(!ln.split) continue;
+
+			// Set measure mode for split: 0 - classification, 1 - regression
+			ln.measure_mode = 1;
+			if( float(size0) / float(size0+size1) >= 0.05 && depth < max_depth-2 )
+				ln.measure_mode = cvRandInt( &cvRNG ) % 2;
+
+			*out << "MeasureMode " << depth << " " << ln.measure_mode << " " << size0 << " " << size1 << endl;
+
+			// Generate tests and random numbers for thresholds
+			ln.vTests.resize(samples*5);
+			if(split_mode==0)
+				ln.vRandThres.resize(samples*10);
+			for(int i=0; i<samples; ++i) {
+				generateTest(&ln.vTests[i*5], pos.GetWidth(), pos.GetHeight(), pos.GetChannels());
+				if(split_mode==0)
+					for(unsigned int j=0; j<10; ++j)
+						ln.vRandThres[i*10+j] = cvRandInt( &cvRNG );
+			}
+		}
+
+		// Find optimal tests
+		optimizeLevel(vLevel, vPos, samples);
+
+		// Route patches: 2n, 2n+1 - children A, B of node n; 2n - node n if it becomes a leaf
+		vector<unsigned int> vCount(vLevel.size()*2*num_l, 0);
+		for(unsigned int l=0; l<num_l; ++l) {
+			for(unsigned int i=0; i<vPos[l].size(); ++i) {
+				int n = vPos[l][i];
+				if(n<0) continue;
+				int t = 2*n;
+				if(vLevel[n].split && testValue(l, i, vLevel[n].test) >= vLevel[n].test[5])
+					++t;
+				vPos[l][i] = t;
+				++vCount[t*num_l+l];
+			}
+		}
+
+		// Nodes of next depth or leafs
+		vector<LevelNode> vNext;
+		vector<int> vTarget(vLevel.size()*2, -1);
+		vector<int> vLeaf(vLevel.size()*2, -1);
+		vector<int> vLeafNode;
+		for(unsigned int n=0; n<vLevel.size(); ++n) {
+			const LevelNode& ln = vLevel[n];
+
+			if(!ln.split) {
+				vLeaf[2*n] = vLeafNode.size();
+				vLeafNode.push_back(ln.node);
+				continue;
+			}
+
+			// Store binary test for current node
+			int* ptT = &treetable[ln.node*7];
+			ptT[0] = -1; ++ptT; 
+			for(int t=0; t<6; ++t)
+				ptT[t] = ln.test[t];
+
+			const unsigned int* countA = &vCount[2*n*num_l];
+			const unsigned int* countB = &vCount[(2*n+1)*num_l];
+			double sizeA = 0;
+			double sizeB = 0;
+			for(unsigned int l=0; l<num_l; ++l) {
+				*out << "Final_Split A/B " << l << " " << countA[l] << " " << countB[l] << endl; 
+				sizeA += countA[l]; sizeB += countB[l];
+			}
+			for(unsigned int l=0; l<num_l; ++l) {
+				*out << "Final_SplitA: " << countA[l]/sizeA << "% "; 
+			}
+			*out << endl;
+			for(unsigned int l=0; l<num_l; ++l) {
+				*out << "Final_SplitB: " << countB[l]/sizeB << "% "; 
+			}
+			*out << endl;
+
+			// If enough patches are left continue growing else stop
+			for(int c=0; c<2; ++c) {
+				int t = 2*n+c;
+				const unsigned int* count = &vCount[t*num_l];
+				if((c==0 ? sizeA : sizeB)>min_samples) {
+					vTarget[t] = vNext.size();
+					vNext.push_back(LevelNode());
+					vNext.back().node = 2*ln.node+1+c;
+					vNext.back().vCount.assign(count, count+num_l);
+				} else {
+					vLeaf[t] = vLeafNode.size();
+					vLeafNode.push_back(2*ln.node+1+c);
+				}
+			}
+		}
+
+		// Assign patches to nodes of next depth and collect patches of leafs
+		vector<vector<vector<unsigned int> > > vLeafSet(vLeafNode.size(), vector<vector<unsigned int> >(num_l));
+		for(unsigned int l=0; l<num_l; ++l) {
+			for(unsigned int i=0; i<vPos[l].size(); ++i) {
+				int t = vPos[l][i];
+				if(t<0) continue;
+				if(vTarget[t]<0) 
+					vLeafSet[vLeaf[t]][l].push_back(i);
+				vPos[l][i] = vTarget[t];
+			}
+		}
+
+		// Create leafs
+		for(unsigned int k=0; k<vLeafNode.size(); ++k) {
+			NodeSet LeafSet;
+			LeafSet.begin.resize(num_l);
+			LeafSet.end.resize(num_l);
+			for(unsigned int l=0; l<num_l; ++l) {
+				LeafSet.begin[l] = vLeafSet[k][l].size()>0 ? &vLeafSet[k][l][0] : 0;
+				LeafSet.end[l] = LeafSet.begin[l] + vLeafSet[k][l].size();
+			}
+			makeLeaf(LeafSet, vLeafNode[k]);
+		}
+
+		vLevel.swap(vNext);
+	}
+}
+
+// Find the optimal test for each node of a depth that is split
+void CRTree::optimizeLevel(vector<LevelNode>& vLevel, const vector<vector<int> >& vPos, unsigned int iter) {
+	unsigned int num_l = vPos.size();
+
+	// nodes that are split
+	vector<LevelNode*> vSplit;
+	for(unsigned int n=0; n<vLevel.size(); ++n)
+		if(vLevel[n].split)
+			vSplit.push_back(&vLevel[n]);
+
+	// Number of nodes per pass: histograms of all tests of a node
+	unsigned int num_bins = split_mode==1 ? TestHist::range : 11;
+	size_t node_memory = iter * (sizeof(TestHist) + num_bins*(num_l*sizeof(unsigned int) + (num_l-1)*num_cp*3*sizeof(double)));
+	unsigned int chunk = max(size_t(1), max_level_memory / node_memory);
+
+	vector<TestHist> vHist;
+	for(unsigned int first=0; first<vSplit.size(); first+=chunk) {
+		vector<LevelNode*> vChunk(vSplit.begin()+first, vSplit.begin()+min(first+chunk, (unsigned int)vSplit.size()));
+
+		// slot of each node of the depth in the chunk
+		vector<int> vSlot(vLevel.size(), -1);
+		for(unsigned int k=0; k<vChunk.size(); ++k)
+			vSlot[vChunk[k]-&vLevel[0]] = k;
+
+		vHist.resize(vChunk.size()*iter);
+		for(unsigned int k=0; k<vHist.size(); ++k)
+			vHist[k].init(num_l, num_cp, num_bins);
+
+		// Random thresholds depend on the min/max values of the tests
+		if(split_mode==0)
+			rangeLevel(vChunk, vSlot, vPos, iter);
+
+		// One pass over all patches
+		histLevel(vHist, vChunk, vSlot, vPos, iter);
+
+		// Find best test for each node (first one in case of equal measures)
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) if(num_threads>1)
+		for(int k=0; k<(int)vChunk.size(); ++k) {
+			LevelNode& ln = *vChunk[k];
+			double bestDist = -DBL_MAX;
+			double tmpDist;
+			ln.split = false;
+			for(unsigned int i=0; i<iter; ++i) {
+				int tr;
+				bool valid = split_mode==1 ? bestThreshold(vHist[k*iter+i], ln.measure_mode, tr, tmpDist) : randomThreshold(vHist[k*iter+i], ln, i, tr, tmpDist);
+				if(valid && tmpDist>bestDist) {
+					bestDist = tmpDist;
+					ln.split = true;
+					for(int t=0; t<5; ++t) ln.test[t] = ln.vTests[i*5+t];
+					ln.test[5] = tr;
+				}
+			}
+
+			// Release tests
+			vector<int>().swap(ln.vTests);
+			vector<unsigned int>().swap(ln.vRandThres);
+			vector<int>().swap(ln.vRange);
+			vector<int>().swap(ln.vThres);
+		}
+	}
+}
+
+// One pass over all patches: min/max test values and sorted random thresholds of the nodes in the chunk
+void CRTree::rangeLevel(vector<LevelNode*>& vChunk, const vector<int>& vSlot, const vector<vector<int> >& vPos, unsigned int iter) {
+	for(unsigned int k=0; k<vChunk.size(); ++k) {
+		vChunk[k]->vRange.resize(iter*2);
+		for(unsigned int i=0; i<iter; ++i) {
+			vChunk[k]->vRange[i*2] = INT_MAX;
+			vChunk[k]->vRange[i*2+1] = INT_MIN;
+		}
+	}
+
+	// Tests are split into blocks among the threads; every thread passes over all patches
+	int num_blocks = (iter+31)/32;
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) if(num_threads>1)
+	for(int b=0; b<num_blocks; ++b) {
+		unsigned int first = b*32;
+		unsigned int last = min(first+32, iter);
+		for(unsigned int l=0; l<vPos.size(); ++l) {
+			for(unsigned int i=0; i<vPos[l].size(); ++i) {
+				if(vPos[l][i]<0 || vSlot[vPos[l][i]]<0) continue;
+				LevelNode& ln = *vChunk[vSlot[vPos[l][i]]];
+				for(unsigned int k=first; k<last; ++k) {
+					int val = testValue(l, i, &ln.vTests[k*5]);
+					if(val<ln.vRange[k*2]) ln.vRange[k*2] = val;
+					if(val>ln.vRange[k*2+1]) ln.vRange[k*2+1] = val;
+				}
+			}
+		}
+	}
+
+	// Generate 10 random thresholds per test (sorted for binning)
+	for(unsigned int k=0; k<vChunk.size(); ++k) {
+		LevelNode& ln = *vChunk[k];
+		ln.vThres.assign(iter*10, 0);
+		for(unsigned int i=0; i<iter; ++i) {
+			int d = ln.vRange[i*2+1]-ln.vRange[i*2];
+			if(d<=0) continue;
+			for(unsigned int j=0; j<10; ++j)
+				ln.vThres[i*10+j] = (ln.vRandThres[i*10+j] % (d)) + ln.vRange[i*2];
+			sort(&ln.vThres[i*10], &ln.vThres[i*10+10]);
+		}
+	}
+}
+
+// One pass over all patches: histograms of the test values of the nodes in the chunk
+void CRTree::histLevel(vector<TestHist>& vHist, vector<LevelNode*>& vChunk, const vector<int>& vSlot, const vector<vector<int> >& vPos, unsigned int iter) {
+	for(unsigned int k=0; k<vHist.size(); ++k)
+		vHist[k].clear();
+
+	// Tests are split into blocks among the threads; every thread passes over all patches
+	int num_blocks = (iter+31)/32;
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) if(num_threads>1)
+	for(int b=0; b<num_blocks; ++b) {
+		unsigned int first = b*32;
+		unsigned int last = min(first+32, iter);
+		for(unsigned int l=0; l<vPos.size(); ++l) {
+			for(unsigned int i=0; i<vPos[l].size(); ++i) {
+				if(vPos[l][i]<0 || vSlot[vPos[l][i]]<0) continue;
+				int slot = vSlot[vPos[l][i]];
+				const LevelNode& ln = *vChunk[slot];
+
+				// offsets of positive patches
+				const CvPoint* center = l>0 ? trData->vLPatches[l].center(i) : 0;
+				for(unsigned int k=first; k<last; ++k) {
+					int val = testValue(l, i, &ln.vTests[k*5]);
+					// bin: value for exact search, number of thresholds <= value for random thresholds
+					int bin = split_mode==1 ? val + TestHist::off : upper_bound(&ln.vThres[k*10], &ln.vThres[k*10+10], val) - &ln.vThres[k*10];
+					vHist[slot*iter+k].add(bin, l, center);
+				}
+			}
+		}
+	}
+}
+
+// Best of the 10 random thresholds of test i from the histogram between the sorted thresholds
+bool CRTree::randomThreshold(const TestHist& hist, const LevelNode& ln, unsigned int i, int& thres, double& dist) {
+	bool found = false;
+	unsigned int num_l = hist.num_l;
+	unsigned int num_s = hist.num_s;
+	int d = ln.vRange[i*2+1]-ln.vRange[i*2];
+	if(d<=0) 
+		return false;
+
+	// cumulative counts and sums of the bins
+	vector<double> vCountCum((hist.num_bins+1)*num_l, 0);
+	vector<double> vSumCum((hist.num_bins+1)*num_s, 0);
+	for(unsigned int b=0; b<hist.num_bins; ++b) {
+		for(unsigned int l=0; l<num_l; ++l)
+			vCountCum[(b+1)*num_l+l] = vCountCum[b*num_l+l] + hist.vCount[b*num_l+l];
+		for(unsigned int k=0; k<num_s; ++k)
+			vSumCum[(b+1)*num_s+k] = vSumCum[b*num_s+k] + hist.vSum[b*num_s+k];
+	}
+	const double* countT = &vCountCum[hist.num_bins*num_l];
+	const double* sumT = &vSumCum[hist.num_bins*num_s];
+
+	vector<double> countB(num_l);
+	for(unsigned int j=0; j<10; ++j) {
+		int tr = (ln.vRandThres[i*10+j] % (d)) + ln.vRange[i*2];
+
+		// set A: value < tr, i.e., the bins up to the first sorted threshold equal to tr
+		unsigned int s = lower_bound(&ln.vThres[i*10], &ln.vThres[i*10+10], tr) - &ln.vThres[i*10] + 1;
+		const double* countA = &vCountCum[s*num_l];
+		double sizeA = 0;
+		double sizeB = 0;
+		for(unsigned int l=0; l<num_l; ++l) {
+			countB[l] = countT[l]-countA[l];
+			sizeA += countA[l];
+			sizeB += countB[l];
+		}
+
+		// Do not allow empty set split (all patches end up in set A or B)
+		if( sizeA>0 && sizeB>0 ) {
+			double tmpDist = measureSplit(countA, &countB[0], &vSumCum[s*num_s], sumT, num_l, ln.measure_mode);
+			if(!found || tmpDist>dist) {
+				found = true;
+				dist = tmpDist;
+				thres = tr;
+			}
+		}
+	}
+
+	return found;
+}
+
+void CRTree::refillLeaves(const CRPatch& TrData, bool append) {
+	unsigned int num_l = TrData.vLPatches.size();
+
+	// Leafs of a mapped tree are copied
+	if(leaf==0)
+		expandLeaves();
+
+	// Get ratios of the numbers of patches of the classes
+	classRatios(TrData);
+
+	// Pass patches through tree: number of patches per leaf (first entry) and class, positive patches per entry
+	vector<unsigned int> vCount(num_leaf*num_l, 0);
+	vector<vector<unsigned int> > vLeafPos(num_leaf);
+	for(unsigned int l=0; l<num_l; ++l) {
+		const PatchArena& patches = TrData.vLPatches[l];
+		vector<uchar*> ptFCh(patches.GetChannels());
+		for(unsigned int i=0; i<patches.size(); ++i) {
+			for(unsigned int c=0; c<ptFCh.size(); ++c)
+				ptFCh[c] = (uchar*)patches.channel(i, c);
+			unsigned int k = leafIndex(&ptFCh[0], patches.GetWidth());
+			++vCount[k*num_l+l];
+			if(l>0)
+				vLeafPos[k+l-1].push_back(i);
+		}
+	}
+
+	// Update leafs
+	unsigned int empty = 0;
+	for(unsigned int k=0; k<num_leaf; ++k) {
+		LeafNode* ptL = &leaf[k];
+		// class of the entry and patches of the leaf
+		unsigned int c = k%num_class + 1;
+		const unsigned int* count = &vCount[(k-c+1)*num_l];
+		double other = 0;
+		unsigned int size = 0;
+		for(unsigned int l=0; l<num_l; ++l) {
+			if(l!=c) other += vRatio[c*num_l+l]*double(count[l]);
+			size += count[l];
+		}
+		double pos = vLeafPos[k].size();
+
+		if(append) {
+			// Weight of the previous patches (normalized by the class ratios)
+			// Trees without weights: number of patches of the class / pfg (leafs without patches of the class count as one patch)
+			double old = ptL->weight>=0 ? ptL->weight : (ptL->pfg>0 ? ptL->vCenter.size()/ptL->pfg : 1.0);
+			double all = old + other + pos;
+			ptL->pfg = all>0 ? (ptL->pfg*old + pos) / all : 0;
+			ptL->weight = all;
+		} else if(size>0) {
+			ptL->pfg = other + pos>0 ? pos / (other + pos) : 0;
+			ptL->weight = float(other + pos);
+			ptL->vCenter.clear();
+		} else {
+			// No patches: keep previous statistics
+			if(c==1) ++empty;
+			continue;
+		}
+
+		for(unsigned int i=0; i<vLeafPos[k].size(); ++i) {
+			const CvPoint* center = TrData.vLPatches[c].center(vLeafPos[k][i]);
+			ptL->vCenter.push_back(vector<CvPoint>(center, center+num_cp));
+		}
+	}
+	vector<float>().swap(vRatio);
+
+	*out << "Refill " << num_leaf/num_class << " leafs: " << empty << " without patches" << endl;
+}
+
+bool CRTree::optimizeTest(const NodeSet& TrainSet, int* test, unsigned int iter, unsigned int measure_mode) {
+	
+	unsigned int num_l = TrainSet.begin.size();
+	const PatchArena& pos = trData->vLPatches[1];
+
+	// Generate ITER binary tests without threshold and 10 random numbers for thresholds per test
+	// All random numbers are drawn in advance such that the result does not depend on the number of threads
+	vector<int> vTests(iter*5);
+	vector<unsigned int> vRandThres(iter*10);
+	for(unsigned int i =0; i<iter; ++i) {
+		generateTest(&vTests[i*5], pos.GetWidth(), pos.GetHeight(), pos.GetChannels());
+		if(split_mode==0)
+			for(unsigned int j=0; j<10; ++j)
+				vRandThres[i*10+j] = cvRandInt( &cvRNG );
+	}
+
+	unsigned int size = 0;
+	for(unsigned int l =0; l<num_l; ++l)
+		size += TrainSet.size(l);
+
+	int best;
+	if(node_samples>0 && size>node_samples) {
+
+		// Score tests on a random subsample of the node
+		vector<vector<unsigned int> > vSample;
+		NodeSet SubSet;
+		subsample(SubSet, vSample, TrainSet);
+		best = bestTest(SubSet, &vTests[0], &vRandThres[0], iter, measure_mode, test[5]);
+
+		// Re-evaluate threshold of best test on all patches of the node
+		if(best>=0 && bestTest(TrainSet, &vTests[best*5], &vRandThres[best*10], 1, measure_mode, test[5])<0)
+			best = -1;
+
+	} else {
+
+		best = bestTest(TrainSet, &vTests[0], &vRandThres[0], iter, measure_mode, test[5]);
+
+	}
+
+	if(best>=0)
+		for(int k=0; k<5;++k) test[k] = vTests[best*5+k];
+
+	// return true if a valid test has been found
+	// test is invalid if only splits with an empty set A or B has been created
+	return best>=0;
+}
+
+// Random subsample of the node with node_samples patches (index order is kept)
+// Patches are sampled proportional to the classes or, if node_balance is set, equally per class
+void CRTree::subsample(NodeSet& SubSet, vector<vector<unsigned int> >& vSample, const NodeSet& TrainSet) {
+	unsigned int num_l = TrainSet.begin.size();
+	unsigned int size = 0;
+	for(unsigned int l =0; l<num_l; ++l)
+		size += TrainSet.size(l);
+
+	vSample.resize(num_l);
+	SubSet.begin.resize(num_l);
+	SubSet.end.resize(num_l);
+	*out << "Subsample";
+	for(unsigned int l =0; l<num_l; ++l) {
+		unsigned int num;
+		if(node_balance)
+			num = min(TrainSet.size(l), node_samples/num_l);
+		else
+			num = (unsigned int)((double)TrainSet.size(l)*node_samples/size);
+		// a class of the node is never dropped (no empty class in the scores of the tests)
+		if(num==0 && TrainSet.size(l)>0)
+			num = 1;
+
+		// partial Fisher-Yates shuffle
+		vSample[l].assign(TrainSet.begin[l], TrainSet.end[l]);
+		for(unsigned int i=0; i<num; ++i)
+			swap(vSample[l][i], vSample[l][i + cvRandInt( &cvRNG ) % (vSample[l].size()-i)]);
+		vSample[l].resize(num);
+		sort(vSample[l].begin(), vSample[l].end());
+
+		SubSet.begin[l] = num>0 ? &vSample[l][0] : 0;
+		SubSet.end[l] = SubSet.begin[l] + num;
+		*out << " " << num;
+	}
+	*out << endl;
+}
+
+// Find best of iter tests for the patches of TrainSet; returns index of test or -1 if no valid test is found
+int CRTree::bestTest(const NodeSet& TrainSet, const int* vTests, const unsigned int* vRandThres, unsigned int iter, unsigned int measure_mode, int& thres) {
+
+	unsigned int num_l = TrainSet.begin.size();
+
+	// Small nodes are optimized sequentially
+	unsigned int size = 0;
+	for(unsigned int l =0; l<num_l; ++l)
+		size += TrainSet.size(l);
+	int threads = size>=min_parallel ? num_threads : 1;
+
+	// Number of tests evaluated together (values of all patches per test for random thresholds)
+	int block = min(32, (int)iter);
+	if(split_mode==0 && size>0)
+		block = max(1, min(block, int(max_values / size)));
+	int num_blocks = (iter+block-1)/block;
+
+	// best test per thread: measure, test, threshold
+	vector<double> vBestDist(threads, -DBL_MAX);
+	vector<int> vBestTest(threads, -1);
+	vector<int> vBestThres(threads, 0);
+
+#pragma omp parallel num_threads(threads) if(threads>1)
+	{
+#ifdef _OPENMP
+	int thread = omp_get_thread_num();
+#else
+	int thread = 0;
+#endif
+
+	// temporary data for split into Set A and Set B: number of patches in A per class
+	vector<unsigned int> vSplit(num_l);
+
+	// temporary data for finding best test
+	vector<vector<vector<IntIndex> > > vValSet;
+	vector<TestHist> vHist;
+	if(split_mode==1) {
+		vHist.resize(block);
+		for(int k=0; k<block; ++k)
+			vHist[k].init(num_l, num_cp);
+	} else {
+		vValSet.resize(block, vector<vector<IntIndex> >(num_l));
+	}
+	double tmpDist;
+	// maximize!!!!
+	double& bestDist = vBestDist[thread];
+
+	// Find best test of ITER iterations
+	// Tests are evaluated in blocks with one pass over the patches of the node per block
+#pragma omp for schedule(dynamic)
+	for(int b =0; b<num_blocks; ++b) {
+		int first = b*block;
+		int num = min(block, (int)iter-first);
+
+		if(split_mode==1) {
+
+			// compute histograms of values and find best thresholds
+			evaluateHist(vHist, &vTests[first*5], num, TrainSet);
+
+			for(int k=0; k<num; ++k) {
+				int tr;
+				if( bestThreshold(vHist[k], measure_mode, tr, tmpDist) && tmpDist>bestDist ) {
+					bestDist = tmpDist;
+					vBestTest[thread] = first+k;
+					vBestThres[thread] = tr;
+				}
+			}
+
+			continue;
+		}
+
+		// compute value for each patch
+		evaluateTest(vValSet, &vTests[first*5], num, TrainSet);
+
+		for(int k=0; k<num; ++k) {
+			int i = first+k;
+			vector<vector<IntIndex> >& valSet = vValSet[k];
+
+			// find min/max values for threshold
+			int vmin = INT_MAX;
+			int vmax = INT_MIN;
+			for(unsigned int l = 0; l<num_l; ++l) {
+				if(valSet[l].size()>0) {
+					if(vmin>valSet[l].front().val)  vmin = valSet[l].front().val;
+					if(vmax<valSet[l].back().val )  vmax = valSet[l].back().val;
+				}
+			}
+			int d = vmax-vmin;
+
+			if(d>0) {
+
+				// Find best threshold
+				for(unsigned int j=0; j<10; ++j) { 
+
+					// Generate some random thresholds
+					int tr = (vRandThres[i*10+j] % (d)) + vmin; 
+
+					// Split training data into two sets A,B accroding to threshold t 
+					// (first patch with val>=t for each class)
+					IntIndex key;
+					key.val = tr;
+					unsigned int sizeA = 0;
+					unsigned int sizeB = 0;
+					for(unsigned int l = 0; l<num_l; ++l) {
+						vSplit[l] = lower_bound(valSet[l].begin(), valSet[l].end(), key) - valSet[l].begin();
+						sizeA += vSplit[l];
+						sizeB += valSet[l].size() - vSplit[l];
+					}
+
+					// Do not allow empty set split (all patches end up in set A or B)
+					if( sizeA>0 && sizeB>0 ) {
+
+						// Measure quality of split with measure_mode 0 - classification, 1 - regression
+						tmpDist = measureSet(valSet, vSplit, measure_mode);
+
+						// Take binary test with best split
+						// (iterations of a thread are increasing, i.e., the first best test is kept)
+						if(tmpDist>bestDist) {
+							bestDist = tmpDist;
+							vBestTest[thread] = i;
+							vBestThres[thread] = tr;
+						}
+
+					}
+
+				} // end for j
+
+			}
+
+		} // end block
+
+	} // end iter
+
+	} // end parallel
+
+	// Take best test of all threads (first one in case of equal measures)
+	double bestDist = -DBL_MAX;
+	int best = -1;
+	for(int t=0; t<threads; ++t) {
+		if(vBestTest[t]>=0 && (vBestDist[t]>bestDist || (vBestDist[t]==bestDist && vBestTest[t]<best))) {
+			bestDist = vBestDist[t];
+			best = vBestTest[t];
+			thres = vBestThres[t];
+		}
+	}
+
+	return best;
+}
+
+void CRTree::evaluateTest(std::vector<std::vector<std::vector<IntIndex> > >& valSet, const int* test, unsigned int num_tests, const NodeSet& TrainSet) {
+	for(unsigned int l=0;l<TrainSet.begin.size();++l) {
+		for(unsigned int k=0;k<num_tests;++k)
+			valSet[k][l].resize(TrainSet.size(l));
+
+		// patches are accessed in index order
+		for(unsigned int i=0;i<TrainSet.size(l);++i) {
+			unsigned int index = TrainSet.begin[l][i];
+			for(unsigned int k=0;k<num_tests;++k) {
+				valSet[k][l][i].val = testValue(l, index, &test[k*5]);
+				valSet[k][l][i].index = index;			
+			}
+		}
+
+		for(unsigned int k=0;k<num_tests;++k)
+			sort( valSet[k][l].begin(), valSet[k][l].end() );
+	}
+}
+
+// Partition the index range of each class in place (stable): A - p1-p2 < t, B - p1-p2 >= t
+void CRTree::split(NodeSet& SetA, NodeSet& SetB, const NodeSet& TrainSet, const int* test) {
+	unsigned int num_l = TrainSet.begin.size();
+	SetA.begin.resize(num_l); SetA.end.resize(num_l);
+	SetB.begin.resize(num_l); SetB.end.resize(num_l);
+
+	for(unsigned int l = 0; l<num_l; ++l) {
+		unsigned int* ptA = TrainSet.begin[l];
+		unsigned int* ptB = &vBuffer[0];
+		for(unsigned int* it = TrainSet.begin[l]; it != TrainSet.end[l]; ++it) {
+			if(testValue(l, *it, test) < test[5])
+				*(ptA++) = *it;
+			else
+				*(ptB++) = *it;
+		}
+		copy(&vBuffer[0], ptB, ptA);
+
+		SetA.begin[l] = TrainSet.begin[l];
+		SetA.end[l] = ptA;
+		SetB.begin[l] = ptA;
+		SetB.end[l] = TrainSet.end[l];
+	}
+}
+
+void CRTree::evaluateHist(std::vector<TestHist>& hist, const int* test, unsigned int num_tests, const NodeSet& TrainSet) {
+	for(unsigned int k=0;k<num_tests;++k)
+		hist[k].clear();
+
+	for(unsigned int l=0;l<TrainSet.begin.size();++l) {
+		// patches are accessed in index order
+		for(unsigned int* it = TrainSet.begin[l]; it != TrainSet.end[l]; ++it) {
+			// offsets of positive patches
+			const CvPoint* center = l>0 ? trData->vLPatches[l].center(*it) : 0;
+			for(unsigned int k=0;k<num_tests;++k)
+				hist[k].add(testValue(l, *it, &test[k*5]) + TestHist::off, l, center);
+		}
+	}
+}
+
+// Scan all thresholds between occupied bins; set A: value < thres
+// Same measures as measureSet: 0 - InfGain, 1 - (negative) distMean
+bool CRTree::bestThreshold(const TestHist& hist, unsigned int mode, int& thres, double& dist) {
+	bool found = false;
+	unsigned int num_l = hist.num_l;
+	unsigned int num_s = hist.num_s;
+
+	// totals and running sums of set A
+	vector<double> countT(num_l, 0), countA(num_l, 0), countB(num_l);
+	vector<double> sumT(num_s, 0), sumA(num_s, 0);
+	for(int b=hist.bmin; b<=hist.bmax; ++b) {
+		for(unsigned int l=0; l<num_l; ++l)
+			countT[l] += hist.vCount[b*num_l+l];
+		if(mode==1)
+			for(unsigned int k=0; k<num_s; ++k)
+				sumT[k] += hist.vSum[b*num_s+k];
+	}
+
+	int prev = -1;
+	for(int b=hist.bmin; b<=hist.bmax; ++b) {
+		// skip empty bins
+		unsigned int n = 0;
+		for(unsigned int l=0; l<num_l; ++l)
+			n += hist.vCount[b*num_l+l];
+		if(n==0) continue;
+
+		// split between previous and current occupied bin
+		if(prev>=0) {
+			for(unsigned int l=0; l<num_l; ++l)
+				countB[l] = countT[l]-countA[l];
+			double tmpDist = measureSplit(&countA[0], &countB[0], &sumA[0], &sumT[0], num_l, mode);
+
+			if(!found || tmpDist>dist) {
+				found = true;
+				dist = tmpDist;
+				// threshold in the middle of the two bins
+				thres = (prev+b+1)/2 - TestHist::off;
+			}
+		}
+
+		// add bin to set A
+		for(unsigned int l=0; l<num_l; ++l)
+			countA[l] += hist.vCount[b*num_l+l];
+		if(mode==1)
+			for(unsigned int k=0; k<num_s; ++k)
+				sumA[k] += hist.vSum[b*num_s+k];
+		prev = b;
+	}
+
+	return found;
+}
+
+// Measure of split from the class counts of A and B and the offset sums of A and of all patches (per object class)
+// 0 - InfGain, 1 - (negative) distMean
+double CRTree::measureSplit(const double* countA, const double* countB, const double* sumA, const double* sumT, unsigned int num_l, unsigned int mode) {
+	if(mode==0)
+		return InfGain(countA, countB, num_l);
+
+	// sum of squared distances to mean: sum x^2+y^2 - (sum x)^2/n - (sum y)^2/n
+	double dist = 0;
+	double size = 0;
+	for(unsigned int l=1; l<num_l; ++l, sumA+=num_cp*3, sumT+=num_cp*3) {
+		double nA = countA[l];
+		double nB = countB[l];
+		if(nA+nB==0) continue;
+		double minDist = DBL_MAX;
+		for(unsigned int c=0; c<num_cp; ++c) {
+			double distA = 0;
+			double distB = 0;
+			if(nA>0) distA = sumA[c*3+2] - (sumA[c*3]*sumA[c*3] + sumA[c*3+1]*sumA[c*3+1])/nA;
+			if(nB>0) {
+				double sx = sumT[c*3]-sumA[c*3];
+				double sy = sumT[c*3+1]-sumA[c*3+1];
+				distB = sumT[c*3+2]-sumA[c*3+2] - (sx*sx + sy*sy)/nB;
+			}
+			if(distA+distB < minDist) minDist = distA+distB;
+		}
+		dist += minDist;
+		size += nA+nB;
+	}
+	return -dist/size;
+}
+
+// Sum of squared distances of the offsets to their means for the sets A and B of all object classes
+// (minimum over center points per class normalized by number of positive patches)
+double CRTree::distMean(const std::vector<std::vector<IntIndex> >& valSet, const std::vector<unsigned int>& vSplit) {
+	double dist = 0;
+	double size = 0;
+	for(unsigned int l=1; l<valSet.size(); ++l) {
+		if(valSet[l].empty()) continue;
+		dist += distMean(valSet[l], vSplit[l], l);
+		size += valSet[l].size();
+	}
+	return dist/size;
+}
+
+// Sum of squared distances of the offsets of class label to their mean for the sets A: valSet[0,split) and B: valSet[split,end)
+// (minimum over center points)
+double CRTree::distMean(const std::vector<IntIndex>& valSet, unsigned int split, unsigned int label) {
+	vector<double> meanAx(num_cp,0);
+	vector<double> meanAy(num_cp,0);
+	for(unsigned int i=0; i<split; ++i) {
+		const CvPoint* center = trData->vLPatches[label].center(valSet[i].index);
+		for(unsigned int c = 0; c<num_cp; ++c) {
+			meanAx[c] += center[c].x;
+			meanAy[c] += center[c].y;
+		}
+	}
+
+	for(unsigned int c = 0; c<num_cp; ++c) {
+		meanAx[c] /= (double)split;
+		meanAy[c] /= (double)split;
+	}
+
+	vector<double> distA(num_cp,0);
+	for(unsigned int i=0; i<split; ++i) {
+		const CvPoint* center = trData->vLPatches[label].center(valSet[i].index);
+		for(unsigned int c = 0; c<num_cp; ++c) {
+			double tmp = center[c].x - meanAx[c];
+			distA[c] += tmp*tmp;
+			tmp = center[c].y - meanAy[c];
+			distA[c] += tmp*tmp;
+		}
+	}
+
+	vector<double> meanBx(num_cp,0);
+	vector<double> meanBy(num_cp,0);
+	for(unsigned int i=split; i<valSet.size(); ++i) {
+		const CvPoint* center = trData->vLPatches[label].center(valSet[i].index);
+		for(unsigned int c = 0; c<num_cp; ++c) {
+			meanBx[c] += center[c].x;
+			meanBy[c] += center[c].y;
+		}
+	}
+
+	for(unsigned int c = 0; c<num_cp; ++c) {
+		meanBx[c] /= (double)(valSet.size()-split);
+		meanBy[c] /= (double)(valSet.size()-split);
+	}
+
+	vector<double> distB(num_cp,0);
+	for(unsigned int i=split; i<valSet.size(); ++i) {
+		const CvPoint* center = trData->vLPatches[label].center(valSet[i].index);
+		for(unsigned int c = 0; c<num_cp; ++c) {
+			double tmp = center[c].x - meanBx[c];
+			distB[c] += tmp*tmp;
+			tmp = center[c].y - meanBy[c];
+			distB[c] += tmp*tmp;
+		}
+	}
+
+	double minDist = DBL_MAX;
+
+	for(unsigned int c = 0; c<num_cp; ++c) {
+		distA[c] += distB[c];
+		if(distA[c] < minDist) minDist = distA[c];
+	}
+
+	return minDist; 
+}
+
+double CRTree::InfGain(const vector<vector<IntIndex> >& valSet, const vector<unsigned int>& vSplit) {
+	// number of patches per class in set A and B
+	vector<double> countA(valSet.size());
+	vector<double> countB(valSet.size());
+	for(unsigned int l=0; l<valSet.size(); ++l) {
+		countA[l] = vSplit[l];
+		countB[l] = valSet[l].size() - vSplit[l];
+	}
+
+	return InfGain(&countA[0], &countB[0], valSet.size());
+}
+
+double CRTree::InfGain(const double* countA, const double* countB, unsigned int num_l) {
+
+	// get size of set A and B
+	double sizeA = 0;
+	double sizeB = 0;
+	for(unsigned int l=0; l<num_l; ++l) {
+		sizeA += countA[l];
+		sizeB += countB[l];
+	}
+
+	// negative entropy: sum_i p_i*log(p_i)
+	double n_entropyA = 0;
+	double n_entropyB = 0;
+	for(unsigned int l=0; l<num_l; ++l) {
+		double p = countA[l] / sizeA;
+		if(p>0) n_entropyA += p*log(p); 
+		p = countB[l] / sizeB;
+		if(p>0) n_entropyB += p*log(p); 
+	}
+
+	return (sizeA*n_entropyA+sizeB*n_entropyB)/(sizeA+sizeB); 
+}
+
+/////////////////////// IO functions /////////////////////////////
+
+void LeafNode::show(int delay, int width, int height) {
+	char buffer[200];
+
+	print();
+
+	if(vCenter.size()>0) {
+		vector<IplImage*> iShow(vCenter[0].size());
+		for(unsigned int c = 0; c<iShow.size(); ++c) {
+			iShow[c] = cvCreateImage( cvSize(width,height), IPL_DEPTH_8U , 1 );
+			cvSetZero( iShow[c] );
+			for(unsigned int i = 0; i<vCenter.size(); ++i) {
+				int y = height/2+vCenter[i][c].y;
+				int x = width/2+vCenter[i][c].x;
+
+				if(x>=0 && y>=0 && x<width && y<height)
+					cvSetReal2D( iShow[c],  y,  x, 255 );
+			}
+			sprintf_s(buffer,"Leaf%d",c);
+			cvNamedWindow(buffer,1);
+			cvShowImage(buffer, iShow[c]);
+		}
+		
+		cvWaitKey(delay);
+		
+		for(unsigned int c = 0; c<iShow.size(); ++c) {
+			sprintf_s(buffer,"Leaf%d",c);
+			cvDestroyWindow(buffer);
+			cvReleaseImage(&iShow[c]);
+		}
+	}
+}
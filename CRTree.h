@@ -1,150 +1,405 @@
-/* 
-// Author: Juergen Gall, BIWI, ETH Zurich
-// Email: gall@vision.ee.ethz.ch
-*/
-
-#pragma once
-
-#define sprintf_s sprintf 
-
-#include "CRPatch.h"
-#include <iostream>
-#include <fstream>
-
-// Auxilary structure
-struct IntIndex {
-	int val;
-	unsigned int index;
-	bool operator<(const IntIndex& a) const { return val<a.val; }
-};
-
-// Structure for the leafs
-struct LeafNode {
-	// Constructors
-	LeafNode() {}
-
-	// IO functions
-	void show(int delay, int width, int height); 
-	void print() const {
-		std::cout << "Leaf " << vCenter.size() << " "  << pfg << std::endl;
-	}
-
-	// Probability of foreground
-	float pfg;
-	// Vectors from object center to training patches
-	std::vector<std::vector<CvPoint> > vCenter;	
-};
-
-class CRTree {
-public:
-	// Constructors
-	CRTree(const char* filename);
-	CRTree(int min_s, int max_d, int cp, CvRNG* pRNG) : min_samples(min_s), max_depth(max_d), num_leaf(0), num_cp(cp), cvRNG(pRNG) {
-		num_nodes = (int)pow(2.0,int(max_depth+1))-1;
-		// num_nodes x 7 matrix as vector
-		treetable = new int[num_nodes * 7];
-		for(unsigned int i=0; i<num_nodes * 7; ++i) treetable[i] = 0;
-		// allocate memory for leafs
-		leaf = new LeafNode[(int)pow(2.0,int(max_depth))];
-	}
-	~CRTree() {delete[] leaf; delete[] treetable;}
-
-	// Set/Get functions
-	unsigned int GetDepth() const {return max_depth;}
-	unsigned int GetNumCenter() const {return num_cp;}
-
-	// Regression
-	const LeafNode* regression(uchar** ptFCh, int stepImg) const;
-
-	// Training
-	void growTree(const CRPatch& TrData, int samples);
-
-	// IO functions
-	bool saveTree(const char* filename) const;
-	void showLeaves(int width, int height) const {
-		for(unsigned int l=0; l<num_leaf; ++l)
-			leaf[l].show(5000, width, height);
-	}
-
-private: 
-
-	// Private functions for training
-	void grow(const std::vector<std::vector<const PatchFeature*> >& TrainSet, int node, unsigned int depth, int samples, float pnratio);
-	void makeLeaf(const std::vector<std::vector<const PatchFeature*> >& TrainSet, float pnratio, int node);
-	bool optimizeTest(std::vector<std::vector<const PatchFeature*> >& SetA, std::vector<std::vector<const PatchFeature*> >& SetB, const std::vector<std::vector<const PatchFeature*> >& TrainSet, int* test, unsigned int iter, unsigned int mode);
-	void generateTest(int* test, unsigned int max_w, unsigned int max_h, unsigned int max_c);
-	void evaluateTest(std::vector<std::vector<IntIndex> >& valSet, const int* test, const std::vector<std::vector<const PatchFeature*> >& TrainSet);
-	void split(std::vector<std::vector<const PatchFeature*> >& SetA, std::vector<std::vector<const PatchFeature*> >& SetB, const std::vector<std::vector<const PatchFeature*> >& TrainSet, const std::vector<std::vector<IntIndex> >& valSet, int t);
-	double measureSet(const std::vector<std::vector<const PatchFeature*> >& SetA, const std::vector<std::vector<const PatchFeature*> >& SetB, unsigned int mode) {
-	  if (mode==0) return InfGain(SetA, SetB); else return -distMean(SetA[1],SetB[1]);
-	}
-	double distMean(const std::vector<const PatchFeature*>& SetA, const std::vector<const PatchFeature*>& SetB);
-	double InfGain(const std::vector<std::vector<const PatchFeature*> >& SetA, const std::vector<std::vector<const PatchFeature*> >& SetB);
-
-
-	// Data structure
-
-	// tree table
-	// 2^(max_depth+1)-1 x 7 matrix as vector
-	// column: leafindex x1 y1 x2 y2 channel thres
-	// if node is not a leaf, leaf=-1
-	int* treetable;
-
-	// stop growing when number of patches is less than min_samples
-	unsigned int min_samples;
-
-	// depth of the tree: 0-max_depth
-	unsigned int max_depth;
-
-	// number of nodes: 2^(max_depth+1)-1
-	unsigned int num_nodes;
-
-	// number of leafs
-	unsigned int num_leaf;
-
-	// number of center points per patch
-	unsigned int num_cp;
-
-	//leafs as vector
-	LeafNode* leaf;
-
-	CvRNG *cvRNG;
-};
-
-inline const LeafNode* CRTree::regression(uchar** ptFCh, int stepImg) const {
-	// pointer to current node
-	const int* pnode = &treetable[0];
-	int node = 0;
-
-	// Go through tree until one arrives at a leaf, i.e. pnode[0]>=0)
-	while(pnode[0]==-1) {
-		// binary test 0 - left, 1 - right
-		// Note that x, y are changed since the patches are given as matrix and not as image 
-		// p1 - p2 < t -> left is equal to (p1 - p2 >= t) == false
-		
-		// pointer to channel
-		uchar* ptC = ptFCh[pnode[5]];
-		// get pixel values 
-		int p1 = *(ptC+pnode[1]+pnode[2]*stepImg);
-		int p2 = *(ptC+pnode[3]+pnode[4]*stepImg);
-		// test
-		bool test = ( p1 - p2 ) >= pnode[6];
-
-		// next node: 2*node_id + 1 + test
-		// increment node/pointer by node_id + 1 + test
-		int incr = node+1+test;
-		node += incr;
-		pnode += incr*7;
-	}
-
-	// return leaf
-	return &leaf[pnode[0]];
-}
-
-inline void CRTree::generateTest(int* test, unsigned int max_w, unsigned int max_h, unsigned int max_c) {
-	test[0] = cvRandInt( cvRNG ) % max_w;
-	test[1] = cvRandInt( cvRNG ) % max_h;
-	test[2] = cvRandInt( cvRNG ) % max_w;
-	test[3] = cvRandInt( cvRNG ) % max_h;
-	test[4] = cvRandInt( cvRNG ) % max_c;
-}
+/* 
+// Author: Juergen Gall, BIWI, ETH Zurich
+// Email: gall@vision.ee.ethz.ch
+*/
+
+#pragma once
+
+#define sprintf_s sprintf 
+
+#include "CRPatch.h"
+#include "CRProfile.h"
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <ctime>
+
+// Auxilary structure
+struct IntIndex {
+	int val;
+	unsigned int index;
+	bool operator<(const IntIndex& a) const { return val<a.val; }
+};
+
+// Training patches of a node: range [begin[l], end[l]) of the index array of class l
+struct NodeSet {
+	std::vector<unsigned int*> begin;
+	std::vector<unsigned int*> end;
+	unsigned int size(unsigned int l) const {return end[l]-begin[l];}
+};
+
+// Histogram of test values for threshold search
+// exact search: one bin per value p1-p2 in [-255,255]; random thresholds: bins between the sorted thresholds
+struct TestHist {
+	enum { range = 511, off = 255 };
+
+	void init(unsigned int classes, unsigned int cp, unsigned int n = range) {
+		num_bins = n;
+		num_l = classes;
+		num_cp = cp;
+		num_s = (num_l-1)*num_cp*3;
+		vCount.resize(num_bins*num_l);
+		vSum.resize(num_bins*num_s);
+	}
+	void clear() {
+		std::fill(vCount.begin(), vCount.end(), 0);
+		std::fill(vSum.begin(), vSum.end(), 0.0);
+		bmin = num_bins; bmax = -1;
+	}
+	// add patch of class l to bin b (center points only for positive patches)
+	void add(int b, unsigned int l, const CvPoint* center) {
+		if(b<bmin) bmin = b;
+		if(b>bmax) bmax = b;
+		++vCount[b*num_l+l];
+		if(center!=0) {
+			double* ptS = &vSum[b*num_s+(l-1)*num_cp*3];
+			for(unsigned int c=0; c<num_cp; ++c, ptS+=3) {
+				ptS[0] += center[c].x;
+				ptS[1] += center[c].y;
+				ptS[2] += center[c].x*center[c].x + center[c].y*center[c].y;
+			}
+		}
+	}
+
+	unsigned int num_bins;
+	unsigned int num_l;
+	unsigned int num_cp;
+	// number of sums per bin: num_cp*3 per object class
+	unsigned int num_s;
+	// min/max occupied bin
+	int bmin, bmax;
+	// number of patches per bin and class
+	std::vector<unsigned int> vCount;
+	// sum of offsets x, y and of squared offsets per bin, object class and center point (positive patches)
+	std::vector<double> vSum;
+};
+
+// Node on the stack of depth-first growing: range [begin[l], end[l]) of the index array of class l
+struct StackNode {
+	int node;
+	unsigned int depth;
+	// true if node becomes a leaf (not enough patches)
+	bool leaf;
+	std::vector<unsigned int> begin;
+	std::vector<unsigned int> end;
+};
+
+// Node of the current depth for level-wise growing
+struct LevelNode {
+	// index in tree table
+	int node;
+	// number of patches per class
+	std::vector<unsigned int> vCount;
+	// true if a test is searched for the node; false if it becomes a leaf
+	bool split;
+	// measure mode for split: 0 - classification, 1 - regression
+	unsigned int measure_mode;
+	// random tests, random numbers for thresholds, min/max test values, sorted thresholds
+	std::vector<int> vTests;
+	std::vector<unsigned int> vRandThres;
+	std::vector<int> vRange;
+	std::vector<int> vThres;
+	// best test: x1 y1 x2 y2 channel thres
+	int test[6];
+};
+
+// Structure for the leafs
+struct LeafNode {
+	// Constructors
+	LeafNode() : weight(-1) {}
+
+	// IO functions
+	void show(int delay, int width, int height); 
+	void print() const {
+		std::cout << "Leaf " << vCenter.size() << " "  << pfg << std::endl;
+	}
+
+	// Probability of foreground
+	float pfg;
+	// Number of training patches of the leaf normalized by the class ratios, i.e., patches of the class 
+	// plus weighted patches of the other classes (-1: unknown, trees saved without it)
+	float weight;
+	// Vectors from object center to training patches
+	std::vector<std::vector<CvPoint> > vCenter;	
+};
+
+// Leaf of the flat representation used for detection
+// votes [first, first+count) of the vote array of the tree with num_cp offsets per vote
+// A leaf of a tree with several object classes consists of one entry per class (see CRTree::regression)
+struct FlatLeaf {
+	// Probability of foreground (of the class of the entry)
+	float pfg;
+	// Number of votes (positive patches) and index of first vote
+	unsigned int count;
+	unsigned int first;
+};
+
+// Version of the binary tree file; increase whenever the layout changes
+#define CRTREE_VERSION 4
+
+class CRTree {
+public:
+	// Constructors
+	// Read tree from text file or map binary tree file (see saveBinary)
+	CRTree(const char* filename);
+	// Tree in binary format in memory that stays valid while the tree is used (see binaryTree)
+	CRTree(const void* data, size_t length);
+	// Tree for classes object classes (labels 1..classes of the training data, label 0: background)
+	CRTree(int min_s, int max_d, int cp, CvRNG seed, int classes = 1) : min_samples(min_s), max_depth(max_d), num_leaf(0), num_cp(cp), num_class(classes), flatleaf(0), votes(0), weights(0), mapped(false), map_addr(0), map_length(0), cvRNG(seed), out(&std::cout), trData(0), num_threads(1), split_mode(0), grow_mode(0), node_samples(0), node_balance(false), ckpt_interval(0), ckpt_data(0) {
+		num_nodes = (int)pow(2.0,int(max_depth+1))-1;
+		// num_nodes x 7 matrix as vector
+		treetable = new int[num_nodes * 7];
+		for(unsigned int i=0; i<num_nodes * 7; ++i) treetable[i] = 0;
+		// allocate memory for leafs (one entry per class)
+		leaf = new LeafNode[(int)pow(2.0,int(max_depth))*num_class];
+	}
+	~CRTree();
+
+	// Set/Get functions
+	unsigned int GetDepth() const {return max_depth;}
+	unsigned int GetNumCenter() const {return num_cp;}
+	unsigned int GetNumClasses() const {return num_class;}
+	// Channels used by the tests (bit c: channel c)
+	unsigned int usedChannels() const;
+	// Stream for training output (default: cout)
+	void SetLog(std::ostream* log) {out = log;}
+	// Number of threads for evaluating the tests of a node (default: 1)
+	void SetThreads(int n) {num_threads = n>0 ? n : 1;}
+	// Threshold search: 0 - 10 random thresholds per test (default), 1 - exact search over all thresholds
+	void SetSplitMode(int mode) {split_mode = mode;}
+	// Tree growing: 0 - depth-first (default), 1 - level-wise with one pass over all patches per depth
+	void SetGrowMode(int mode) {grow_mode = mode;}
+	// Tests of nodes with more than n patches are scored on a random subsample of n patches (default 0: all patches)
+	// balance: same number of patches per class instead of proportional
+	void SetNodeSamples(unsigned int n, bool balance) {node_samples = n; node_balance = balance;}
+	// Save state of training to file every interval seconds (default 0: no checkpoints) 
+	// growTree continues from the file if it exists
+	void SetCheckpoint(const std::string& filename, int interval) {ckpt_file = filename; ckpt_interval = interval;}
+
+	// Regression (only for loaded trees)
+	// Entry of class 1 of the leaf; the entries of the classes 1..num_class follow each other
+	const FlatLeaf* regression(uchar** ptFCh, int stepImg) const {return &flatleaf[leafIndex(ptFCh, stepImg)];}
+	// Votes of a leaf: num_cp offsets per vote
+	const CvPoint* GetVotes(const FlatLeaf* pLeaf) const {return &votes[pLeaf->first*num_cp];}
+	// Number of leafs, index of the leaf of an entry (see regression) and entry of class 1 of leaf with index id
+	unsigned int GetNumLeafs() const {return num_leaf/num_class;}
+	unsigned int leafId(const FlatLeaf* pLeaf) const {return (pLeaf-flatleaf)/num_class;}
+	const FlatLeaf* GetLeaf(unsigned int id) const {return &flatleaf[id*num_class];}
+
+	// Training
+	void growTree(const CRPatch& TrData, int samples);
+	// Recompute the leafs from training patches without changing the tests (append: add patches to the leafs)
+	void refillLeaves(const CRPatch& TrData, bool append);
+
+	// IO functions
+	bool saveTree(const char* filename) const;
+	// Binary tree file that is mapped instead of parsed when loaded:
+	// header | tree table | leafs | votes | leaf weights, checksum of data and byte order in header
+	// encoding 1: compressed tree table and leafs with the first center point only, decoded when loaded
+	bool saveBinary(const char* filename, int encoding = 0) const;
+	// Binary tree file in memory
+	void binaryTree(std::vector<char>& vData, int encoding = 0) const;
+	// Checksum of binary trees
+	static unsigned long long checksum(const void* data, size_t bytes);
+	// Checksum of the tree table, i.e., of the tests and the leafs the patches reach (see CRLeafMaps)
+	unsigned long long testChecksum() const {return checksum(treetable, num_nodes*7*sizeof(int));}
+	// Check whether file contains a complete tree
+	static bool checkTree(const char* filename);
+	void showLeaves(int width, int height) const;
+
+	// Microbenchmarks (CRBenchmark.cpp) and reference implementations (CRReference.cpp)
+	friend class CRBenchmark;
+	friend class CRReference;
+
+private: 
+
+	// Leaf index for patch
+	int leafIndex(uchar** ptFCh, int stepImg) const;
+
+	// Flat leafs and votes
+	void flattenLeaves(std::vector<FlatLeaf>& vFL, std::vector<CvPoint>& vV) const;
+	void expandLeaves();
+	bool mapTree(const char* filename);
+	bool setBinary(const void* addr, size_t length);
+	bool checkTables(unsigned int num_votes) const;
+	void encodeNodes(std::vector<uchar>& vData) const;
+	bool decodeNodes(const uchar* data, size_t length);
+	void encodeLeaves(std::vector<uchar>& vData, const FlatLeaf* ptL, const CvPoint* ptV) const;
+	bool decodeLeaves(const uchar* data, size_t length, unsigned int num_votes);
+
+	// Private functions for training
+	void grow(int samples);
+	void makeLeaf(const NodeSet& TrainSet, int node);
+	void classRatios(const CRPatch& TrData);
+	bool optimizeTest(const NodeSet& TrainSet, int* test, unsigned int iter, unsigned int mode);
+	int bestTest(const NodeSet& TrainSet, const int* vTests, const unsigned int* vRandThres, unsigned int iter, unsigned int mode, int& thres);
+	void subsample(NodeSet& SubSet, std::vector<std::vector<unsigned int> >& vSample, const NodeSet& TrainSet);
+	void generateTest(int* test, unsigned int max_w, unsigned int max_h, unsigned int max_c);
+	int testValue(unsigned int label, unsigned int index, const int* test) const;
+	void evaluateTest(std::vector<std::vector<std::vector<IntIndex> > >& valSet, const int* test, unsigned int num_tests, const NodeSet& TrainSet);
+	void split(NodeSet& SetA, NodeSet& SetB, const NodeSet& TrainSet, const int* test);
+	double measureSet(const std::vector<std::vector<IntIndex> >& valSet, const std::vector<unsigned int>& vSplit, unsigned int mode) {
+	  if (mode==0) return InfGain(valSet, vSplit); else return -distMean(valSet, vSplit);
+	}
+	double distMean(const std::vector<std::vector<IntIndex> >& valSet, const std::vector<unsigned int>& vSplit);
+	double distMean(const std::vector<IntIndex>& valSet, unsigned int split, unsigned int label);
+	double InfGain(const std::vector<std::vector<IntIndex> >& valSet, const std::vector<unsigned int>& vSplit);
+	static double InfGain(const double* countA, const double* countB, unsigned int num_l);
+
+	// Exact threshold search
+	void evaluateHist(std::vector<TestHist>& hist, const int* test, unsigned int num_tests, const NodeSet& TrainSet);
+	bool bestThreshold(const TestHist& hist, unsigned int mode, int& thres, double& dist);
+	double measureSplit(const double* countA, const double* countT, const double* sumA, const double* sumT, unsigned int num_l, unsigned int mode);
+
+	// Checkpoints
+	void saveCheckpoint(const std::vector<std::vector<int> >& vPos, const std::vector<LevelNode>& vLevel, bool force);
+	void loadCheckpoint(std::vector<std::vector<int> >& vPos, std::vector<LevelNode>& vLevel);
+
+	// Level-wise growing
+	void growLevels(int samples);
+	void optimizeLevel(std::vector<LevelNode>& vLevel, const std::vector<std::vector<int> >& vPos, unsigned int iter);
+	void rangeLevel(std::vector<LevelNode*>& vChunk, const std::vector<int>& vSlot, const std::vector<std::vector<int> >& vPos, unsigned int iter);
+	void histLevel(std::vector<TestHist>& vHist, std::vector<LevelNode*>& vChunk, const std::vector<int>& vSlot, const std::vector<std::vector<int> >& vPos, unsigned int iter);
+	bool randomThreshold(const TestHist& hist, const LevelNode& ln, unsigned int i, int& thres, double& dist);
+
+
+	// Data structure
+
+	// tree table
+	// 2^(max_depth+1)-1 x 7 matrix as vector
+	// column: leafindex x1 y1 x2 y2 channel thres
+	// if node is not a leaf, leaf=-1
+	int* treetable;
+
+	// stop growing when number of patches is less than min_samples
+	unsigned int min_samples;
+
+	// depth of the tree: 0-max_depth
+	unsigned int max_depth;
+
+	// number of nodes: 2^(max_depth+1)-1
+	unsigned int num_nodes;
+
+	// number of leafs (entries of all classes)
+	unsigned int num_leaf;
+
+	// number of center points per patch
+	unsigned int num_cp;
+
+	// number of object classes: entries per leaf
+	unsigned int num_class;
+
+	//leafs as vector (0 for mapped trees)
+	LeafNode* leaf;
+
+	// flat leafs and votes for detection: point into the mapped file or to vFlatLeaf/vVotes (text or compressed trees)
+	const FlatLeaf* flatleaf;
+	const CvPoint* votes;
+	std::vector<FlatLeaf> vFlatLeaf;
+	std::vector<CvPoint> vVotes;
+	// weights of the leafs of a binary tree for refilling (see LeafNode; 0: text tree or unknown)
+	const float* weights;
+
+	// tree table and leafs point into a binary tree (not owned)
+	bool mapped;
+	// mapped binary tree file (0: not mapped by the tree)
+	void* map_addr;
+	size_t map_length;
+
+	// random generator of the tree
+	CvRNG cvRNG;
+
+	// training output
+	std::ostream* out;
+
+	// training data (only set during training)
+	const CRPatch* trData;
+	// ratio of the number of training patches of class c and class l (c*num_l+l) for the class probabilities
+	std::vector<float> vRatio;
+	// patch indices for each class; every node owns a range of it
+	std::vector<std::vector<unsigned int> > vIndex;
+	// start of the patch indices of class l (0 for a class without patches)
+	unsigned int* indexBase(unsigned int l) {return vIndex[l].empty() ? 0 : &vIndex[l][0];}
+	// buffer for partitioning a range
+	std::vector<unsigned int> vBuffer;
+	// nodes that still have to be grown (depth-first)
+	std::vector<StackNode> vStack;
+
+	// number of threads for evaluating tests
+	int num_threads;
+
+	// threshold search: 0 - random, 1 - exact
+	int split_mode;
+
+	// tree growing: 0 - depth-first, 1 - level-wise
+	int grow_mode;
+
+	// size of subsample for scoring tests (0: all patches) and class balance of subsample
+	unsigned int node_samples;
+	bool node_balance;
+
+	// checkpoint file, interval in seconds, time of last checkpoint, and checksum of the training data
+	std::string ckpt_file;
+	int ckpt_interval;
+	time_t ckpt_time;
+	unsigned long long ckpt_data;
+
+	// nodes with less patches are optimized sequentially
+	static const unsigned int min_parallel = 2000;
+
+	// maximum number of test values per thread that are kept for a block of tests
+	static const unsigned int max_values = 4000000;
+
+	// maximum memory in bytes for the histograms of a pass in level-wise growing (nodes are processed in chunks)
+	static const size_t max_level_memory = 1<<30;
+};
+
+inline int CRTree::leafIndex(uchar** ptFCh, int stepImg) const {
+	// pointer to current node
+	const int* pnode = &treetable[0];
+	int node = 0;
+
+	// Go through tree until one arrives at a leaf, i.e. pnode[0]>=0)
+	while(pnode[0]==-1) {
+		// binary test 0 - left, 1 - right
+		// Note that x, y are changed since the patches are given as matrix and not as image 
+		// p1 - p2 < t -> left is equal to (p1 - p2 >= t) == false
+		
+		// pointer to channel
+		uchar* ptC = ptFCh[pnode[5]];
+		// get pixel values 
+		int p1 = *(ptC+pnode[1]+pnode[2]*stepImg);
+		int p2 = *(ptC+pnode[3]+pnode[4]*stepImg);
+		// test
+		bool test = ( p1 - p2 ) >= pnode[6];
+
+		// next node: 2*node_id + 1 + test
+		// increment node/pointer by node_id + 1 + test
+		int incr = node+1+test;
+		node += incr;
+		pnode += incr*7;
+		CR_PROFILE_COUNT(COUNT_NODES, 1);
+	}
+
+	// return leaf
+	return pnode[0];
+}
+
+// Value p1 - p2 of binary test for patch index of class label
+inline int CRTree::testValue(unsigned int label, unsigned int index, const int* test) const {
+	const PatchArena& patches = trData->vLPatches[label];
+	// pointer to channel
+	const uchar* ptC = patches.channel(index, test[4]);
+	// get pixel values 
+	int p1 = ptC[test[0] + test[1]*patches.GetWidth()];
+	int p2 = ptC[test[2] + test[3]*patches.GetWidth()];
+	return p1 - p2;
+}
+
+inline void CRTree::generateTest(int* test, unsigned int max_w, unsigned int max_h, unsigned int max_c) {
+	test[0] = cvRandInt( &cvRNG ) % max_w;
+	test[1] = cvRandInt( &cvRNG ) % max_h;
+	test[2] = cvRandInt( &cvRNG ) % max_w;
+	test[3] = cvRandInt( &cvRNG ) % max_h;
+	test[4] = cvRandInt( &cvRNG ) % max_c;
+}